@@ -1,17 +1,18 @@
 #include <Command.h>
 #include <stdlib.h>
-#include <math.h>
+#include <string.h>
 
-int Command :: checkSize(int size)
+Command :: Command()
 {
-	if(size < 128) return size;
-	
-	int result;
-	
-	result = ((size-2)/128)-1;
-	result = result | 0x80; //Set first bit 1
-	
-	return result;
+	custom.bits = 0;
+	setCurveRounding(FP_ROUND_TRUNCATE, 0);
+}
+
+void Command :: setCurveRounding(enum fp_rounding mode, unsigned int seed)
+{
+	rounding = mode;
+	ditherSeed = seed;
+	fp_dither_init(&dither, seed);
 }
 
 int Command :: checkSize(char size)
@@ -28,28 +29,37 @@ int Command :: checkSize(char size)
 
 //Default: 18 bits
 unsigned int Command :: valueToBytes(double value)
-{			
-	unsigned int result = (unsigned int) ((value+10)*262143)/20.0;	
-	return result;
+{
+	return fp_to_code(&fp_codec_bipolar_18, value);
 }
 
 //Default: 18 bits
 float Command :: bytesToValue(unsigned int bytes)
 {
-	float result = ((20*bytes)/262143.0)-10;
-	return result;
+	return fp_from_code(&fp_codec_bipolar_18, bytes);
 }
 
 unsigned int Command :: valueToBytes(double value, int bits)
 {
-	unsigned int result = (unsigned int) ((value+10)*(pow(2, (double)bits)-1))/20.0;
-	return result;
+	return fp_to_code(codec(bits), value);
 }
 
 float Command :: bytesToValue (unsigned int bytes, int bits)
 {
-	float result = ((20*bytes)/(pow(2, (double) bits)-1)) -10;
-	return result;
+	return fp_from_code(codec(bits), bytes);
+}
+
+//Widths without a predefined codec get one built on first use
+const struct fp_codec * Command :: codec(int bits)
+{
+	const struct fp_codec * result = fp_codec_bipolar(bits);
+
+	if(result) return result;
+
+	if(custom.bits != bits)
+		fp_codec_init(&custom, bits, 0, -10.0, 10.0, FP_BIG_ENDIAN);
+
+	return &custom;
 }
 
 double Command :: readingVariable(char * header, char * payload,int simple)
@@ -83,212 +93,131 @@ double Command :: readingVariable(char * header, char * payload,int simple)
 	
 }
 
-double * Command :: readingCurve(char * packet)
+size_t Command :: readingCurve(char * packet, epicsFloat64 * values, size_t nElements)
 {
 	/*
-	   Payload: Byte 4 to byte 16389
-	   Points by offset: 8192
+	   Payload: Byte 4 to byte 16389, curve id and block offset first
+	   Points by offset: 8192, from byte 6
         */
-	printf("Reading curve\n");
+	if(nElements > CURVE_POINTS) nElements = CURVE_POINTS;
 
-	double * result;
-	int i, j, iresult=0;
-	unsigned int temp = 0;
+	fp_decode_array(&fp_codec_bipolar_16, (uint8_t *) packet + 6, values, nElements);
 
-	result = (double*) malloc(8192*sizeof(double));
+	return nElements;
+}
 
-	for(i = 4; i < 16390; i+=2)
-	{
-		temp = 0;
+int Command :: readVariable(char * buffer, int address, int id, int simple)
+{
+	typedef PacketBuilder<READ_VARIABLE> Packet;
 
-		for(j = 0; j < 2; j++)
- 		{
-			temp = temp << 8;
-			temp += packet[i+j];			
-		}
+	printf("Read id = %d\n", id);
 
-		result[iresult++] = bytesToValue(temp & 0xFFFF, 16);
-	}
+	char * payload = Packet::begin(buffer, address, 1, simple);
+	payload[0] = id & 0xFF;
 
-	return result;
+	return Packet::finish(buffer, 1, simple);
 }
 
-char * Command :: readVariable(int address, int id, int * bytesToWrite,int simple)
+int Command :: readCurve(char * buffer, int address, int id, int offset)
 {
-	char * result;
-	int i;
-	printf("Read id = %d\n", id);
-	unsigned int check = 0;
-	
-	
-	/*
-	    Packet: Address (1 byte), origin (1 byte), command (1 byte), size (1 byte), 
-	    payload (1 byte), checksum (1 byte)	 
-	*/
-	if(!simple){
-		result = (char *) malloc(6*sizeof(char));
-		*bytesToWrite = 6*sizeof(char);
-		
-		result[0] = address & 0xFF;
-		result[1] = 0;
-		result[2] = READ_VARIABLE;
-		result[3] = 1;
-		result[4] = id & 0xFF;
-		
-		for(i = 0; i <= 4; i++) check += result[i];
-		
-		//Checksum
-		result[5] = 0x100 - (check & 0xFF);
-		printf("Send: %d | %d | %d | %d | %d | %u\n", result[0], result[1], result[2], result[3], result[4], result[5] & 0xFF);	
-	}
-	else{
-		result = (char *) malloc(3*sizeof(char));
-		*bytesToWrite = 3*sizeof(char);
-		
-		result[0] = READ_VARIABLE;
-		result[1] = 1;
-		result[2] = id & 0xFF;
-		printf("Send: %d | %d | %d \n", result[0], result[1], result[2] & 0xFF);	
-	}
-	fflush(stdout);
-	return result;
-}
+	typedef PacketBuilder<TRANSMIT_BLOCK_CURVE> Packet;
 
-char * Command :: readCurve(int address, int size, int id, int offset, int * bytesToWrite)
-{
-	/*
-	   Packet: Address (1 byte), origin (1 byte), command (1 byte), size (1 byte), payload (2 bytes),
-	   checksum (1 byte)
-	*/
+	char * payload = Packet::begin(buffer, address, 2, false);
+	payload[0] = id & 0xFF;
+	payload[1] = offset & 0xFF;
 
-	char * result;
-	unsigned int check = 0;
-	int i;
-	result = (char *) malloc (7*sizeof(char));
-	*bytesToWrite = 7*sizeof(char);
+	return Packet::finish(buffer, 2, false);
+}
 
-	result[0] = address & 0xFF;
- 	result[1] = 0;
-	result[2] = TRANSMIT_BLOCK_CURVE;
-	result[3] = checkSize(size);
-	result[4] = id & 0xFF;
-	result[5] = offset & 0xFF;
+int Command :: writeCurveBlock(char * buffer, int address, int id, int offset, epicsFloat64 * values, size_t nElements)
+{
+	typedef PacketBuilder<BLOCK_CURVE> Packet;
 
-	for(i = 0; i <= 5; i++) check += result[i];
+	char * payload = Packet::begin(buffer, address, CURVE_PAYLOAD, false);
+	payload[0] = id & 0xFF;
+	payload[1] = offset & 0xFF;
 
-	result[6] = 0x100 - (check & 0xFF);
+	//If the number of points is smaller than 8192, the last bytes will be 0
+	if(nElements > CURVE_POINTS) nElements = CURVE_POINTS;
 
-	printf("Send: %d | %d | %d | %d | %d | %d | %u\n", result[0], result[1], result[2], result[3], result[4], result[5], result[6]&0xFF);
+	fp_quantize_array(&fp_codec_bipolar_16, values, (uint8_t *) payload + 2, nElements, rounding, &dither);
+	memset(payload + 2 + 2*nElements, 0, 2*(CURVE_POINTS - nElements));
 
-	fflush(stdout);
-	return result;	
+	return Packet::finish(buffer, CURVE_PAYLOAD, false);
 }
 
-char * Command :: writeCurveBlock(int address, int size, int id, int offset, epicsFloat64 * values, size_t nElements, int * bytesToWrite)
+int Command :: writeCurveBlocks(std::vector<char> &frames, int address, int id, const epicsFloat64 * values, size_t nElements)
 {
-	/*
-	   Packet: Address (1 byte), origin (1 byte), command (1 byte), size (1 byte),
-	   payload (size bytes), checksum (1 byte)	
-	*/
-	
-	char * result;
-	size_t i, ibuf;
-	unsigned int bytes;
-	
-	
-	result = (char *) malloc ((5+size)*sizeof(char));
-	*bytesToWrite = (5+size)*sizeof(char);
-	
-	result[0] = address & 0xFF;
-	result[1] = 0;
-	result[2] = BLOCK_CURVE;
-	result[3] = checkSize(size);
-	result[4] = id & 0xFF;
-	result[5] = offset & 0xFF;
-	ibuf = 6;
-	
-	//8192 point by offset. Each value have 2 bytes. Total payload = (points*2)+offset+id -> Total payload = 8192*2+1+1
-	//Total payload = 16386
-	//If the number of points is smallest than 8192, the last bytes will byte 0
-	
-	for(i = 0; i < nElements; i++)
+	typedef PacketBuilder<BLOCK_CURVE> Packet;
+
+	//Offset is a single byte
+	if(nElements > 256*(size_t) CURVE_POINTS) nElements = 256*CURVE_POINTS;
+
+	size_t full = nElements/CURVE_POINTS;
+	size_t tail = nElements%CURVE_POINTS;
+	size_t count = full + (tail || !full ? 1 : 0);
+	std::vector<const double *> blockValues(count);
+	std::vector<uint8_t *> samples(count);
+	size_t i;
+
+	frames.resize(count*CURVE_BLOCK_SIZE);
+
+	for(i = 0; i < count; i++)
 	{
-		
-		bytes = valueToBytes(values[i], 16) & 0xFFFF;
-		result[ibuf++] = (bytes >> 8) & 0xFF;
-		result[ibuf++] = bytes & 0xFF;
+		char * payload = Packet::begin(&frames[i*CURVE_BLOCK_SIZE], address, CURVE_PAYLOAD, false);
+		payload[0] = id & 0xFF;
+		payload[1] = i & 0xFF;
+
+		blockValues[i] = values + i*CURVE_POINTS;
+		samples[i] = (uint8_t *) payload + 2;
 	}
-	
-	if(nElements < 8192)
-		for(i = ibuf; i < 16390; i++) result[i] = 0;		
-	
-	//Checksum 0	
-	result[16390] = 0;	
-	
-	//16391 bytes
-	return result;
+
+	fp_quantize_blocks(&fp_codec_bipolar_16, blockValues.data(), samples.data(), CURVE_POINTS, full, rounding, ditherSeed);
+
+	//The last block, if short, ends in zeros
+	if(full < count)
+	{
+		struct fp_dither last;
+
+		fp_dither_init(&last, ditherSeed + full);
+		fp_quantize_array(&fp_codec_bipolar_16, blockValues[full], samples[full], tail, rounding, &last);
+		memset(samples[full] + 2*tail, 0, 2*(CURVE_POINTS - tail));
+	}
+
+	for(i = 0; i < count; i++)
+		Packet::finish(&frames[i*CURVE_BLOCK_SIZE], CURVE_PAYLOAD, false);
+
+	return count;
 }
 
-char * Command :: writeVariable(int address, int size, int id, double value, int * bytesToWrite,int simple)
+int Command :: writeVariable(char * buffer, int address, int size, int id, double value, int simple)
 {
-	char * result;
-	int i;
-	unsigned int check = 0;
-	
+	typedef PacketBuilder<WRITE_VARIABLE> Packet;
+
 	printf("Write value = %f\n", value);
-	
-	/*
-	   Packet: Address (1 byte), origin (1 byte), command (1 byte), size (1 byte), 
-	   payload (size bytes), checksum (1 byte)	  
-	*/
-	if(!simple){
-		result = (char *) malloc ((5+size)*sizeof(char));
-		*bytesToWrite = (5+size)*sizeof(char);
-		result[0] = address & 0xFF;
-		result[1] = 0;
-		result[2] = WRITE_VARIABLE;
-		result[3] = checkSize(size);
-		result[4] = id & 0xFF;
-	
+
+	//Values are 8 bytes at most, and the packet buffer is sized for that
+	if(size < 1 || size > 8) return -1;
+
+	char * payload = Packet::begin(buffer, address, 1+size, simple);
+	payload[0] = id & 0xFF;
+
+	if(!simple)
+	{
+		//18-bit code, most significant byte first
 		unsigned int bytes = valueToBytes(value);
-	
-		unsigned int copyBytes = bytes;
-	
-		for(i = size+3; i > 4; i--)
-		{	
-			result[i] = bytes & 255;
+
+		for(int i = size; i > 0; i--)
+		{
+			payload[i] = bytes & 0xFF;
 			bytes = bytes >> 8;
 		}
-	
-		for(i = 0; i <= size+3; i++) check += result[i];
-	
-		//Checksum
-		result[size+4] = 0x100 - (check & 0xFF);
-	
-		printf("Send: %d | %d | %d | %d | %d | %u | %u\n", result[0], result[1], result[2], result[3], result[4], copyBytes, result[size+4] & 0xFF);
 	}
-	else{
-		result = (char *) malloc ((3+size)*sizeof(char));
-		*bytesToWrite = (3+size)*sizeof(char);
-		result[0] = WRITE_VARIABLE;
-		result[1] = checkSize(size)+1;
-		result[2] = id & 0xFF;
-	
-		unsigned int bytes = valueToBytes(value);
-		union {
-                	unsigned char c[8];
-                	double f;
-        	} u;
-		u.f = value;
-
-		unsigned int copyBytes = bytes;
-	
-		for(i = 0; i < 8; i++)
-		{	
-			result[3+i] = u.c[i];
-		}
-		printf("Send:  %d | %d | %d | %u | %u\n", result[0], result[1], result[2], copyBytes, result[size+2] & 0xFF);
-	}	
+	else
+	{
+		//The value itself, in host byte order
+		memcpy(payload + 1, &value, size);
+	}
 
-	return result;	
+	return Packet::finish(buffer, 1+size, simple);
 }
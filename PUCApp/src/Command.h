@@ -1,6 +1,10 @@
 #ifndef COMMAND_H
 #define COMMAND_H
 
+#include <stddef.h>
+#include <vector>
+#include "fixedPointCodec.h"
+
 enum COMMANDS
 {
    READ_VARIABLE        =0x10,
@@ -11,25 +15,112 @@ enum COMMANDS
    OK_COMMAND           =0xE0
 };
 
+/*
+   Packet: Address (1 byte), origin (1 byte), command (1 byte), size (1 byte),
+   payload (size bytes), checksum (1 byte)
+
+   Simple packets (SLLP over TCP) carry only command, size and payload.
+
+   Everything that depends only on the command and the payload size (lengths,
+   the encoded size byte and their share of the checksum) is computed at
+   compile time. Packets are built in caller provided buffers.
+*/
+template <unsigned char Code>
+struct PacketBuilder
+{
+	//Size byte: sizes up to 127 are sent as is, bigger ones in 128 byte steps
+	static constexpr unsigned char sizeByte(int size)
+	{
+		return size < 128 ? size : ((((size-2)/128)-1) | 0x80);
+	}
+
+	static constexpr int length(int payload, bool simple)
+	{
+		return simple ? 2 + payload : 5 + payload;
+	}
+
+	//Sum of the header bytes that don't depend on the call (origin is 0)
+	static constexpr unsigned int fixedSum(int payload)
+	{
+		return Code + sizeByte(payload);
+	}
+
+	//Write the header, returning where the payload goes
+	static char * begin(char * buffer, int address, int payload, bool simple)
+	{
+		if(simple)
+		{
+			buffer[0] = Code;
+			buffer[1] = sizeByte(payload);
+			return buffer + 2;
+		}
+
+		buffer[0] = address & 0xFF;
+		buffer[1] = 0;
+		buffer[2] = Code;
+		buffer[3] = sizeByte(payload);
+		return buffer + 4;
+	}
+
+	//Append the checksum once the payload is in place, returning the length
+	static int finish(char * buffer, int payload, bool simple)
+	{
+		if(simple) return length(payload, simple);
+
+		unsigned int check = (buffer[0] & 0xFF) + fixedSum(payload);
+		for(int i = 0; i < payload; i++) check += buffer[4+i] & 0xFF;
+
+		buffer[4+payload] = 0x100 - (check & 0xFF);
+		return length(payload, simple);
+	}
+};
+
 class Command
 {
-private:		
+private:
 	unsigned int valueToBytes(double value);
 	unsigned int valueToBytes(double value, int bits);
 	float bytesToValue(unsigned int bytes);
 	float bytesToValue (unsigned int bytes, int bits);
-	
-	int          checkSize(int size);	
-	
-public:    
+	const struct fp_codec * codec(int bits);
+
+	struct fp_codec custom;
+
+	//How curve samples are quantized (truncated unless set)
+	enum fp_rounding rounding;
+	struct fp_dither dither;
+	unsigned int ditherSeed;
+
+public:
+	//8192 points by offset. Each value has 2 bytes.
+	static constexpr int CURVE_POINTS  = 8192;
+	static constexpr int CURVE_PAYLOAD = 2*CURVE_POINTS + 2;
+
+	//Largest packets each builder writes
+	static constexpr int READ_VARIABLE_SIZE = PacketBuilder<READ_VARIABLE>::length(1, false);
+	static constexpr int WRITE_VARIABLE_SIZE = PacketBuilder<WRITE_VARIABLE>::length(1+8, false);
+	static constexpr int READ_CURVE_SIZE = PacketBuilder<TRANSMIT_BLOCK_CURVE>::length(2, false);
+	static constexpr int CURVE_BLOCK_SIZE = PacketBuilder<BLOCK_CURVE>::length(CURVE_PAYLOAD, false);
+
+	Command();
 	int    checkSize(char size);
-    char * writeVariable(int address, int size, int id, double value, int * bytesToWrite,int simple);    
-    char * readVariable(int address, int id, int * bytesToWrite,int simple);
+
+	//Builders: write a packet into buffer and return its length
+	//(writeVariable returns -1 for sizes other than 1 to 8 bytes)
+	int writeVariable(char * buffer, int address, int size, int id, double value, int simple);
+	int readVariable(char * buffer, int address, int id, int simple);
+	int readCurve(char * buffer, int address, int id, int offset);
+	int writeCurveBlock(char * buffer, int address, int id, int offset, epicsFloat64 * values, size_t nElements);
+	//Every block of a curve of nElements points, one frame of CURVE_BLOCK_SIZE
+	//bytes each in frames. Blocks are quantized in parallel. Returns how many.
+	int writeCurveBlocks(std::vector<char> &frames, int address, int id, const epicsFloat64 * values, size_t nElements);
+
+	void setCurveRounding(enum fp_rounding mode, unsigned int seed);
+
     double readingVariable(char * header, char * payload,int simple);
-    double* readingCurve(char * packet);
-    char * readCurve(int address, int size, int id, int offset, int * bytesToWrite);
-    char * writeCurveBlock(int address, int size, int id, int offset, epicsFloat64 * values, size_t nElements, int * bytesToWrite);
-    
+    //Decode up to nElements points of a curve block, returning how many
+    size_t readingCurve(char * packet, epicsFloat64 * values, size_t nElements);
+
 };
 
 #endif
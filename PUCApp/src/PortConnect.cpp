@@ -4,7 +4,13 @@
 #include <string.h>
 #include "PortConnect.h"
 
-PortConnect::PortConnect(const char* portName, const char * serialName) : asynPortDriver(portName, 0, 6, asynInt32Mask | asynOctetMask | asynFloat64Mask | asynFloat64ArrayMask | asynEnumMask | asynDrvUserMask, 0, 0, 1, 0, 0)
+static void curveTaskC(void * drvPvt)
+{
+   PortConnect * port = (PortConnect *) drvPvt;
+   port->curveTask();
+}
+
+PortConnect::PortConnect(const char* portName, const char * serialName) : asynPortDriver(portName, 0, 6 + NUM_CURVE_PARAMS, asynInt32Mask | asynOctetMask | asynFloat64Mask | asynFloat64ArrayMask | asynEnumMask | asynDrvUserMask, 0, 0, 1, 0, 0)
 {   
    printf("Constructor\n");
 #ifdef BPM   
@@ -15,14 +21,132 @@ PortConnect::PortConnect(const char* portName, const char * serialName) : asynPo
    createParam(P_TemperatureSensor4, asynParamFloat64, &P_TemperatureS4);
    createParam(P_SwitchState, asynParamInt32, &P_SState);
 #endif  
+   createParam(P_CurveAddress, asynParamInt32, &P_Address);
+   createParam(P_CurveId, asynParamInt32, &P_Id);
+   createParam(P_CurveSize, asynParamInt32, &P_Size);
+   createParam(P_CurveOffset, asynParamInt32, &P_Offset);
+   createParam(P_CurveType, asynParamInt32, &P_Type);
+   createParam(P_CurveMode, asynParamInt32, &P_Mode);
+   createParam(P_CurveValue, asynParamFloat64Array, &P_Value);
+   setIntegerParam(P_Mode, CURVE_READ_BLOCK);
    asynStatus status = pasynOctetSyncIO->connect(serialName, 0, &user, NULL);
    
    if(status == asynSuccess) printf("Success: Connect to port\n");   
    else printf("Error: Connect to port");   
 
    timeout = 5000;
+   ioLock = epicsMutexMustCreate();
    
    pasynOctetSyncIO->flush(user);   
+
+   //Whole curves are fetched by their own thread, on their own asynUser
+   front = 0;
+   curveLock = epicsMutexMustCreate();
+   curveRequest = epicsEventMustCreate(epicsEventEmpty);
+
+   status = pasynOctetSyncIO->connect(serialName, 0, &curveUser, NULL);
+   if(status != asynSuccess) printf("Error: Connect curve reader to port\n");
+   else epicsThreadMustCreate("PortConnectCurve", epicsThreadPriorityMedium,
+                              epicsThreadGetStackSize(epicsThreadStackMedium),
+                              curveTaskC, this);
+}
+
+//Send a request for a variable and read the header and payload of the response
+asynStatus PortConnect :: transactVariable(const char *write, int bytesToWrite, char *header, char *payload, int maxSize, int *size)
+{
+	size_t wrote, bytesRead;
+	int eomReason;
+
+	epicsMutexLock(ioLock);
+
+	asynStatus status = pasynOctetSyncIO->write(user, write, bytesToWrite, timeout, &wrote);
+
+	if(status == asynSuccess)
+		status = pasynOctetSyncIO->read(user, header, 2, timeout, &bytesRead, &eomReason);
+
+	if(status == asynSuccess)
+	{
+		*size = com.checkSize(header[1]);
+		if(*size > maxSize) status = asynError;
+	}
+
+	if(status == asynSuccess)
+		status = pasynOctetSyncIO->read(user, payload, *size, timeout, &bytesRead, &eomReason);
+
+	epicsMutexUnlock(ioLock);
+	return status;
+}
+
+bool PortConnect :: isCurveParam(int reason)
+{
+	return reason >= FIRST_CURVE_PARAM && reason <= LAST_CURVE_PARAM;
+}
+
+//Read every block of a curve of size points (one block if size is 0)
+asynStatus PortConnect :: fetchCurve(std::vector<epicsFloat64> &curve, int address, int id, int size)
+{
+	const int maxPoints = 256*Command::CURVE_POINTS; //Offset is a single byte
+
+	if(size <= 0) size = Command::CURVE_POINTS;
+	if(size > maxPoints) size = maxPoints;
+
+	curve.resize(size);
+
+	for(int offset = 0; offset*Command::CURVE_POINTS < size; offset++)
+	{
+		char write[Command::READ_CURVE_SIZE];
+		int bytesToWrite = com.readCurve(write, address, id, offset);
+
+		size_t wrote, bytesRead;
+		int eomReason;
+
+		epicsMutexLock(ioLock);
+		asynStatus status = pasynOctetSyncIO->writeRead(curveUser, write, bytesToWrite,
+				curveTaskFrame, Command::CURVE_BLOCK_SIZE, timeout, &wrote, &bytesRead, &eomReason);
+		epicsMutexUnlock(ioLock);
+		if(status != asynSuccess) return status;
+		if(bytesRead != Command::CURVE_BLOCK_SIZE) return asynError;
+
+		size_t first = offset*Command::CURVE_POINTS;
+		com.readingCurve(curveTaskFrame, &curve[first], size - first);
+	}
+
+	return asynSuccess;
+}
+
+//Fetch a whole curve into the back buffer each time a reader asks for one,
+//then make it the front buffer. A failed fetch keeps the previous curve.
+void PortConnect :: curveTask()
+{
+	int address, id, size;
+
+	while(1)
+	{
+		epicsEventMustWait(curveRequest);
+
+		lock();
+		getIntegerParam(P_Address, &address);
+		getIntegerParam(P_Id,      &id);
+		getIntegerParam(P_Size,    &size);
+		unlock();
+
+		//Only this thread writes the back buffer or changes front
+		std::vector<epicsFloat64> & back = curves[1 - front];
+
+		if(fetchCurve(back, address, id, size) != asynSuccess)
+		{
+			printf("Error: Curve %d from %d not read\n", id, address);
+			continue;
+		}
+
+		epicsMutexLock(curveLock);
+		front = 1 - front;
+		epicsMutexUnlock(curveLock);
+
+		lock();
+		doCallbacksFloat64Array(&curves[front][0], curves[front].size(), P_Value, 0);
+		unlock();
+	}
 }
 
 //Override method from AsynPortDriver
@@ -31,40 +155,19 @@ asynStatus PortConnect :: readFloat64(asynUser* pasynUser, epicsFloat64* value)
 	printf("Read float64\n");
 	asynStatus status = asynError;
 	
-	size_t wrote;
-	
 	printf("Sending request to read\n");
 	
-	int bytesToWrite;
 	int simple=1; 		
-	char * write = com.readVariable(0, pasynUser->reason, &bytesToWrite,simple);
-	
-	if (write[0] == 0) return asynSuccess;
-		
-	status = pasynOctetSyncIO->write(user, write, bytesToWrite, 5000, &wrote);
+	char write[Command::READ_VARIABLE_SIZE];
+	int bytesToWrite = com.readVariable(write, 0, pasynUser->reason, simple);
 	
-	if(status != asynSuccess) return status;
-		
 	//Read response from PUC
-	//First, read the header, and after read the payload and checksum
-		
-	char * header;		
-	char * payload;
+	char header[2];
+	char payload[256];
 	int size;
 		
-	size_t bytesRead;
-	int eomReason;
-		
-	header = (char *) malloc(2*sizeof(char));
-		
 	printf("Reading\n");
-	status = pasynOctetSyncIO->read(user, header, 2, 5000, &bytesRead, &eomReason);		
-	if(status != asynSuccess) return status;
-				
-	size = com.checkSize(header[1]);
-	payload = (char *) malloc((size+1)*sizeof(char));
-		
-	status = pasynOctetSyncIO->read(user, payload, size, 5000, &bytesRead, &eomReason);
+	status = transactVariable(write, bytesToWrite, header, payload, sizeof(payload), &size);
 	if(status != asynSuccess) return status;
 		
 	*value = com.readingVariable(header, payload,simple);
@@ -109,102 +212,104 @@ asynStatus PortConnect :: readFloat64(asynUser* pasynUser, epicsFloat64* value)
 	
 }
 
+>>>>>>> 06506e6a82d16b118e626b4d37b99ab696ed7508
+*/
+
 //Request and read a curve from PUC.
 //Override method from AsynPortDriver
->>>>>>> 06506e6a82d16b118e626b4d37b99ab696ed7508
 asynStatus PortConnect :: readFloat64Array(asynUser *pasynUser, epicsFloat64 *value, size_t nElements, size_t *nIn)
 {
-	printf("readFloat64Array\n");
 	asynStatus status;
 
+	if(pasynUser->reason != P_Value) return asynError;
+
+	int mode = CURVE_READ_BLOCK;
+	getIntegerParam(P_Mode, &mode);
+
+	if(mode == CURVE_READ_ALL)
+	{
+		//Served from the last complete curve, never from the wire
+		epicsMutexLock(curveLock);
+		std::vector<epicsFloat64> & curve = curves[front];
+		*nIn = curve.size() < nElements ? curve.size() : nElements;
+		if(*nIn) memcpy(value, &curve[0], *nIn * sizeof(epicsFloat64));
+		epicsMutexUnlock(curveLock);
+
+		//Ask for a fresh one
+		epicsEventSignal(curveRequest);
+		return asynSuccess;
+	}
+
 	int offset = 0, address = 0, id = 0, size = 0;
-	int bytesToWrite;
-	size_t wrote;
+	size_t wrote, bytesRead;
+	int eomReason;
 
 	getIntegerParam(P_Address, &address);
 	getIntegerParam(P_Size,    &size);
 	getIntegerParam(P_Id,      &id);
 	getIntegerParam(P_Offset,  &offset);
 
-	char * write = com.readCurve(address, size, id, offset, &bytesToWrite);
-	
-	printf("Bytes to write: %d\n", bytesToWrite);
+	char write[Command::READ_CURVE_SIZE];
+	int bytesToWrite = com.readCurve(write, address, id, offset);
 
-	status = pasynOctetSyncIO->write(user, write, bytesToWrite, timeout, &wrote);
+	//Reading response from PUC, straight into the waveform
+	epicsMutexLock(ioLock);
+	status = pasynOctetSyncIO->writeRead(user, write, bytesToWrite, curveFrame, Command::CURVE_BLOCK_SIZE,
+			timeout, &wrote, &bytesRead, &eomReason);
+	epicsMutexUnlock(ioLock);
+	if(status != asynSuccess) return status;
+	if(bytesRead != Command::CURVE_BLOCK_SIZE) return asynError;
 
-	//Reading response from PUC
-	char * bufferRead;
-	bufferRead = (char *) malloc(16391*sizeof(char));
-	
-	size_t bytesRead;
-	int eomReason;
+	*nIn = com.readingCurve(curveFrame, value, nElements);
 
-	status = pasynOctetSyncIO->read(user, bufferRead, 16391, timeout, &bytesRead, &eomReason);
-	printf("Bytes read: %li\n", bytesRead);
-	printf("eomReason: %d\n", eomReason);
-	if(status != asynSuccess) return status;
+	return status;
+}
 
-	memcpy(value, com.readingCurve(bufferRead), 8192*sizeof(double));
+//Send curve block frames one by one, each answered by a bare OK packet
+asynStatus PortConnect :: storeCurve(const char *frames, int count)
+{
+	char answer[PacketBuilder<OK_COMMAND>::length(0, false)];
+	size_t wrote, bytesRead;
+	int eomReason;
 
-	printf("Debug 2 values for test:\n");
-	printf("value[100] = %f\n", value[100]);
-  	printf("value[1000] = %f\n", value[1000]);
+	for(int i = 0; i < count; i++)
+	{
+		epicsMutexLock(ioLock);
+		asynStatus status = pasynOctetSyncIO->writeRead(user, frames + i*Command::CURVE_BLOCK_SIZE,
+				Command::CURVE_BLOCK_SIZE, answer, sizeof(answer), timeout, &wrote, &bytesRead, &eomReason);
+		epicsMutexUnlock(ioLock);
+		if(status != asynSuccess) return status;
+		if(bytesRead != sizeof(answer) || (answer[2] & 0xFF) != OK_COMMAND) return asynError;
+	}
 
-	*nIn = nElements; //Correct this
-	
-	fflush(stdout);
-	return status;
+	return asynSuccess;
 }
 
+//Write to PUC the block selected by OFFSET, or in MODE Curve, the whole curve
+//from its first block.
 //Override method from AsynPortDriver
-//Write a curve to PUC
 asynStatus PortConnect :: writeFloat64Array(asynUser* pasynUser, epicsFloat64* value, size_t nElements)
 {
-	asynStatus status = asynError;
-	printf("writeFloat64Array\n");
-	size_t wrote;
-	
-	if(pasynUser->reason == P_Value)
-	{
-		int offset = 0, address = 0, id=0, size=0;
-		int bytesToWrite;
-		
-		getIntegerParam(P_Address, &address);
-		getIntegerParam(P_Size,    &size);
-		getIntegerParam(P_Id,      &id);
-		getIntegerParam(P_Offset, &offset);
-		
-		char * write = com.writeCurveBlock(address, size, id, offset, value, nElements, &bytesToWrite);
-		
-		printf("Bytes to write: %d\n", bytesToWrite);
+	if(pasynUser->reason != P_Value) return asynError;
 
-		//////////////////Verify command
-		status = pasynOctetSyncIO->write(user, write, bytesToWrite, timeout, &wrote);		
-		//////////////////
-		
-		//Read response from PUC
-		char * bufferRead;
-		bufferRead = (char *) malloc(5*sizeof(char));
-		
-		size_t bytesRead;
-		int eomReason;
-		
-		status = pasynOctetSyncIO->read(user, bufferRead, 5, timeout, &bytesRead, &eomReason);
-		
-		if(status != asynSuccess) return status;
-		
-		printf("Bytes read: %lu \n", bytesRead);
-		printf("%u | %u | %u | %u | %u \n", bufferRead[0]&0xFF, bufferRead[1]&0xFF, bufferRead[2]&0xFF, bufferRead[3]&0xFF , bufferRead[4]&0xFF);			
-		printf("Write: %d, Wrote: %li \n", bytesToWrite, wrote);		
-		
-		//TODO: Verify checksum and the response	
-		
+	int mode = CURVE_READ_BLOCK, offset = 0, address = 0, id = 0;
+
+	getIntegerParam(P_Mode,    &mode);
+	getIntegerParam(P_Address, &address);
+	getIntegerParam(P_Id,      &id);
+	getIntegerParam(P_Offset,  &offset);
+
+	if(mode != CURVE_READ_ALL)
+	{
+		com.writeCurveBlock(curveFrame, address, id, offset, value, nElements);
+		return storeCurve(curveFrame, 1);
 	}
-	
-	fflush(stdout);	
-	return status;
+
+	std::vector<char> frames;
+	int count = com.writeCurveBlocks(frames, address, id, value, nElements);
+
+	return storeCurve(&frames[0], count);
 }
-*/
 //Override method from AsynPortDriver
 asynStatus PortConnect :: writeFloat64(asynUser* pasynUser, epicsFloat64 value)
 {	
@@ -215,22 +320,19 @@ asynStatus PortConnect :: writeFloat64(asynUser* pasynUser, epicsFloat64 value)
 	printf("Data writing\n");	
 	printf("Value = %f\n", value);
 		
-	int bytesToWrite;
 	int simple = 1;
-	char * write = com.writeVariable(0, sizeof(epicsFloat64), pasynUser->reason, (double) value, &bytesToWrite,simple);
+	char write[Command::WRITE_VARIABLE_SIZE];
+	int bytesToWrite = com.writeVariable(write, 0, sizeof(epicsFloat64), pasynUser->reason, (double) value, simple);
+	if(bytesToWrite < 0) return asynError;
 		
+	epicsMutexLock(ioLock);
 	pasynOctetSyncIO->flush(user);
 	status = pasynOctetSyncIO->write(user, write, bytesToWrite, 5000, &wrote);
+	epicsMutexUnlock(ioLock);
 		
 	if(status != asynSuccess) return status;
 		
 	//Read response from PUC		
-	char * bufferRead;
-	bufferRead = (char *) malloc(5*sizeof(char));
-		
-	size_t bytesRead;
-	int eomReason;
-		
 	//status = pasynOctetSyncIO->read(user, bufferRead, 5, 5000, &bytesRead, &eomReason);
 		
 	//if(status != asynSuccess) return status;
@@ -244,41 +346,22 @@ asynStatus PortConnect :: readInt32(asynUser* pasynUser, epicsInt32* value)
 {
 	printf("Read Int32");
 	asynStatus status = asynError;
-	
-	size_t wrote;
+
+	if(isCurveParam(pasynUser->reason)) return asynPortDriver::readInt32(pasynUser, value);
 	
 	printf("Sending request to read: %d\n",pasynUser->reason);
 	
-	int bytesToWrite;
 	int simple=1; 		
-	char * write = com.readVariable(0, pasynUser->reason, &bytesToWrite,simple);
-	
-	if (write[0] == 0) return asynSuccess;
-		
-	status = pasynOctetSyncIO->write(user, write, bytesToWrite, 5000, &wrote);
+	char write[Command::READ_VARIABLE_SIZE];
+	int bytesToWrite = com.readVariable(write, 0, pasynUser->reason, simple);
 	
-	if(status != asynSuccess) return status;
-		
 	//Read response from PUC
-	//First, read the header, and after read the payload and checksum
-		
-	char * header;		
-	char * payload;
+	char header[2];
+	char payload[256];
 	int size;
 		
-	size_t bytesRead;
-	int eomReason;
-		
-	header = (char *) malloc(2*sizeof(char));
-		
 	printf("Reading\n");
-	status = pasynOctetSyncIO->read(user, header, 2, 5000, &bytesRead, &eomReason);		
-	if(status != asynSuccess) return status;
-				
-	size = com.checkSize(header[1]);
-	payload = (char *) malloc((size+1)*sizeof(char));
-		
-	status = pasynOctetSyncIO->read(user, payload, size, 5000, &bytesRead, &eomReason);
+	status = transactVariable(write, bytesToWrite, header, payload, sizeof(payload), &size);
 	if(status != asynSuccess) return status;
 	//TODO:NO THE BEST WAY TO DO THIS CONVERSION!!Use the protocol!	
 	union{
@@ -300,48 +383,34 @@ asynStatus PortConnect :: readInt32(asynUser* pasynUser, epicsInt32* value)
 asynStatus PortConnect :: writeInt32(asynUser* pasynUser, epicsInt32 value)
 {	
 	asynStatus status = asynError;
+
+	if(isCurveParam(pasynUser->reason)) return asynPortDriver::writeInt32(pasynUser, value);
 	
 	//User can modify only the value
 	size_t wrote;
 	printf("Data writing Int32\n");	
 		
-	int bytesToWrite;
 	int simple = 1;
 	
-	//TODO:USE THE PROTOCOL!
 	//TODO:USE nobts!
-	char *result;
-	result = (char *)malloc((3+1)*sizeof(char));
-	result[0] = WRITE_VARIABLE;
-	result[1] = 1+1;
-	result[2] = pasynUser->reason;
+	typedef PacketBuilder<WRITE_VARIABLE> Packet;
+	char result[Packet::length(1+1, true)];
 
-	union {
-		unsigned char c[4];
-		epicsInt32 f;
-	} u;
-	u.f = value;
-	printf("epicsInt32Value: %d\n",u.f);
-	
-	int i = 0;
-	for(i = 0;i < 1; i++){
-		result[3+i] = u.c[i];
-	}
+	char * payload = Packet::begin(result, 0, 1+1, simple);
+	payload[0] = pasynUser->reason;
+	payload[1] = value & 0xFF;
+	printf("epicsInt32Value: %d\n",value);
+
+	int bytesToWrite = Packet::finish(result, 1+1, simple);
 	
-	for(i = 2;i < 7; i++)
-		printf("message %d\n",result[i]);
+	epicsMutexLock(ioLock);
 	pasynOctetSyncIO->flush(user);
-	status = pasynOctetSyncIO->write(user, result, (3+1)*sizeof(char), 5000, &wrote);
+	status = pasynOctetSyncIO->write(user, result, bytesToWrite, 5000, &wrote);
+	epicsMutexUnlock(ioLock);
 		
 	if(status != asynSuccess) return status;
 		
 	//Read response from PUC		
-	char * bufferRead;
-	bufferRead = (char *) malloc(5*sizeof(char));
-		
-	size_t bytesRead;
-	int eomReason;
-		
 	//status = pasynOctetSyncIO->read(user, bufferRead, 5, 5000, &bytesRead, &eomReason);
 		
 	//if(status != asynSuccess) return status;
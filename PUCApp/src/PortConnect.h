@@ -4,6 +4,10 @@
 
 #include <asynPortDriver.h>
 #include <asynOctetSyncIO.h>
+#include <epicsEvent.h>
+#include <epicsMutex.h>
+#include <epicsThread.h>
+#include <vector>
 #include <Command.cpp>
 
 #define P_TemperatureSetPoint "T_SetPoint"
@@ -13,6 +17,25 @@
 #define P_TemperatureSensor4    "T_Sensor4"
 #define P_SwitchState  "S_State"
 
+//Curve parameters (curve.db)
+#define P_CurveAddress "ADDRESS"
+#define P_CurveId      "ID"
+#define P_CurveSize    "SIZE"
+#define P_CurveOffset  "OFFSET"
+#define P_CurveType    "TYPE"
+#define P_CurveMode    "MODE"
+#define P_CurveValue   "VALUE"
+
+#define NUM_CURVE_PARAMS 7
+
+//MODE: read or write the block selected by OFFSET, or every block of a curve
+//(of SIZE points when read)
+enum CurveReadMode
+{
+	CURVE_READ_BLOCK = 0,
+	CURVE_READ_ALL   = 1
+};
+
 
 class PortConnect : public asynPortDriver
 {
@@ -23,9 +46,11 @@ public:
     virtual asynStatus readFloat64(asynUser* pasynUser, epicsFloat64* value);
     virtual asynStatus readInt32(asynUser* pasynUser, epicsInt32* value);
     virtual asynStatus writeInt32(asynUser* pasynUser, epicsInt32 value);
-    //virtual asynStatus writeFloat64Array(asynUser* pasynUser, epicsFloat64* value, size_t nElements);
-    //virtual asynStatus readFloat64Array(asynUser *pasynUser, epicsFloat64 *value, size_t nElements, size_t *nIn);
-    
+    virtual asynStatus writeFloat64Array(asynUser* pasynUser, epicsFloat64* value, size_t nElements);
+    virtual asynStatus readFloat64Array(asynUser *pasynUser, epicsFloat64 *value, size_t nElements, size_t *nIn);
+
+    void curveTask();
+
 protected:
 #ifdef BPM
 	int P_TemperatureSP;
@@ -35,10 +60,38 @@ protected:
 	int P_TemperatureS4;
 	int P_SState;
 #endif
+	int P_Address;
+	int P_Id;
+	int P_Size;
+	int P_Offset;
+	int P_Type;
+	int P_Mode;
+	int P_Value;
+#define FIRST_CURVE_PARAM P_Address
+#define LAST_CURVE_PARAM  P_Value
 private:
 	Command com;
+	char curveFrame[Command::CURVE_BLOCK_SIZE];
 	asynUser* user;
 	int timeout;
+
+	//Requests and their responses go as one transaction on the port,
+	//whichever asynUser sends them
+	epicsMutexId ioLock;
+	asynStatus transactVariable(const char *write, int bytesToWrite, char *header, char *payload, int maxSize, int *size);
+
+	bool isCurveParam(int reason);
+	asynStatus fetchCurve(std::vector<epicsFloat64> &curve, int address, int id, int size);
+	asynStatus storeCurve(const char *frames, int count);
+
+	//Whole curve reads: curveTask fills the back buffer and swaps it with the
+	//front one, which is all readFloat64Array ever copies from
+	std::vector<epicsFloat64> curves[2];
+	int front;
+	char curveTaskFrame[Command::CURVE_BLOCK_SIZE];
+	asynUser* curveUser;
+	epicsMutexId curveLock;
+	epicsEventId curveRequest;
 };
 
 #endif
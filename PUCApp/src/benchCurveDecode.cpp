@@ -0,0 +1,164 @@
+/*
+ * Check that a curve block built by Command::writeCurveBlock reads back the
+ * same through Command::readingCurve, to within one code, and that
+ * Command::writeCurveBlocks builds the same frames for a whole curve. Then
+ * time the decoding of one block (8192 16-bit big endian codes) by
+ * fp_decode_array, whose kernel is chosen for this processor, against the
+ * scalar fp_decode loop that boards without vector units run, after checking
+ * that both give the same values.
+ *
+ * Build and run, with EPICS_BASE and EPICS_HOST_ARCH set:
+ *
+ *   gcc -std=gnu99 -O2 -c fixedPointCodec.c && \
+ *   g++ -O2 -I. -I$EPICS_BASE/include -I$EPICS_BASE/include/os/Linux \
+ *       -I$EPICS_BASE/include/compiler/gcc -o benchCurveDecode \
+ *       benchCurveDecode.cpp fixedPointCodec.o && ./benchCurveDecode
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+#include <epicsTypes.h>
+#include "Command.cpp"
+
+#define ROUNDS          10000
+
+static const int CURVE_POINTS = Command::CURVE_POINTS;
+
+static double now (void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec*1e-9;
+}
+
+static void decode_scalar (const uint8_t *data, double *values, size_t count)
+{
+    size_t i;
+
+    for(i = 0; i < count; i++)
+        values[i] = fp_decode(&fp_codec_bipolar_16, data + 2*i);
+}
+
+// A ramp over the whole range goes out in a block and comes back
+static int round_trip (void)
+{
+    static char frame[Command::CURVE_BLOCK_SIZE];
+    static epicsFloat64 sent[CURVE_POINTS], received[CURVE_POINTS];
+    const double lsb = fp_codec_bipolar_16.scale;
+    Command com;
+    int i;
+
+    for(i = 0; i < CURVE_POINTS; i++)
+        sent[i] = -10.0 + 20.0*i/CURVE_POINTS;
+
+    if(com.writeCurveBlock(frame, 1, 3, 7, sent, CURVE_POINTS) !=
+       Command::CURVE_BLOCK_SIZE)
+    {
+        printf("Wrong block length\n");
+        return 1;
+    }
+
+    if(com.readingCurve(frame, received, CURVE_POINTS) != (size_t) CURVE_POINTS)
+    {
+        printf("Wrong number of points read\n");
+        return 1;
+    }
+
+    for(i = 0; i < CURVE_POINTS; i++)
+    {
+        if(fabs(received[i] - sent[i]) > lsb)
+        {
+            printf("Round trip differs at point %d: %.17g != %.17g\n", i,
+                   received[i], sent[i]);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Two and a half blocks, built at once and one by one
+static int curve_round_trip (void)
+{
+    static epicsFloat64 sent[5*CURVE_POINTS/2];
+    static char frame[Command::CURVE_BLOCK_SIZE];
+    const size_t points = sizeof(sent)/sizeof(sent[0]);
+    std::vector<char> frames;
+    Command com;
+    size_t i;
+    int count;
+
+    for(i = 0; i < points; i++)
+        sent[i] = sin(i*1e-3)*10.0;
+
+    count = com.writeCurveBlocks(frames, 1, 3, sent, points);
+    if(count != 3)
+    {
+        printf("Wrong number of blocks: %d\n", count);
+        return 1;
+    }
+
+    for(i = 0; i < (size_t) count; i++)
+    {
+        size_t first = i*CURVE_POINTS;
+
+        com.writeCurveBlock(frame, 1, 3, i, sent + first, points - first);
+        if(memcmp(frame, &frames[i*Command::CURVE_BLOCK_SIZE], sizeof(frame)))
+        {
+            printf("Block %zu differs\n", i);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int main (void)
+{
+    static uint8_t block[2*CURVE_POINTS];
+    static double vector[CURVE_POINTS], scalar[CURVE_POINTS];
+    double t;
+    int i;
+
+    if(round_trip() || curve_round_trip())
+        return 1;
+
+    for(i = 0; i < 2*CURVE_POINTS; i++)
+        block[i] = (i*37 + 11) & 0xFF;
+
+    // An odd count also covers the tail the kernels leave to the scalar loop
+    fp_decode_array(&fp_codec_bipolar_16, block, vector, CURVE_POINTS - 1);
+    decode_scalar(block, scalar, CURVE_POINTS - 1);
+
+    for(i = 0; i < CURVE_POINTS - 1; i++)
+    {
+        if(vector[i] != scalar[i])
+        {
+            printf("Mismatch at point %d: %.17g != %.17g\n", i, vector[i],
+                   scalar[i]);
+            return 1;
+        }
+    }
+
+    t = now();
+    for(i = 0; i < ROUNDS; i++)
+    {
+        fp_decode_array(&fp_codec_bipolar_16, block, vector, CURVE_POINTS);
+        __asm__ volatile("" : : "r"(vector) : "memory");
+    }
+    t = (now() - t)/ROUNDS;
+    printf("fp_decode_array: %6.2f us per block\n", t*1e6);
+
+    t = now();
+    for(i = 0; i < ROUNDS; i++)
+    {
+        decode_scalar(block, scalar, CURVE_POINTS);
+        __asm__ volatile("" : : "r"(scalar) : "memory");
+    }
+    t = (now() - t)/ROUNDS;
+    printf("fp_decode loop:  %6.2f us per block\n", t*1e6);
+
+    return 0;
+}
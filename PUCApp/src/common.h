@@ -14,6 +14,8 @@
 #define MAX_PAYLOAD             SLLP_MAX_PAYLOAD
 #define MAX_MESSAGE             SLLP_MAX_MESSAGE
 #define MAX_PAYLOAD_ENCODED     255
+#define EXTENDED_FRAME          SLLP_EXTENDED_FRAME
+#define MAX_HEADER_SIZE         SLLP_MAX_HEADER_SIZE
 
 #define WRITABLE_MASK           0x80
 #define SIZE_MASK               0x7F
@@ -33,6 +35,10 @@ enum command_code
     CMD_GROUP,
     CMD_QUERY_CURVES_LIST,
     CMD_CURVES_LIST,
+    CMD_QUERY_STATS,
+    CMD_STATS,
+    CMD_QUERY_CAPS,
+    CMD_CAPS,
 
     CMD_READ_VAR = 0x10,
     CMD_VAR_READING,
@@ -43,6 +49,10 @@ enum command_code
     CMD_WRITE_GROUP = 0x22,
     CMD_BIN_OP_VAR = 0x24,
     CMD_BIN_OP_GROUP = 0x26,
+    CMD_CAS_VAR = 0x28,
+    CMD_CAS_GROUP = 0x2A,
+    CMD_FETCH_ADD_VAR = 0x2C,
+    CMD_FETCH_ADD_GROUP = 0x2E,
 
     CMD_CREATE_GROUP = 0x30,
     CMD_REMOVE_ALL_GROUPS = 0x32,
@@ -50,6 +60,18 @@ enum command_code
     CMD_CURVE_TRANSMIT = 0x40,
     CMD_CURVE_BLOCK,
     CMD_CURVE_RECALC_CSUM,
+    CMD_CURVE_CSUM,
+    CMD_CURVE_TRANSMIT_COMPRESSED,
+    CMD_CURVE_BLOCK_COMPRESSED,
+    CMD_CURVE_READ_RANGE,
+    CMD_CURVE_RANGE,
+
+    CMD_SUBSCRIBE = 0x50,
+    CMD_UNSUBSCRIBE,
+    CMD_NOTIFY,
+
+    CMD_BATCH = 0x60,
+    CMD_BATCH_REPLY,
 
     CMD_OK = 0xE0,
     CMD_ERR_MALFORMED_MESSAGE,
@@ -63,6 +85,22 @@ enum command_code
     CMD_MAX
 };
 
+#define CAPS_SIZE               12
+
+// Optional protocol features a server may offer (see enum sllp_capability)
+enum capability
+{
+    CAP_WIDE_IDS            = SLLP_CAP_WIDE_IDS,
+    CAP_CRC32C              = SLLP_CAP_CRC32C,
+    CAP_EXTENDED_SIZE       = SLLP_CAP_EXTENDED_SIZE,
+    CAP_COMPRESSED_CURVES   = SLLP_CAP_COMPRESSED_CURVES,   // See deltarle.h
+    CAP_BATCH               = SLLP_CAP_BATCH,
+    CAP_SUBSCRIPTIONS       = SLLP_CAP_SUBSCRIPTIONS,
+    CAP_ATOMIC              = SLLP_CAP_ATOMIC,
+    CAP_CURVE_RANGE         = SLLP_CAP_CURVE_RANGE,
+    CAP_STATS               = SLLP_CAP_STATS,
+};
+
 enum group_id
 {
     GROUP_ALL_ID,
@@ -72,5 +110,88 @@ enum group_id
     GROUP_STANDARD_COUNT,
 };
 
-#endif  /* COMMON_H */
+// Message headers
+
+// Size of the header for a payload of the given size, extended or not
+static inline unsigned int header_size (uint32_t size, bool extended)
+{
+    if(!extended)
+        return HEADER_SIZE;
 
+    unsigned int len = HEADER_SIZE + 1;     // Last byte of the size
+
+    for(; size > 0x7F; size >>= 7)
+        ++len;
+
+    return len;
+}
+
+// Whether a payload of the given size needs an extended header
+static inline bool header_needs_extended (uint32_t size)
+{
+    return size >= MAX_PAYLOAD_ENCODED && size != MAX_PAYLOAD;
+}
+
+// Write a header, extended or not, returning its size
+static inline unsigned int header_encode (uint8_t *data, uint8_t code,
+                                          uint32_t size, bool extended)
+{
+    if(!extended)
+    {
+        data[0] = code;
+        data[1] = size == MAX_PAYLOAD ? MAX_PAYLOAD_ENCODED : size;
+        return HEADER_SIZE;
+    }
+
+    unsigned int len = HEADER_SIZE;
+
+    data[0] = EXTENDED_FRAME;
+    data[1] = code;
+
+    for(; size > 0x7F; size >>= 7)
+        data[len++] = 0x80 | (size & 0x7F);
+    data[len++] = size;
+
+    return len;
+}
+
+// Read the header at data, of which len bytes are at hand. Returns the size of
+// the header, or 0 if it's incomplete. Sizes too large for a message come out
+// as MAX_PAYLOAD + 1.
+static inline unsigned int header_decode (const uint8_t *data, uint32_t len,
+                                          uint8_t *code, uint32_t *size)
+{
+    if(len < HEADER_SIZE)
+        return 0;
+
+    if(data[0] != EXTENDED_FRAME)
+    {
+        *code = data[0];
+        *size = data[1] == MAX_PAYLOAD_ENCODED ? MAX_PAYLOAD : data[1];
+        return HEADER_SIZE;
+    }
+
+    *code = data[1];
+    *size = 0;
+
+    unsigned int i;
+    for(i = HEADER_SIZE; i < MAX_HEADER_SIZE; ++i)
+    {
+        if(i == len)
+            return 0;
+
+        *size |= (uint32_t)(data[i] & 0x7F) << 7*(i - HEADER_SIZE);
+
+        if(!(data[i] & 0x80))
+        {
+            if(*size > MAX_PAYLOAD)
+                *size = MAX_PAYLOAD + 1;
+            return i + 1;
+        }
+    }
+
+    *size = MAX_PAYLOAD + 1;
+    return MAX_HEADER_SIZE;
+}
+
+#endif  /* COMMON_H */
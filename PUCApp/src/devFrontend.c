@@ -39,14 +39,15 @@
 #include "asynOctetSyncIO.h"
 #include "asynInt32.h"
 #include "asynFloat64.h"
+#include "asynFloat64Array.h"
 #include "asynCommonSyncIO.h"
 #include "asynStandardInterfaces.h"
 #include "drvAsynIPPort.h"
 #include "devFrontend.h"
 #include <epicsExport.h>
-#include "unionConversion.h"
 #include "sendrecvlib.h"
 #include "frontendRecordParams.h"
+#include "varCodec.h"
 
 /*
  * Interposed layer private storage
@@ -57,6 +58,7 @@ typedef struct FrontendPvt {
     asynInterface  asynCommon;     /* Our interfaces */
     asynInterface  asynInt32;
     asynInterface  asynFloat64;
+    asynInterface  asynFloat64Array;
     asynInterface  asynDrvUser;
 
     unsigned long commandCount;
@@ -69,6 +71,13 @@ typedef struct FrontendPvt {
 
     sllp_client_t *sllp;
     struct sllp_vars_list *vars;
+    struct sllp_groups_list *groups;
+
+    struct var_codec *codecs;      /* How to interpret each variable, by its
+                                      position in vars */
+
+    uint8_t *groupData;            /* Values of a group, as read */
+    const struct var_codec **groupCodecs; /* Codecs of its variables */
 
 } FrontendPvt;
 
@@ -149,17 +158,46 @@ disconnect(void *pvt, asynUser *pasynUser)
 static asynCommon commonMethods = { report, connect, disconnect };
 
 /*
- * asynInt32 methods
+ * Interpretation of a variable from its size alone
  */
+static void
+defaultCodec(struct var_codec *codec, unsigned int size)
+{
+    #ifdef PUC
+    /* Analog variables are 18-bit +-10 V codes, everything else is raw */
+    if (size == FP_CODE_BYTES(18) &&
+        var_codec_init(codec, size, VAR_TYPE_FIXED, FP_BIG_ENDIAN,
+                       &fp_codec_bipolar_18) == 0)
+        return;
+    if (var_codec_init(codec, size, VAR_TYPE_UINT, FP_BIG_ENDIAN, NULL))
+        codec->size = 0;
+    #else
+    /* BPM front-ends send doubles and integers in x86_64 byte order */
+    if (var_codec_init(codec, size, size == 8 ? VAR_TYPE_IEEE : VAR_TYPE_UINT,
+                       FP_LITTLE_ENDIAN, NULL))
+        codec->size = 0;
+    #endif
+}
+
+/*
+ * Codec of a variable of the list, whatever id it goes by on the wire
+ */
+static const struct var_codec *
+varCodec(FrontendPvt *ppvt, const struct sllp_var_info *var)
+{
+    return &ppvt->codecs[var - ppvt->vars->list];
+}
+
 static asynStatus
-int32Write(void *pvt, asynUser *pasynUser, epicsInt32 value)
+readVar(FrontendPvt *ppvt, asynUser *pasynUser, uint8_t *data,
+        const struct var_codec **codec)
 {
-	FrontendPvt *ppvt = (FrontendPvt *)pvt;
-	unsigned_int_32_value ui32v;
-	ui32v.ui32value = (uint32_t) value;
 	struct sllp_var_info * var = &ppvt->vars->list[pasynUser->reason];
 
-	if(sllp_write_var(ppvt->sllp, var, ui32v.vvalue)!=SLLP_SUCCESS)
+	*codec = varCodec(ppvt, var);
+	if(!(*codec)->size) return asynError;
+
+	if(sllp_read_var(ppvt->sllp, var, data)!=SLLP_SUCCESS)
 	{
     		if( pasynOctetSyncIO->connect(ppvt->serverAddress, -1, &ppvt->pasynUser, NULL) != asynSuccess)
 			printf("SERVER DISCONNECTED\n");
@@ -169,29 +207,48 @@ int32Write(void *pvt, asynUser *pasynUser, epicsInt32 value)
 }
 
 static asynStatus
-int32Read(void *pvt, asynUser *pasynUser, epicsInt32 *value)
+writeVar(FrontendPvt *ppvt, asynUser *pasynUser, uint8_t *data)
 {
-
-	FrontendPvt *ppvt = (FrontendPvt *)pvt;
-
-	uint8_t *val;
-	val = (uint8_t*) malloc(4*sizeof(char));
-	
 	struct sllp_var_info * var = &ppvt->vars->list[pasynUser->reason];
 
-	if(sllp_read_var(ppvt->sllp, var, val)!=SLLP_SUCCESS)
+	if(sllp_write_var(ppvt->sllp, var, data)!=SLLP_SUCCESS)
 	{
     		if( pasynOctetSyncIO->connect(ppvt->serverAddress, -1, &ppvt->pasynUser, NULL) != asynSuccess)
 			printf("SERVER DISCONNECTED\n");
 		return asynError;
 	}
-	unsigned_int_32_value ui32v;
+	return asynSuccess;
+}
 
-	ui32v.ui32value=0;
-	ui32v.vvalue[0] = val[0];
-	
-	*value = (epicsInt32) ui32v.ui32value;
-	free(val);	
+/*
+ * asynInt32 methods
+ */
+static asynStatus
+int32Write(void *pvt, asynUser *pasynUser, epicsInt32 value)
+{
+	FrontendPvt *ppvt = (FrontendPvt *)pvt;
+	const struct var_codec *codec;
+	uint8_t data[VAR_CODEC_MAX_SIZE];
+
+	codec = varCodec(ppvt, &ppvt->vars->list[pasynUser->reason]);
+	if(!codec->size) return asynError;
+
+	var_codec_from_int32(codec, value, data);
+
+	return writeVar(ppvt, pasynUser, data);
+}
+
+static asynStatus
+int32Read(void *pvt, asynUser *pasynUser, epicsInt32 *value)
+{
+	FrontendPvt *ppvt = (FrontendPvt *)pvt;
+	const struct var_codec *codec;
+	uint8_t data[VAR_CODEC_MAX_SIZE];
+
+	if(readVar(ppvt, pasynUser, data, &codec) != asynSuccess)
+		return asynError;
+
+	*value = (epicsInt32) var_codec_to_int32(codec, data);
 	return asynSuccess;
 }
 
@@ -204,78 +261,75 @@ static asynStatus
 float64Write(void *pvt, asynUser *pasynUser, epicsFloat64 value)
 {
 	FrontendPvt *ppvt = (FrontendPvt *)pvt;
-	struct sllp_var_info * var = &ppvt->vars->list[pasynUser->reason];
+	const struct var_codec *codec;
+	uint8_t data[VAR_CODEC_MAX_SIZE];
 
-    #ifdef BPM
-	double_value dv;
-	dv.dvalue = (double) value;
-	if(sllp_write_var(ppvt->sllp, var, dv.vvalue)!=SLLP_SUCCESS)
-	{
-    		if( pasynOctetSyncIO->connect(ppvt->serverAddress, -1, &ppvt->pasynUser, NULL) != asynSuccess)
-			printf("SERVER DISCONNECTED\n");
-		return asynError;
-	}
-    #elif defined PUC
-    unsigned int raw = (unsigned int) (((double)value+10)*262143)/20.0;
-    int i;
-    uint8_t* buf;
-    buf = (uint8_t*) malloc(3*sizeof(char));
+	codec = varCodec(ppvt, &ppvt->vars->list[pasynUser->reason]);
+	if(!codec->size) return asynError;
 
-    for(i = 2; i >= 0; i--)
-    {
-        buf[i] = raw & 0xFF;
-        raw >> 8;
-    }
+	var_codec_from_float64(codec, (double) value, data);
 
-    if(sllp_write_var(ppvt->sllp, var, buf) != SLLP_SUCCESS) return asynError;
-    free(buf);
-    #endif
+	return writeVar(ppvt, pasynUser, data);
+}
+
+static asynStatus
+float64Read(void *pvt, asynUser *pasynUser, epicsFloat64 *value)
+{
+	FrontendPvt *ppvt = (FrontendPvt *)pvt;
+	const struct var_codec *codec;
+	uint8_t data[VAR_CODEC_MAX_SIZE];
+
+	if(readVar(ppvt, pasynUser, data, &codec) != asynSuccess)
+		return asynError;
 
+	*value = (epicsFloat64) var_codec_to_float64(codec, data);
 	return asynSuccess;
 }
 
+static asynFloat64 float64Methods = { float64Write, float64Read };
+
+/*
+ * asynFloat64Array methods. The standard groups of the server (all
+ * variables, then the read-only ones) are read in a single request each,
+ * and decoded in a single pass.
+ */
 static asynStatus
-float64Read(void *pvt, asynUser *pasynUser, epicsFloat64 *value)
+float64ArrayRead(void *pvt, asynUser *pasynUser, epicsFloat64 *value,
+                 size_t nElements, size_t *nIn)
 {
 	FrontendPvt *ppvt = (FrontendPvt *)pvt;
+	unsigned int id = pasynUser->reason - g_all;
+	struct sllp_group *grp;
+	size_t i, count;
 
-	struct sllp_var_info * var = &ppvt->vars->list[pasynUser->reason];
+	if(pasynUser->reason < g_all || pasynUser->reason > g_read ||
+	   id >= ppvt->groups->count)
+		return asynError;
+
+	grp = &ppvt->groups->list[id];
+	count = grp->vars.count < nElements ? grp->vars.count : nElements;
+
+	/* Values follow each other, so only the ones returned need codecs */
+	for(i = 0; i < count; i++)
+	{
+		ppvt->groupCodecs[i] = varCodec(ppvt, grp->vars.list[i]);
+		if(!ppvt->groupCodecs[i]->size) return asynError;
+	}
 
-	#ifdef BPM
-	double_value dn;
-	if(sllp_read_var(ppvt->sllp, var, dn.vvalue)!=SLLP_SUCCESS)
+	if(sllp_read_group(ppvt->sllp, grp, ppvt->groupData)!=SLLP_SUCCESS)
 	{
     		if( pasynOctetSyncIO->connect(ppvt->serverAddress, -1, &ppvt->pasynUser, NULL) != asynSuccess)
 			printf("SERVER DISCONNECTED\n");
 		return asynError;
 	}
-	*value = (epicsFloat64) dn.dvalue;
-
-	#elif defined PUC
-	int i;
-	uint8_t *val;
-	unsigned int raw = 0;
-	val = (uint8_t*) malloc(3*sizeof(char));
-    sllp_read_var(ppvt->sllp, var, val);
-	for(i=0; i < 3; i++)
-	{
-        raw = raw << 8;
-		raw += val[i];			
-	}
-
-    printf("Raw = %u\n", raw);
 
-	//18 bits
-	float result = ((20*raw)/262143.0)-10;
-    printf("Result = %f\n", result);
-
-	*value = (epicsFloat64) result;
-	free(val);
-	#endif
+	var_codec_decode_group(ppvt->groupCodecs, count, ppvt->groupData,
+	                       value);
+	*nIn = count;
 	return asynSuccess;
 }
 
-static asynFloat64 float64Methods = { float64Write, float64Read };
+static asynFloat64Array float64ArrayMethods = { NULL, float64ArrayRead };
 
 epicsShareFunc int 
 //devFrontendConfigure(const char *portName, const char *hostInfo, int flags, int priority)
@@ -342,6 +396,24 @@ devFrontendConfigure(const char *portName, const char *hostInfo, int priority)
         printf("Variable listing error\n");
     }
 
+    if (sllp_get_groups_list(ppvt->sllp, &ppvt->groups)!=SLLP_SUCCESS){
+        printf("Group listing error\n");
+    }
+
+    /*
+     * Decide how each variable is interpreted
+     */
+    ppvt->codecs = callocMustSucceed(ppvt->vars->count ? ppvt->vars->count : 1,
+                                     sizeof(*ppvt->codecs), "devFrontendConfigure");
+    {
+        unsigned int i;
+        for (i = 0; i < ppvt->vars->count; i++)
+            defaultCodec(&ppvt->codecs[i], ppvt->vars->list[i].size);
+    }
+    ppvt->groupData = callocMustSucceed(1, SLLP_MAX_PAYLOAD, "devFrontendConfigure");
+    ppvt->groupCodecs = callocMustSucceed(ppvt->vars->count ? ppvt->vars->count : 1,
+                                          sizeof(*ppvt->groupCodecs), "devFrontendConfigure");
+
     #ifdef DEBUG
     printf("SLLP initialized\n");
     #endif
@@ -388,6 +460,14 @@ devFrontendConfigure(const char *portName, const char *hostInfo, int priority)
         printf("Can't register asynFloat64 support.\n");
         return -1;
     }
+    ppvt->asynFloat64Array.interfaceType = asynFloat64ArrayType;
+    ppvt->asynFloat64Array.pinterface = &float64ArrayMethods;
+    ppvt->asynFloat64Array.drvPvt = ppvt;
+    status = pasynManager->registerInterface(portName, &ppvt->asynFloat64Array);
+    if (status != asynSuccess) {
+        printf("Can't register asynFloat64Array support.\n");
+        return -1;
+    }
     
     ppvt->asynDrvUser.interfaceType = asynDrvUserType;
     ppvt->asynDrvUser.pinterface = &drvUser;
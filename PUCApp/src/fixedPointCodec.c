@@ -0,0 +1,545 @@
+#include "fixedPointCodec.h"
+
+const struct fp_codec fp_codec_bipolar_16 =
+        FP_CODEC_INITIALIZER(16, 0, -10.0, 10.0, FP_BIG_ENDIAN);
+const struct fp_codec fp_codec_bipolar_18 =
+        FP_CODEC_INITIALIZER(18, 0, -10.0, 10.0, FP_BIG_ENDIAN);
+const struct fp_codec fp_codec_bipolar_20 =
+        FP_CODEC_INITIALIZER(20, 0, -10.0, 10.0, FP_BIG_ENDIAN);
+const struct fp_codec fp_codec_bipolar_24 =
+        FP_CODEC_INITIALIZER(24, 0, -10.0, 10.0, FP_BIG_ENDIAN);
+const struct fp_codec fp_codec_bipolar_32 =
+        FP_CODEC_INITIALIZER(32, 0, -10.0, 10.0, FP_BIG_ENDIAN);
+
+int fp_codec_init (struct fp_codec *codec, unsigned int bits, int is_signed,
+                   double min, double max, enum fp_byte_order order)
+{
+    if(!codec || bits < FP_CODEC_MIN_BITS || bits > FP_CODEC_MAX_BITS)
+        return -1;
+
+    if(!(max > min) || (order != FP_BIG_ENDIAN && order != FP_LITTLE_ENDIAN))
+        return -1;
+
+    codec->bits      = bits;
+    codec->bytes     = FP_CODE_BYTES(bits);
+    codec->is_signed = is_signed ? 1 : 0;
+    codec->order     = order;
+    codec->max_code  = FP_MAX_CODE(bits);
+    codec->min       = min;
+    codec->max       = max;
+    codec->scale     = (max - min) / (double) codec->max_code;
+    codec->inv_scale = (double) codec->max_code / (max - min);
+
+    return 0;
+}
+
+const struct fp_codec *fp_codec_bipolar (unsigned int bits)
+{
+    switch(bits)
+    {
+    case 16: return &fp_codec_bipolar_16;
+    case 18: return &fp_codec_bipolar_18;
+    case 20: return &fp_codec_bipolar_20;
+    case 24: return &fp_codec_bipolar_24;
+    case 32: return &fp_codec_bipolar_32;
+    default: return NULL;
+    }
+}
+
+// Code <-> value conversion. Signed codes are offset binary codes with the
+// sign bit flipped, so both share the same linear mapping.
+
+static inline uint32_t sign_flip (const struct fp_codec *codec)
+{
+    return codec->is_signed ? (uint32_t) 1 << (codec->bits - 1) : 0;
+}
+
+// offset is added before truncating: 0 truncates, 0.5 rounds to nearest and
+// a random offset in [0, 1) dithers
+static inline uint32_t value_to_code (const struct fp_codec *codec,
+                                      double value, double offset,
+                                      uint32_t flip)
+{
+    double code = (value - codec->min) * codec->inv_scale + offset;
+
+    if(!(code > 0.0))           // Also catches NaN
+        return flip;
+
+    if(code >= (double) codec->max_code)
+        return codec->max_code ^ flip;
+
+    return (uint32_t) code ^ flip;
+}
+
+static inline double code_to_value (const struct fp_codec *codec,
+                                    uint32_t code, uint32_t flip)
+{
+    return codec->min + (double) ((code ^ flip) & codec->max_code) *
+                        codec->scale;
+}
+
+static inline uint32_t load_code (const uint8_t *data, unsigned int bytes,
+                                  enum fp_byte_order order)
+{
+    uint32_t code = 0;
+    unsigned int i;
+
+    if(order == FP_BIG_ENDIAN)
+        for(i = 0; i < bytes; ++i)
+            code = (code << 8) | data[i];
+    else
+        for(i = bytes; i > 0; --i)
+            code = (code << 8) | data[i-1];
+
+    return code;
+}
+
+static inline void store_code (uint8_t *data, uint32_t code, unsigned int bytes,
+                               enum fp_byte_order order)
+{
+    unsigned int i;
+
+    if(order == FP_BIG_ENDIAN)
+        for(i = bytes; i > 0; --i, code >>= 8)
+            data[i-1] = code & 0xFF;
+    else
+        for(i = 0; i < bytes; ++i, code >>= 8)
+            data[i] = code & 0xFF;
+}
+
+uint32_t fp_to_code (const struct fp_codec *codec, double value)
+{
+    return value_to_code(codec, value, 0.0, sign_flip(codec));
+}
+
+double fp_from_code (const struct fp_codec *codec, uint32_t code)
+{
+    return code_to_value(codec, code, sign_flip(codec));
+}
+
+void fp_encode (const struct fp_codec *codec, double value, uint8_t *data)
+{
+    store_code(data, value_to_code(codec, value, 0.0, sign_flip(codec)),
+               codec->bytes, (enum fp_byte_order) codec->order);
+}
+
+double fp_decode (const struct fp_codec *codec, const uint8_t *data)
+{
+    return code_to_value(codec, load_code(data, codec->bytes,
+                                          (enum fp_byte_order) codec->order),
+                         sign_flip(codec));
+}
+
+// Dither noise. Sample i of an array always draws from lane i % 8, which is
+// what lets the vector kernels advance all lanes at once.
+
+#define FP_DITHER_SHIFT         8
+#define FP_DITHER_SCALE         (1.0 / 16777216.0)     // 2^-24
+
+void fp_dither_init (struct fp_dither *dither, uint32_t seed)
+{
+    unsigned int i;
+
+    for(i = 0; i < FP_DITHER_LANES; ++i)
+    {
+        // Spread the seed over the lanes; xorshift must not start at 0
+        uint32_t x = seed + 0x9E3779B9u * (i + 1);
+        x = (x ^ (x >> 16)) * 0x85EBCA6Bu;
+        x = (x ^ (x >> 13)) * 0xC2B2AE35u;
+        x ^= x >> 16;
+        dither->state[i] = x ? x : 1;
+    }
+}
+
+static inline double dither_next (struct fp_dither *dither, size_t i)
+{
+    uint32_t *s = &dither->state[i % FP_DITHER_LANES];
+
+    *s ^= *s << 13;
+    *s ^= *s >> 17;
+    *s ^= *s << 5;
+
+    return (double) (*s >> FP_DITHER_SHIFT) * FP_DITHER_SCALE;
+}
+
+// Bulk conversion. One loop is instantiated per code width and byte order so
+// that the compiler sees constant sizes and can unroll and vectorize it.
+
+#define FP_ARRAY_LOOPS(BYTES, ORDER, SUFFIX)                                 \
+static void quantize_array_##SUFFIX (const struct fp_codec *codec,           \
+                                     const double *values, uint8_t *data,    \
+                                     size_t count, enum fp_rounding rounding,\
+                                     struct fp_dither *dither)               \
+{                                                                            \
+    const uint32_t flip = sign_flip(codec);                                  \
+    const double offset = rounding == FP_ROUND_NEAREST ? 0.5 : 0.0;          \
+    size_t i;                                                                \
+    if(rounding == FP_ROUND_DITHER)                                          \
+        for(i = 0; i < count; ++i)                                           \
+            store_code(data + i*(BYTES),                                     \
+                       value_to_code(codec, values[i],                       \
+                                     dither_next(dither, i), flip),          \
+                       (BYTES), (ORDER));                                    \
+    else                                                                     \
+        for(i = 0; i < count; ++i)                                           \
+            store_code(data + i*(BYTES),                                     \
+                       value_to_code(codec, values[i], offset, flip),        \
+                       (BYTES), (ORDER));                                    \
+}                                                                            \
+static void decode_array_##SUFFIX (const struct fp_codec *codec,             \
+                                   const uint8_t *data, double *values,      \
+                                   size_t count)                             \
+{                                                                            \
+    const uint32_t flip = sign_flip(codec);                                  \
+    size_t i;                                                                \
+    for(i = 0; i < count; ++i)                                               \
+        values[i] = code_to_value(codec,                                     \
+                                  load_code(data + i*(BYTES), (BYTES),       \
+                                            (ORDER)), flip);                 \
+}
+
+FP_ARRAY_LOOPS(1, FP_BIG_ENDIAN,    1)
+FP_ARRAY_LOOPS(2, FP_BIG_ENDIAN,    2be)
+FP_ARRAY_LOOPS(3, FP_BIG_ENDIAN,    3be)
+FP_ARRAY_LOOPS(4, FP_BIG_ENDIAN,    4be)
+FP_ARRAY_LOOPS(2, FP_LITTLE_ENDIAN, 2le)
+FP_ARRAY_LOOPS(3, FP_LITTLE_ENDIAN, 3le)
+FP_ARRAY_LOOPS(4, FP_LITTLE_ENDIAN, 4le)
+
+// Curve samples are 16-bit big endian codes. On x86 they get dedicated SSE4.1
+// and AVX2 kernels (byte swap, widen, scale and the reverse), picked once at
+// run time, so the IOC binary still runs on processors without them.
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FP_X86_KERNELS
+#include <immintrin.h>
+
+__attribute__((target("sse4.1")))
+static void decode_array_2be_sse41 (const struct fp_codec *codec,
+                                    const uint8_t *data, double *values,
+                                    size_t count)
+{
+    const __m128i swap  = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6,
+                                        9, 8, 11, 10, 13, 12, 15, 14);
+    const __m128i flip  = _mm_set1_epi32((int) sign_flip(codec));
+    const __m128i mask  = _mm_set1_epi32((int) codec->max_code);
+    const __m128d scale = _mm_set1_pd(codec->scale);
+    const __m128d min   = _mm_set1_pd(codec->min);
+    size_t i;
+
+    for(i = 0; i + 4 <= count; i += 4)
+    {
+        __m128i raw   = _mm_loadl_epi64((const __m128i *) (data + 2*i));
+        __m128i codes = _mm_cvtepu16_epi32(_mm_shuffle_epi8(raw, swap));
+        codes = _mm_and_si128(_mm_xor_si128(codes, flip), mask);
+
+        __m128d lo = _mm_cvtepi32_pd(codes);
+        __m128d hi = _mm_cvtepi32_pd(_mm_srli_si128(codes, 8));
+
+        _mm_storeu_pd(values + i,     _mm_add_pd(min, _mm_mul_pd(lo, scale)));
+        _mm_storeu_pd(values + i + 2, _mm_add_pd(min, _mm_mul_pd(hi, scale)));
+    }
+
+    decode_array_2be(codec, data + 2*i, values + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void decode_array_2be_avx2 (const struct fp_codec *codec,
+                                   const uint8_t *data, double *values,
+                                   size_t count)
+{
+    const __m128i swap  = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6,
+                                        9, 8, 11, 10, 13, 12, 15, 14);
+    const __m256i flip  = _mm256_set1_epi32((int) sign_flip(codec));
+    const __m256i mask  = _mm256_set1_epi32((int) codec->max_code);
+    const __m256d scale = _mm256_set1_pd(codec->scale);
+    const __m256d min   = _mm256_set1_pd(codec->min);
+    size_t i;
+
+    for(i = 0; i + 8 <= count; i += 8)
+    {
+        __m128i raw   = _mm_loadu_si128((const __m128i *) (data + 2*i));
+        __m256i codes = _mm256_cvtepu16_epi32(_mm_shuffle_epi8(raw, swap));
+        codes = _mm256_and_si256(_mm256_xor_si256(codes, flip), mask);
+
+        __m256d lo = _mm256_cvtepi32_pd(_mm256_castsi256_si128(codes));
+        __m256d hi = _mm256_cvtepi32_pd(_mm256_extracti128_si256(codes, 1));
+
+        // No FMA, so results match the scalar loop bit for bit
+        _mm256_storeu_pd(values + i,
+                         _mm256_add_pd(min, _mm256_mul_pd(lo, scale)));
+        _mm256_storeu_pd(values + i + 4,
+                         _mm256_add_pd(min, _mm256_mul_pd(hi, scale)));
+    }
+
+    decode_array_2be(codec, data + 2*i, values + i, count - i);
+}
+// Encoding takes eight samples per iteration, one per dither lane. Clamping
+// to [0, max_code] before truncating saturates like value_to_code, and maxpd
+// returns its second operand for NaN, so NaN goes to the lowest code too.
+
+__attribute__((target("sse4.1")))
+static void quantize_array_2be_sse41 (const struct fp_codec *codec,
+                                      const double *values, uint8_t *data,
+                                      size_t count, enum fp_rounding rounding,
+                                      struct fp_dither *dither)
+{
+    const __m128i swap      = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6,
+                                            9, 8, 11, 10, 13, 12, 15, 14);
+    const __m128i flip      = _mm_set1_epi32((int) sign_flip(codec));
+    const __m128d min       = _mm_set1_pd(codec->min);
+    const __m128d inv_scale = _mm_set1_pd(codec->inv_scale);
+    const __m128d zero      = _mm_setzero_pd();
+    const __m128d max_code  = _mm_set1_pd((double) codec->max_code);
+    const __m128d noise     = _mm_set1_pd(FP_DITHER_SCALE);
+    const int dithered      = rounding == FP_ROUND_DITHER;
+    __m128d offset[4];
+    __m128i state[2] = {_mm_setzero_si128(), _mm_setzero_si128()};
+    size_t i, j;
+
+    for(j = 0; j < 4; ++j)
+        offset[j] = _mm_set1_pd(rounding == FP_ROUND_NEAREST ? 0.5 : 0.0);
+
+    if(dithered)
+    {
+        state[0] = _mm_loadu_si128((const __m128i *) &dither->state[0]);
+        state[1] = _mm_loadu_si128((const __m128i *) &dither->state[4]);
+    }
+
+    for(i = 0; i + 8 <= count; i += 8)
+    {
+        __m128i codes[4];
+
+        if(dithered)
+        {
+            for(j = 0; j < 2; ++j)
+            {
+                __m128i s = state[j];
+                s = _mm_xor_si128(s, _mm_slli_epi32(s, 13));
+                s = _mm_xor_si128(s, _mm_srli_epi32(s, 17));
+                s = _mm_xor_si128(s, _mm_slli_epi32(s, 5));
+                state[j] = s;
+
+                s = _mm_srli_epi32(s, FP_DITHER_SHIFT);
+                offset[2*j]   = _mm_mul_pd(_mm_cvtepi32_pd(s), noise);
+                offset[2*j+1] = _mm_mul_pd(_mm_cvtepi32_pd(_mm_srli_si128(s, 8)),
+                                           noise);
+            }
+        }
+
+        for(j = 0; j < 4; ++j)
+        {
+            __m128d code = _mm_loadu_pd(values + i + 2*j);
+            code = _mm_add_pd(_mm_mul_pd(_mm_sub_pd(code, min), inv_scale),
+                              offset[j]);
+            code = _mm_min_pd(_mm_max_pd(code, zero), max_code);
+            codes[j] = _mm_cvttpd_epi32(code);
+        }
+
+        __m128i lo = _mm_xor_si128(_mm_unpacklo_epi64(codes[0], codes[1]), flip);
+        __m128i hi = _mm_xor_si128(_mm_unpacklo_epi64(codes[2], codes[3]), flip);
+
+        _mm_storeu_si128((__m128i *) (data + 2*i),
+                         _mm_shuffle_epi8(_mm_packus_epi32(lo, hi), swap));
+    }
+
+    if(dithered)
+    {
+        _mm_storeu_si128((__m128i *) &dither->state[0], state[0]);
+        _mm_storeu_si128((__m128i *) &dither->state[4], state[1]);
+    }
+
+    quantize_array_2be(codec, values + i, data + 2*i, count - i, rounding,
+                       dither);
+}
+
+__attribute__((target("avx2")))
+static void quantize_array_2be_avx2 (const struct fp_codec *codec,
+                                     const double *values, uint8_t *data,
+                                     size_t count, enum fp_rounding rounding,
+                                     struct fp_dither *dither)
+{
+    const __m128i swap      = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6,
+                                            9, 8, 11, 10, 13, 12, 15, 14);
+    const __m128i flip      = _mm_set1_epi32((int) sign_flip(codec));
+    const __m256d min       = _mm256_set1_pd(codec->min);
+    const __m256d inv_scale = _mm256_set1_pd(codec->inv_scale);
+    const __m256d zero      = _mm256_setzero_pd();
+    const __m256d max_code  = _mm256_set1_pd((double) codec->max_code);
+    const __m256d noise     = _mm256_set1_pd(FP_DITHER_SCALE);
+    const int dithered      = rounding == FP_ROUND_DITHER;
+    __m256d offset_lo, offset_hi;
+    __m256i state = _mm256_setzero_si256();
+    size_t i;
+
+    offset_lo = offset_hi =
+            _mm256_set1_pd(rounding == FP_ROUND_NEAREST ? 0.5 : 0.0);
+
+    if(dithered)
+        state = _mm256_loadu_si256((const __m256i *) dither->state);
+
+    for(i = 0; i + 8 <= count; i += 8)
+    {
+        if(dithered)
+        {
+            state = _mm256_xor_si256(state, _mm256_slli_epi32(state, 13));
+            state = _mm256_xor_si256(state, _mm256_srli_epi32(state, 17));
+            state = _mm256_xor_si256(state, _mm256_slli_epi32(state, 5));
+
+            __m256i s = _mm256_srli_epi32(state, FP_DITHER_SHIFT);
+            offset_lo = _mm256_mul_pd(
+                    _mm256_cvtepi32_pd(_mm256_castsi256_si128(s)), noise);
+            offset_hi = _mm256_mul_pd(
+                    _mm256_cvtepi32_pd(_mm256_extracti128_si256(s, 1)), noise);
+        }
+
+        // No FMA, so results match the scalar loop bit for bit
+        __m256d lo = _mm256_loadu_pd(values + i);
+        __m256d hi = _mm256_loadu_pd(values + i + 4);
+        lo = _mm256_add_pd(_mm256_mul_pd(_mm256_sub_pd(lo, min), inv_scale),
+                           offset_lo);
+        hi = _mm256_add_pd(_mm256_mul_pd(_mm256_sub_pd(hi, min), inv_scale),
+                           offset_hi);
+        lo = _mm256_min_pd(_mm256_max_pd(lo, zero), max_code);
+        hi = _mm256_min_pd(_mm256_max_pd(hi, zero), max_code);
+
+        __m128i codes_lo = _mm_xor_si128(_mm256_cvttpd_epi32(lo), flip);
+        __m128i codes_hi = _mm_xor_si128(_mm256_cvttpd_epi32(hi), flip);
+
+        _mm_storeu_si128((__m128i *) (data + 2*i),
+                         _mm_shuffle_epi8(_mm_packus_epi32(codes_lo, codes_hi),
+                                          swap));
+    }
+
+    if(dithered)
+        _mm256_storeu_si256((__m256i *) dither->state, state);
+
+    quantize_array_2be(codec, values + i, data + 2*i, count - i, rounding,
+                       dither);
+}
+#endif
+
+typedef void (*quantize_array_function) (const struct fp_codec *codec,
+                                         const double *values, uint8_t *data,
+                                         size_t count, enum fp_rounding rounding,
+                                         struct fp_dither *dither);
+
+typedef void (*decode_array_function) (const struct fp_codec *codec,
+                                       const uint8_t *data, double *values,
+                                       size_t count);
+
+static quantize_array_function quantize_array[2][FP_CODE_BYTES(FP_CODEC_MAX_BITS)+1] =
+{
+    [FP_BIG_ENDIAN]    = {NULL, quantize_array_1, quantize_array_2be,
+                          quantize_array_3be, quantize_array_4be},
+    [FP_LITTLE_ENDIAN] = {NULL, quantize_array_1, quantize_array_2le,
+                          quantize_array_3le, quantize_array_4le},
+};
+
+static decode_array_function decode_array[2][FP_CODE_BYTES(FP_CODEC_MAX_BITS)+1] =
+{
+    [FP_BIG_ENDIAN]    = {NULL, decode_array_1, decode_array_2be,
+                          decode_array_3be, decode_array_4be},
+    [FP_LITTLE_ENDIAN] = {NULL, decode_array_1, decode_array_2le,
+                          decode_array_3le, decode_array_4le},
+};
+
+static quantize_array_function select_quantize_array_2be (void)
+{
+#ifdef FP_X86_KERNELS
+    __builtin_cpu_init();
+
+    if(__builtin_cpu_supports("avx2"))
+        return quantize_array_2be_avx2;
+
+    if(__builtin_cpu_supports("sse4.1"))
+        return quantize_array_2be_sse41;
+#endif
+    return quantize_array_2be;
+}
+
+void fp_quantize_array (const struct fp_codec *codec, const double *values,
+                        uint8_t *data, size_t count, enum fp_rounding rounding,
+                        struct fp_dither *dither)
+{
+    // Selecting twice from concurrent callers is harmless
+    static quantize_array_function quantize_2be = NULL;
+    struct fp_dither local;
+
+    if(rounding == FP_ROUND_DITHER && !dither)
+    {
+        fp_dither_init(&local, 0);
+        dither = &local;
+    }
+
+    if(codec->order == FP_BIG_ENDIAN && codec->bytes == 2)
+    {
+        if(!quantize_2be)
+            quantize_2be = select_quantize_array_2be();
+
+        quantize_2be(codec, values, data, count, rounding, dither);
+        return;
+    }
+
+    quantize_array[codec->order][codec->bytes](codec, values, data, count,
+                                               rounding, dither);
+}
+
+void fp_quantize_blocks (const struct fp_codec *codec,
+                         const double *const *values, uint8_t *const *data,
+                         size_t count, size_t blocks,
+                         enum fp_rounding rounding, uint32_t seed)
+{
+    long i;
+
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static)
+#endif
+    for(i = 0; i < (long) blocks; ++i)
+    {
+        struct fp_dither dither;
+
+        if(rounding == FP_ROUND_DITHER)
+            fp_dither_init(&dither, seed + (uint32_t) i);
+
+        fp_quantize_array(codec, values[i], data[i], count, rounding, &dither);
+    }
+}
+
+void fp_encode_array (const struct fp_codec *codec, const double *values,
+                      uint8_t *data, size_t count)
+{
+    fp_quantize_array(codec, values, data, count, FP_ROUND_TRUNCATE, NULL);
+}
+
+static decode_array_function select_decode_array_2be (void)
+{
+#ifdef FP_X86_KERNELS
+    __builtin_cpu_init();
+
+    if(__builtin_cpu_supports("avx2"))
+        return decode_array_2be_avx2;
+
+    if(__builtin_cpu_supports("sse4.1"))
+        return decode_array_2be_sse41;
+#endif
+    return decode_array_2be;
+}
+
+void fp_decode_array (const struct fp_codec *codec, const uint8_t *data,
+                      double *values, size_t count)
+{
+    // Selecting twice from concurrent callers is harmless
+    static decode_array_function decode_2be = NULL;
+
+    if(codec->order == FP_BIG_ENDIAN && codec->bytes == 2)
+    {
+        if(!decode_2be)
+            decode_2be = select_decode_array_2be();
+
+        decode_2be(codec, data, values, count);
+        return;
+    }
+
+    decode_array[codec->order][codec->bytes](codec, data, values, count);
+}
@@ -0,0 +1,172 @@
+#ifndef FIXED_POINT_CODEC_H
+#define FIXED_POINT_CODEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif  /* __cplusplus */
+
+// Codes of a DAC/ADC variable. Codes are stored in the least significant bits
+// of the fewest whole bytes that can hold them, so an 18-bit code takes three
+// bytes on the wire.
+
+#define FP_CODEC_MIN_BITS       1
+#define FP_CODEC_MAX_BITS       32
+
+#define FP_MAX_CODE(bits)       ((uint32_t)((1ULL << (bits)) - 1))
+#define FP_CODE_BYTES(bits)     (((bits) + 7) / 8)
+
+enum fp_byte_order
+{
+    FP_BIG_ENDIAN,                  // Most significant byte first (PUC)
+    FP_LITTLE_ENDIAN,               // Least significant byte first
+};
+
+enum fp_rounding
+{
+    FP_ROUND_TRUNCATE,              // Toward the lowest code (fp_encode)
+    FP_ROUND_NEAREST,               // To the closest code
+    FP_ROUND_DITHER,                // Add up to one LSB of noise, then truncate
+};
+
+// State of the dither generator: one xorshift32 per lane, eight lanes so the
+// vector kernels and the scalar loop draw the same noise for the same seed
+#define FP_DITHER_LANES         8
+
+struct fp_dither
+{
+    uint32_t state[FP_DITHER_LANES];
+};
+
+struct fp_codec
+{
+    uint8_t  bits;                  // Number of significant bits of a code
+    uint8_t  bytes;                 // Number of bytes a code takes
+    uint8_t  is_signed;             // Two's complement (1) or offset binary (0)
+    uint8_t  order;                 // One of enum fp_byte_order
+    uint32_t max_code;              // 2^bits - 1
+    double   min;                   // Value of the lowest code
+    double   max;                   // Value of the highest code
+    double   scale;                 // Value of one LSB, (max-min)/max_code
+    double   inv_scale;             // Codes per unit of value, 1/scale
+};
+
+/**
+ * Initializer for a struct fp_codec. Every field, including the scale factors,
+ * is a constant expression, so codecs defined with it cost nothing at runtime.
+ */
+#define FP_CODEC_INITIALIZER(_bits, _is_signed, _min, _max, _order)          \
+    {                                                                        \
+        (_bits), FP_CODE_BYTES(_bits), (_is_signed), (_order),               \
+        FP_MAX_CODE(_bits), (_min), (_max),                                  \
+        ((_max) - (_min)) / (double) FP_MAX_CODE(_bits),                     \
+        (double) FP_MAX_CODE(_bits) / ((_max) - (_min))                      \
+    }
+
+// Offset binary +-10 V codecs, big endian, as used by the PUC DACs and ADCs
+extern const struct fp_codec fp_codec_bipolar_16;
+extern const struct fp_codec fp_codec_bipolar_18;
+extern const struct fp_codec fp_codec_bipolar_20;
+extern const struct fp_codec fp_codec_bipolar_24;
+extern const struct fp_codec fp_codec_bipolar_32;
+
+/**
+ * Fill a codec from its parameters, computing the scale factors. Codecs known
+ * at compile time should use FP_CODEC_INITIALIZER instead.
+ *
+ * @param codec [output] The codec to be filled
+ * @param bits [input] Width of the codes, from 1 to 32
+ * @param is_signed [input] Whether codes are two's complement
+ * @param min [input] Value of the lowest code
+ * @param max [input] Value of the highest code
+ * @param order [input] Byte order of the codes on the wire
+ *
+ * @return 0 if successful, -1 if a parameter is out of range
+ */
+int fp_codec_init (struct fp_codec *codec, unsigned int bits, int is_signed,
+                   double min, double max, enum fp_byte_order order);
+
+/**
+ * Return the predefined +-10 V codec for the given width, or NULL if there
+ * isn't one. Widths 16, 18, 20, 24 and 32 are predefined.
+ */
+const struct fp_codec *fp_codec_bipolar (unsigned int bits);
+
+/**
+ * Convert a value to its code, saturating at the ends of the range.
+ */
+uint32_t fp_to_code (const struct fp_codec *codec, double value);
+
+/**
+ * Convert a code to its value. Bits above codec->bits are ignored.
+ */
+double fp_from_code (const struct fp_codec *codec, uint32_t code);
+
+/**
+ * Convert a value to the bytes of its code, saturating at the ends of the
+ * range. Writes codec->bytes bytes.
+ */
+void   fp_encode (const struct fp_codec *codec, double value, uint8_t *data);
+
+/**
+ * Convert codec->bytes bytes of a code to its value.
+ */
+double fp_decode (const struct fp_codec *codec, const uint8_t *data);
+
+/**
+ * Convert count values to consecutive codes (count*codec->bytes bytes).
+ * Same as fp_quantize_array with FP_ROUND_TRUNCATE.
+ */
+void fp_encode_array (const struct fp_codec *codec, const double *values,
+                      uint8_t *data, size_t count);
+
+/**
+ * Seed a dither generator. The same seed always yields the same codes.
+ */
+void fp_dither_init (struct fp_dither *dither, uint32_t seed);
+
+/**
+ * Convert count values to consecutive codes (count*codec->bytes bytes),
+ * saturating at the ends of the range and rounding as requested. 16-bit big
+ * endian codes, the format of curve blocks, use vector kernels when the
+ * processor has them.
+ *
+ * @param codec [input] Codec of the codes
+ * @param values [input] Values to be converted
+ * @param data [output] Receives the codes, in codec->order
+ * @param count [input] Number of values
+ * @param rounding [input] How values between two codes are rounded
+ * @param dither [input/output] Noise generator for FP_ROUND_DITHER, advanced
+ *                              by count samples. If NULL, a generator seeded
+ *                              with 0 is used. Ignored by the other modes.
+ */
+void fp_quantize_array (const struct fp_codec *codec, const double *values,
+                        uint8_t *data, size_t count, enum fp_rounding rounding,
+                        struct fp_dither *dither);
+
+/**
+ * Convert several blocks of count values at once, in parallel when built
+ * with OpenMP. Block i is read from values[i] and written to data[i], so the
+ * codes can go straight into the payload of separate frames.
+ *
+ * @param seed [input] Block i is dithered with a generator seeded with
+ *                     seed + i. Ignored unless rounding is FP_ROUND_DITHER.
+ */
+void fp_quantize_blocks (const struct fp_codec *codec,
+                         const double *const *values, uint8_t *const *data,
+                         size_t count, size_t blocks,
+                         enum fp_rounding rounding, uint32_t seed);
+
+/**
+ * Convert count consecutive codes (count*codec->bytes bytes) to values.
+ */
+void fp_decode_array (const struct fp_codec *codec, const uint8_t *data,
+                      double *values, size_t count);
+
+#ifdef __cplusplus
+}
+#endif  /* __cplusplus */
+
+#endif  /* FIXED_POINT_CODEC_H */
@@ -4,7 +4,7 @@
 #include <epicsStdio.h>
 #include "asynDriver.h"
 /** Number of asyn parameters (asyn commands) this driver supports. */
-#define FRONTEND_N_PARAMS 9
+#define FRONTEND_N_PARAMS 11
 
 /** Specific asyn commands for this support module. These will be used and
  * managed by the parameter library (part of areaDetector). */
@@ -18,6 +18,8 @@ typedef enum FrontendParam_t {
 	t_sensor3 /** Temperature sensor 3*/,	
 	t_sensor4    /** Temeperature sensor 4*/,	
 	c1_switchstate      /** Switch state*/,
+	g_all               /** Values of all variables, as a waveform*/,
+	g_read              /** Values of the read-only variables*/,
 				
     FrontendLastParam
 } FrontendParam_t;
@@ -37,6 +39,8 @@ static FrontendParamStruct FrontendParam[FRONTEND_N_PARAMS] = {
 	{t_sensor3,   "T_Sensor3"},
 	{t_sensor4, "T_Sensor4"},
 	{c1_switchstate, "S_State"},
+	{g_all, "G_All"},
+	{g_read, "G_Read"},
 };
 
 asynStatus frontendparamProcess(asynUser *pasynUser, char *pstring, const char *drvInfo,const char **pptypeName, size_t *psize);
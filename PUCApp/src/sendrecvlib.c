@@ -87,12 +87,27 @@ int recvCommandEPICS(uint8_t *data, uint32_t *count)
     #endif
 
     uint8_t* header;
-    header = (uint8_t*) malloc(2*sizeof(char));
+    size_t header_size = 2;
+    header = (uint8_t*) malloc(SLLP_MAX_HEADER_SIZE*sizeof(char));
 
     status = pasynOctetSyncIO->read(user, (char*) header, 2, 5000, &bread, &eomReason);
     if(err = (status != asynSuccess)) printf("Error %d reading header\n", err); //TODO: Return error;
 
-    if(header[1] == 255)
+    if(header[0] == SLLP_EXTENDED_FRAME)
+    {
+        // Extended header: the size follows, 7 bits per byte
+        size = 0;
+        do
+        {
+            status = pasynOctetSyncIO->read(user, (char*) &header[header_size], 1, 5000, &bread, &eomReason);
+            if(err = (status != asynSuccess)) printf("Error %d reading header\n", err);
+            size |= (size_t)(header[header_size] & 0x7F) << 7*(header_size-2);
+        }while(header[header_size++] & 0x80 && header_size < SLLP_MAX_HEADER_SIZE);
+
+        if(size > SLLP_MAX_PAYLOAD)
+            size = 0;
+    }
+    else if(header[1] == 255)
 
         size = 16386;
     else
@@ -107,10 +122,10 @@ int recvCommandEPICS(uint8_t *data, uint32_t *count)
         if(err = (status != asynSuccess)) printf("Error %d reading payload\n", err);
     }
 
-    memcpy(packet, header, 2);
-    if(size > 0) memcpy(packet+2, payload, size);
+    memcpy(packet, header, header_size);
+    if(size > 0) memcpy(packet+header_size, payload, size);
 
-    *count = size+2;
+    *count = size+header_size;
 
     memcpy(data, packet, *count);
 
@@ -12,6 +12,11 @@ typedef struct sllp_client sllp_client_t;
 // and anything but 0 otherwise.
 typedef int (*sllp_comm_func_t) (uint8_t* data, uint32_t *count);
 
+// Notification function. Called with each new value of a subscribed variable
+// the server notifies (see sllp_subscribe).
+typedef void (*sllp_notify_t) (struct sllp_var_info *var, const uint8_t *value,
+                               void *user);
+
 // Structures representing 'objects' manipulated by the client library
 struct sllp_vars_list
 {
@@ -21,7 +26,7 @@ struct sllp_vars_list
 
 struct sllp_group
 {
-    uint8_t               id;           // ID of the group
+    uint16_t              id;           // ID of the group
     bool                  writable;     // Whether all variables in the group
                                         // are writable
     struct
@@ -29,7 +34,7 @@ struct sllp_group
         struct sllp_var_info** list;    // List of variables in the group
         uint32_t               count;   // Number of variables in the group
     }vars;
-    uint8_t               size;         // Sum of the sizes of all variables in
+    uint16_t              size;         // Sum of the sizes of all variables in
                                         // the group
 };
 
@@ -50,6 +55,25 @@ struct sllp_status
     uint8_t status;
 };
 
+// Requests sent together in one message (see sllp_batch_submit)
+#define SLLP_BATCH_MAX_REQUESTS 64
+
+struct sllp_batch
+{
+    uint8_t requests[SLLP_MAX_PAYLOAD]; // The requests, one after the other
+    uint32_t size;                      // How many bytes they take
+    struct
+    {
+        uint8_t       reply;            // Command code of a successful answer
+        uint8_t       *value;           // Where to put the value read, if any
+        uint8_t       size;             // Size of the value
+        enum sllp_err result;           // Outcome, after submitted
+    }list[SLLP_BATCH_MAX_REQUESTS];
+    uint32_t count;                     // Number of requests
+    uint32_t executed;                  // How many of them the server
+                                        // executed, after submitted
+};
+
 /**
  * Allocate a new SLLP Client instance, returning a handle to it. This instance
  * should be deallocated with sllp_client_destroy after its use.
@@ -77,8 +101,11 @@ enum sllp_err sllp_client_destroy (sllp_client_t *client);
 
 /*
  * Initializes an instance of the SLLP Client Library. Initialization means
- * that information about the server will be queried (list of variables, list
- * of groups, list of curves) and stored in the instance.
+ * that information about the server will be queried (capabilities, list of
+ * variables, list of groups, list of curves) and stored in the instance.
+ * Extended headers and compressed curve blocks are used from then on if the
+ * server offers them (see sllp_use_extended_headers and sllp_use_compression),
+ * and IDs are as wide as the server has them (see sllp_use_wide_ids).
  *
  * The instance MUST be initialized only once.
  *
@@ -311,6 +338,98 @@ enum sllp_err sllp_bin_op_var (sllp_client_t *client, enum sllp_bin_op op,
 enum sllp_err sllp_bin_op_group (sllp_client_t *client, enum sllp_bin_op op,
                                  struct sllp_group *grp, uint8_t *mask);
 
+/*
+ * Replace the value of a variable, in a single step of the server, only if it
+ * is still the expected one. Otherwise expected gets the value found, to try
+ * again from.
+ *
+ * @param sllp [input] A SLLP Client Library instance
+ * @param var [input] The variable
+ * @param expected [input/output] The value the variable must have, var->size
+ *                                bytes long
+ * @param value [input] The new value, var->size bytes long
+ * @param swapped [output] Whether the value was replaced
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: sllp, var, expected, value or swapped is a
+ *                               NULL pointer</li>
+ *   <li>SLLP_ERR_PARAM_INVALID: var is not a valid server variable</li>
+ *   <li>SLLP_ERR_COMM: There was a failure either sending or receiving a
+ *                      message</li>
+ * </ul>
+ */
+enum sllp_err sllp_cas_var (sllp_client_t *client, struct sllp_var_info *var,
+                            uint8_t *expected, uint8_t *value, bool *swapped);
+
+/*
+ * Replace the values of a group, all of them in a single step of the server,
+ * only if they are still the expected ones. Otherwise expected gets the values
+ * found.
+ *
+ * @param sllp [input] A SLLP Client Library instance
+ * @param grp [input] The group
+ * @param expected [input/output] The values the group must have, grp->size
+ *                                bytes long
+ * @param values [input] The new values, grp->size bytes long
+ * @param swapped [output] Whether the values were replaced
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: sllp, grp, expected, values or swapped is a
+ *                               NULL pointer</li>
+ *   <li>SLLP_ERR_PARAM_INVALID: grp is not a valid server group</li>
+ *   <li>SLLP_ERR_COMM: There was a failure either sending or receiving a
+ *                      message</li>
+ * </ul>
+ */
+enum sllp_err sllp_cas_group (sllp_client_t *client, struct sllp_group *grp,
+                              uint8_t *expected, uint8_t *values,
+                              bool *swapped);
+
+/*
+ * Add to a variable, in a single step of the server. The variable and addend
+ * are integers in the byte order of the server, of any size, and the sum
+ * wraps around; subtract by adding the two's complement.
+ *
+ * @param sllp [input] A SLLP Client Library instance
+ * @param var [input] The variable
+ * @param addend [input] What to add, var->size bytes long
+ * @param old [output] The value before, or NULL
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: sllp, var or addend is a NULL pointer</li>
+ *   <li>SLLP_ERR_PARAM_INVALID: var is not a valid server variable</li>
+ *   <li>SLLP_ERR_COMM: There was a failure either sending or receiving a
+ *                      message</li>
+ * </ul>
+ */
+enum sllp_err sllp_fetch_add_var (sllp_client_t *client,
+                                  struct sllp_var_info *var, uint8_t *addend,
+                                  uint8_t *old);
+
+/*
+ * Add to each variable of a group, all in a single step of the server, as in
+ * sllp_fetch_add_var.
+ *
+ * @param sllp [input] A SLLP Client Library instance
+ * @param grp [input] The group
+ * @param addends [input] What to add to each variable, grp->size bytes long
+ * @param old [output] The values before, or NULL
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: sllp, grp or addends is a NULL pointer</li>
+ *   <li>SLLP_ERR_PARAM_INVALID: grp is not a valid server group</li>
+ *   <li>SLLP_ERR_COMM: There was a failure either sending or receiving a
+ *                      message</li>
+ * </ul>
+ */
+enum sllp_err sllp_fetch_add_group (sllp_client_t *client,
+                                    struct sllp_group *grp, uint8_t *addends,
+                                    uint8_t *old);
+
 /*
  * Creates a group of variables from the specified variables list.
  *
@@ -397,12 +516,40 @@ enum sllp_err sllp_send_curve_block (sllp_client_t *client,
                                      uint8_t offset, uint8_t *data);
 
 /*
- * Request a recalculation of the checksum of a server curve.
+ * Read part of a curve, len bytes starting offset bytes into it, which may
+ * span blocks. Parts larger than 249 bytes need extended headers (see
+ * sllp_use_extended_headers).
+ *
+ * @param sllp [input] A SLLP Client Library instance
+ * @param curve [input] The curve to be read
+ * @param offset [input] Where the part starts, in bytes from the start of the
+ *                       curve
+ * @param len [input] Size of the part, at most SLLP_MAX_PAYLOAD - 5 bytes
+ * @param data [output] Buffer to hold the part, len bytes long
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: sllp, curve or data is a NULL pointer</li>
+ *   <li>SLLP_ERR_PARAM_OUT_OF_RANGE: len is 0 or too large</li>
+ *   <li>SLLP_ERR_COMM: There was a failure either sending or receiving a
+ *                      message, or the part is not within the curve</li>
+ * </ul>
+ */
+enum sllp_err sllp_request_curve_range (sllp_client_t *client,
+                                        struct sllp_curve_info *curve,
+                                        uint32_t offset, uint16_t len,
+                                        uint8_t *data);
+
+/*
+ * Request a recalculation of the checksum of a server curve, in the mode
+ * chosen with sllp_set_checksum_mode.
  *
- * The instance's list of curves is updated if the function is successful.
+ * If the function is successful, MD5 checksums are brought by an update of
+ * the instance's list of curves, which replaces it (see sllp_get_curves_list).
+ * Checksums in other modes are left in curve->checksum.
  *
  * @param sllp [input] A SLLP Client Library instance
- * @param curve [input] The curve to have its checksum recalculated
+ * @param curve [input/output] The curve to have its checksum recalculated
  *
  * @return SLLP_SUCCESS or one of the following errors:
  * <ul>
@@ -414,5 +561,280 @@ enum sllp_err sllp_send_curve_block (sllp_client_t *client,
 enum sllp_err sllp_recalc_checksum (sllp_client_t *client,
                                     struct sllp_curve_info *curve);
 
-#endif
+/*
+ * Choose how the server computes the curve checksums this instance asks for
+ * with sllp_recalc_checksum. MD5 is used until this function is called. The
+ * mode goes with each request, so other clients of the same server keep their
+ * own. Servers that don't support a mode refuse the requests.
+ *
+ * @param sllp [input] A SLLP Client Library instance
+ * @param mode [input] One of enum sllp_checksum
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: sllp is a NULL pointer or mode is not one of
+ *                               enum sllp_checksum</li>
+ * </ul>
+ */
+enum sllp_err sllp_set_checksum_mode (sllp_client_t *client,
+                                      enum sllp_checksum mode);
+
+/*
+ * Register a function to be called with the values the server notifies. It's
+ * called while waiting for the response to any request, since notifications
+ * may arrive before it, and by sllp_process_notification. Passing NULL
+ * discards notifications.
+ *
+ * @param sllp [input] A SLLP Client Library instance
+ * @param notify [input] Notification function
+ * @param user [input] Passed to notify as is
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: sllp is a NULL pointer</li>
+ * </ul>
+ */
+enum sllp_err sllp_register_notify (sllp_client_t *client, sllp_notify_t notify,
+                                    void *user);
 
+/*
+ * Ask the server to notify changes of a variable. Its current value is
+ * notified first. Subscribing again to the same variable changes interval and
+ * deadband.
+ *
+ * @param sllp [input] A SLLP Client Library instance
+ * @param var [input] The variable to be watched
+ * @param interval [input] Least time between notifications, in milliseconds
+ * @param deadband [input] Least change notified, for variables of 1, 2, 4 or 8
+ *                         bytes taken as signed integers in the byte order of
+ *                         the server. 0 notifies any change.
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: either sllp or var is a NULL pointer</li>
+ *   <li>SLLP_ERR_COMM: There was a failure either sending or receiving a
+ *                      message, or the server can't take more
+ *                      subscriptions</li>
+ * </ul>
+ */
+enum sllp_err sllp_subscribe (sllp_client_t *client, struct sllp_var_info *var,
+                              uint16_t interval, uint32_t deadband);
+
+/*
+ * Stop the notifications of a variable.
+ *
+ * @param sllp [input] A SLLP Client Library instance
+ * @param var [input] The variable, or NULL for every variable
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: sllp is a NULL pointer</li>
+ *   <li>SLLP_ERR_COMM: There was a failure either sending or receiving a
+ *                      message</li>
+ * </ul>
+ */
+enum sllp_err sllp_unsubscribe (sllp_client_t *client,
+                                struct sllp_var_info *var);
+
+/*
+ * Dispatch a notification received while no request was pending to the
+ * notification function.
+ *
+ * @param sllp [input] A SLLP Client Library instance
+ * @param data [input] The message received
+ * @param size [input] Size of the message, header included
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: sllp or data is a NULL pointer, or data is not
+ *                               a notification</li>
+ *   <li>SLLP_ERR_COMM: The notification refers to unknown variables</li>
+ * </ul>
+ */
+enum sllp_err sllp_process_notification (sllp_client_t *client,
+                                         const uint8_t *data, uint32_t size);
+
+/*
+ * Get the statistics of the server: how many requests of each command it
+ * handled and how long it took, in ticks of its clock, plus how many requests
+ * were malformed or unsupported.
+ *
+ * @param sllp [input] A SLLP Client Library instance
+ * @param stats [output] The statistics
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: either sllp or stats is a NULL pointer</li>
+ *   <li>SLLP_ERR_COMM: There was a failure either sending or receiving a
+ *                      message</li>
+ * </ul>
+ */
+enum sllp_err sllp_query_stats (sllp_client_t *client,
+                                struct sllp_stats *stats);
+
+/*
+ * Returns the features the server offers and its limits. Servers too old to
+ * tell offer none, and their limits are 0.
+ *
+ * The sllp instance MUST be previously initialized. Otherwise no features are
+ * returned.
+ *
+ * @param sllp [input] A SLLP Client Library instance
+ * @param caps [output] Address of the capabilities pointer
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: either sllp or caps is a NULL pointer</li>
+ * </ul>
+ */
+enum sllp_err sllp_get_capabilities (sllp_client_t *client,
+                                     struct sllp_capabilities **caps);
+
+/*
+ * Send every request with an extended header (see SLLP_EXTENDED_FRAME), so
+ * that requests and responses of any size up to SLLP_MAX_PAYLOAD, e.g. reads
+ * and writes of groups larger than 254 bytes, go through. Only for servers
+ * that offer SLLP_CAP_EXTENDED_SIZE: others would lose track of the messages.
+ *
+ * @param sllp [input] A SLLP Client Library instance
+ * @param enable [input] Whether to use extended headers
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: sllp is a NULL pointer</li>
+ * </ul>
+ */
+enum sllp_err sllp_use_extended_headers (sllp_client_t *client, bool enable);
+
+/*
+ * Send and parse variable and group IDs as two bytes, most significant first,
+ * as servers switched to wide IDs expect (see SLLP_CAP_WIDE_IDS).
+ * sllp_client_init sets it from the capabilities of the server, so this is
+ * only needed for servers too old to tell them.
+ *
+ * @param sllp [input] A SLLP Client Library instance
+ * @param enable [input] Whether IDs take two bytes
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: sllp is a NULL pointer</li>
+ * </ul>
+ */
+enum sllp_err sllp_use_wide_ids (sllp_client_t *client, bool enable);
+
+/*
+ * Transfer curve blocks compressed (see deltarle.h) whenever that makes them
+ * smaller. Servers that can't take them answer so to the first one, and from
+ * then on blocks go raw. Compressed blocks larger than 252 bytes need extended
+ * headers (see sllp_use_extended_headers).
+ *
+ * @param sllp [input] A SLLP Client Library instance
+ * @param enable [input] Whether to compress curve blocks
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: sllp is a NULL pointer</li>
+ * </ul>
+ */
+enum sllp_err sllp_use_compression (sllp_client_t *client, bool enable);
+
+/*
+ * Empty a batch, to queue new requests in it with sllp_batch_read_var,
+ * sllp_batch_write_var and sllp_batch_bin_op_var.
+ *
+ * @param batch [output] The batch
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: batch is a NULL pointer</li>
+ * </ul>
+ */
+enum sllp_err sllp_batch_init (struct sllp_batch *batch);
+
+/*
+ * Queue the reading of a variable in a batch. value is filled when the batch
+ * is submitted.
+ *
+ * @param sllp [input] A SLLP Client Library instance
+ * @param batch [input/output] The batch
+ * @param var [input] Variable to be read
+ * @param value [output] Where to put the value, var->size bytes long
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: either sllp, batch, var or value is a NULL
+ *                               pointer, or var is not a variable of
+ *                               sllp</li>
+ *   <li>SLLP_ERR_OUT_OF_MEMORY: The batch is full</li>
+ * </ul>
+ */
+enum sllp_err sllp_batch_read_var (sllp_client_t *client,
+                                   struct sllp_batch *batch,
+                                   struct sllp_var_info *var, uint8_t *value);
+
+/*
+ * Queue the writing of a variable in a batch. value is copied right away.
+ *
+ * @param sllp [input] A SLLP Client Library instance
+ * @param batch [input/output] The batch
+ * @param var [input] Variable to be written
+ * @param value [input] The value, var->size bytes long
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: either sllp, batch, var or value is a NULL
+ *                               pointer, or var is not a variable of
+ *                               sllp</li>
+ *   <li>SLLP_ERR_OUT_OF_MEMORY: The batch is full</li>
+ * </ul>
+ */
+enum sllp_err sllp_batch_write_var (sllp_client_t *client,
+                                    struct sllp_batch *batch,
+                                    struct sllp_var_info *var, uint8_t *value);
+
+/*
+ * Queue a binary operation on a variable in a batch (see sllp_bin_op_var).
+ * mask is copied right away.
+ *
+ * @param sllp [input] A SLLP Client Library instance
+ * @param batch [input/output] The batch
+ * @param op [input] Binary operation
+ * @param var [input] Variable to be operated on
+ * @param mask [input] The mask, var->size bytes long
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: either sllp, batch, var or mask is a NULL
+ *                               pointer, or var is not a variable of
+ *                               sllp</li>
+ *   <li>SLLP_ERR_PARAM_OUT_OF_RANGE: op is not a valid operation</li>
+ *   <li>SLLP_ERR_OUT_OF_MEMORY: The batch is full</li>
+ * </ul>
+ */
+enum sllp_err sllp_batch_bin_op_var (sllp_client_t *client,
+                                     struct sllp_batch *batch,
+                                     enum sllp_bin_op op,
+                                     struct sllp_var_info *var,
+                                     uint8_t *mask);
+
+/*
+ * Send all the requests of a batch in a single message and collect their
+ * answers. The server executes them in order, stopping before the first whose
+ * answer might not fit the response. How many it executed is left in
+ * batch->executed, and the result of each request in batch->list[i].result:
+ * SLLP_SUCCESS, or SLLP_ERR_COMM if it failed or wasn't executed.
+ *
+ * @param sllp [input] A SLLP Client Library instance
+ * @param batch [input/output] The batch
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: either sllp or batch is a NULL pointer</li>
+ *   <li>SLLP_ERR_COMM: There was a failure either sending or receiving a
+ *                      message, or some request didn't succeed</li>
+ * </ul>
+ */
+enum sllp_err sllp_batch_submit (sllp_client_t *client,
+                                 struct sllp_batch *batch);
+
+#endif
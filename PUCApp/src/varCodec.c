@@ -0,0 +1,262 @@
+#include "varCodec.h"
+
+#include <string.h>
+
+int var_codec_init (struct var_codec *codec, unsigned int size,
+                    enum var_type type, enum fp_byte_order order,
+                    const struct fp_codec *fixed)
+{
+    if(!codec || (order != FP_BIG_ENDIAN && order != FP_LITTLE_ENDIAN))
+        return -1;
+
+    switch(type)
+    {
+    case VAR_TYPE_UINT:
+    case VAR_TYPE_INT:
+        if((size < 1 || size > 4) && size != 8)
+            return -1;
+        break;
+
+    case VAR_TYPE_IEEE:
+        if(size != 4 && size != 8)
+            return -1;
+        break;
+
+    case VAR_TYPE_FIXED:
+        if(!fixed || size != fixed->bytes)
+            return -1;
+        order = (enum fp_byte_order) fixed->order;
+        break;
+
+    default:
+        return -1;
+    }
+
+    codec->size  = size;
+    codec->type  = type;
+    codec->order = order;
+    codec->fixed = type == VAR_TYPE_FIXED ? fixed : NULL;
+
+    return 0;
+}
+
+// Raw access to the bytes of a variable, independent of the host byte order
+
+static inline uint64_t load_bits (const struct var_codec *codec,
+                                  const uint8_t *data)
+{
+    uint64_t bits = 0;
+    unsigned int i;
+
+    if(codec->order == FP_BIG_ENDIAN)
+        for(i = 0; i < codec->size; ++i)
+            bits = (bits << 8) | data[i];
+    else
+        for(i = codec->size; i > 0; --i)
+            bits = (bits << 8) | data[i-1];
+
+    return bits;
+}
+
+static inline void store_bits (const struct var_codec *codec, uint64_t bits,
+                               uint8_t *data)
+{
+    unsigned int i;
+
+    if(codec->order == FP_BIG_ENDIAN)
+        for(i = codec->size; i > 0; --i, bits >>= 8)
+            data[i-1] = bits & 0xFF;
+    else
+        for(i = 0; i < codec->size; ++i, bits >>= 8)
+            data[i] = bits & 0xFF;
+}
+
+static inline int64_t sign_extend (uint64_t bits, unsigned int size)
+{
+    unsigned int shift = 64 - 8*size;
+    return (int64_t) (bits << shift) >> shift;
+}
+
+static inline double load_ieee (const struct var_codec *codec,
+                                const uint8_t *data)
+{
+    uint64_t bits = load_bits(codec, data);
+
+    if(codec->size == 4)
+    {
+        uint32_t bits32 = (uint32_t) bits;
+        float value;
+        memcpy(&value, &bits32, sizeof(value));
+        return value;
+    }
+    else
+    {
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+}
+
+static inline void store_ieee (const struct var_codec *codec, double value,
+                               uint8_t *data)
+{
+    uint64_t bits;
+
+    if(codec->size == 4)
+    {
+        float value32 = (float) value;
+        uint32_t bits32;
+        memcpy(&bits32, &value32, sizeof(bits32));
+        bits = bits32;
+    }
+    else
+        memcpy(&bits, &value, sizeof(bits));
+
+    store_bits(codec, bits, data);
+}
+
+// Integer limits of a variable
+
+static inline int64_t int_min (const struct var_codec *codec)
+{
+    if(codec->type == VAR_TYPE_UINT)
+        return 0;
+    return codec->size == 8 ? INT64_MIN : -((int64_t) 1 << (8*codec->size-1));
+}
+
+static inline int64_t int_max (const struct var_codec *codec)
+{
+    if(codec->size == 8)
+        return INT64_MAX;
+    if(codec->type == VAR_TYPE_UINT)
+        return ((int64_t) 1 << (8*codec->size)) - 1;
+    return ((int64_t) 1 << (8*codec->size-1)) - 1;
+}
+
+static inline int32_t saturate_int32 (double value)
+{
+    if(!(value == value))               // NaN
+        return 0;
+    if(value >= (double) INT32_MAX)
+        return INT32_MAX;
+    if(value <= (double) INT32_MIN)
+        return INT32_MIN;
+    return (int32_t) value;
+}
+
+int32_t var_codec_to_int32 (const struct var_codec *codec,
+                            const uint8_t *data)
+{
+    uint64_t bits;
+    int64_t value;
+
+    switch(codec->type)
+    {
+    case VAR_TYPE_UINT:
+        bits = load_bits(codec, data);
+        return bits > INT32_MAX ? INT32_MAX : (int32_t) bits;
+
+    case VAR_TYPE_INT:
+        value = sign_extend(load_bits(codec, data), codec->size);
+        if(value > INT32_MAX) return INT32_MAX;
+        if(value < INT32_MIN) return INT32_MIN;
+        return (int32_t) value;
+
+    default:
+        return saturate_int32(var_codec_to_float64(codec, data));
+    }
+}
+
+double var_codec_to_float64 (const struct var_codec *codec,
+                             const uint8_t *data)
+{
+    switch(codec->type)
+    {
+    case VAR_TYPE_UINT:
+        return (double) load_bits(codec, data);
+
+    case VAR_TYPE_INT:
+        return (double) sign_extend(load_bits(codec, data), codec->size);
+
+    case VAR_TYPE_IEEE:
+        return load_ieee(codec, data);
+
+    case VAR_TYPE_FIXED:
+        return fp_decode(codec->fixed, data);
+
+    default:
+        return 0.0;
+    }
+}
+
+void var_codec_from_int32 (const struct var_codec *codec, int32_t value,
+                           uint8_t *data)
+{
+    int64_t min, max;
+
+    if(codec->type != VAR_TYPE_UINT && codec->type != VAR_TYPE_INT)
+    {
+        var_codec_from_float64(codec, (double) value, data);
+        return;
+    }
+
+    min = int_min(codec);
+    max = int_max(codec);
+
+    if(value < min) store_bits(codec, (uint64_t) min, data);
+    else if(value > max) store_bits(codec, (uint64_t) max, data);
+    else store_bits(codec, (uint64_t) (int64_t) value, data);
+}
+
+void var_codec_from_float64 (const struct var_codec *codec, double value,
+                             uint8_t *data)
+{
+    double min, max;
+
+    switch(codec->type)
+    {
+    case VAR_TYPE_UINT:
+    case VAR_TYPE_INT:
+        min = (double) int_min(codec);
+        max = (double) int_max(codec);
+
+        if(!(value == value))
+            value = 0.0;
+
+        // Doubles can't represent the 64-bit limits exactly, so those go
+        // through the limits themselves instead of a conversion
+        if(value <= min)
+            store_bits(codec, (uint64_t) int_min(codec), data);
+        else if(value >= max)
+            store_bits(codec, (uint64_t) int_max(codec), data);
+        else if(codec->type == VAR_TYPE_UINT)
+            store_bits(codec, (uint64_t) value, data);
+        else
+            store_bits(codec, (uint64_t) (int64_t) value, data);
+        break;
+
+    case VAR_TYPE_IEEE:
+        store_ieee(codec, value, data);
+        break;
+
+    case VAR_TYPE_FIXED:
+        fp_encode(codec->fixed, value, data);
+        break;
+    }
+}
+
+size_t var_codec_decode_group (const struct var_codec *const *codecs,
+                               size_t count, const uint8_t *payload,
+                               double *values)
+{
+    const uint8_t *p = payload;
+    size_t i;
+
+    for(i = 0; i < count; ++i)
+    {
+        values[i] = var_codec_to_float64(codecs[i], p);
+        p += codecs[i]->size;
+    }
+
+    return (size_t) (p - payload);
+}
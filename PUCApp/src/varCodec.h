@@ -0,0 +1,96 @@
+#ifndef VAR_CODEC_H
+#define VAR_CODEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "fixedPointCodec.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif  /* __cplusplus */
+
+// Largest value a SLLP variable can hold, in bytes (see SIZE_MASK)
+#define VAR_CODEC_MAX_SIZE      127
+
+enum var_type
+{
+    VAR_TYPE_UINT,                  // Unsigned integer, 1 to 4 or 8 bytes
+    VAR_TYPE_INT,                   // Two's complement, 1 to 4 or 8 bytes
+    VAR_TYPE_IEEE,                  // IEEE 754 binary32 or binary64
+    VAR_TYPE_FIXED,                 // DAC/ADC code, see fixedPointCodec.h
+};
+
+struct var_codec
+{
+    uint8_t                size;    // Size of the variable (sllp_var_info)
+    uint8_t                type;    // One of enum var_type
+    uint8_t                order;   // One of enum fp_byte_order
+    const struct fp_codec *fixed;   // Codec of VAR_TYPE_FIXED variables
+};
+
+/**
+ * Describe how the bytes of a variable map to a value.
+ *
+ * @param codec [output] The codec to be filled
+ * @param size [input] Size of the variable, as reported by the server
+ * @param type [input] How the bytes are interpreted
+ * @param order [input] Byte order of the variable. Ignored for
+ *                      VAR_TYPE_FIXED, which uses fixed->order.
+ * @param fixed [input] Fixed-point codec for VAR_TYPE_FIXED, NULL otherwise
+ *
+ * @return 0 if successful, -1 if size doesn't fit type (integers must be 1,
+ *         2, 3, 4 or 8 bytes long, IEEE values 4 or 8 bytes long and fixed
+ *         point values fixed->bytes long)
+ */
+int var_codec_init (struct var_codec *codec, unsigned int size,
+                    enum var_type type, enum fp_byte_order order,
+                    const struct fp_codec *fixed);
+
+/**
+ * Convert the bytes of a variable to an Int32. Values that don't fit are
+ * saturated and fractional values are truncated.
+ */
+int32_t var_codec_to_int32 (const struct var_codec *codec,
+                            const uint8_t *data);
+
+/**
+ * Convert the bytes of a variable to a Float64.
+ */
+double var_codec_to_float64 (const struct var_codec *codec,
+                             const uint8_t *data);
+
+/**
+ * Convert an Int32 to codec->size bytes. Values that don't fit the variable
+ * are saturated.
+ */
+void var_codec_from_int32 (const struct var_codec *codec, int32_t value,
+                           uint8_t *data);
+
+/**
+ * Convert a Float64 to codec->size bytes. Values that don't fit the variable
+ * are saturated.
+ */
+void var_codec_from_float64 (const struct var_codec *codec, double value,
+                             uint8_t *data);
+
+/**
+ * Decode the payload of a group reading. The payload holds the variables of
+ * the group back to back, in the same order as codecs.
+ *
+ * @param codecs [input] Codec of each variable of the group
+ * @param count [input] Number of variables in the group
+ * @param payload [input] Values read from the group
+ * @param values [output] Receives count values
+ *
+ * @return Number of payload bytes consumed
+ */
+size_t var_codec_decode_group (const struct var_codec *const *codecs,
+                               size_t count, const uint8_t *payload,
+                               double *values);
+
+#ifdef __cplusplus
+}
+#endif  /* __cplusplus */
+
+#endif  /* VAR_CODEC_H */
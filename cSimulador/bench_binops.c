@@ -0,0 +1,173 @@
+/*
+ * Time binary operations on a writable group of 130 variables stored back to
+ * back (16 KiB), the largest a CMD_BIN_OP_GROUP can carry. Every operation of
+ * the request is first checked against a byte by byte reference. Then XOR is
+ * timed as a whole request, as the binops.h kernel over the whole run, as the
+ * kernel called once per variable, and as the byte loop binops.h used before
+ * its kernels went a word at a time.
+ *
+ * Build and run:
+ *
+ *   gcc -std=gnu99 -O2 -o bench_binops bench_binops.c sllp_server.c \
+ *       sllp.c md5/md5.c crc32c.c deltarle.c && ./bench_binops
+ */
+
+#include "sllp_server.h"
+#include "common.h"
+#include "binops.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define NUM_VARS        130
+#define VAR_SIZE        127                         // The last one is smaller
+#define GROUP_SIZE      (SLLP_MAX_PAYLOAD - 2)      // Group ID and operation
+#define ROUNDS          20000
+
+static sllp_server_t *server;
+static uint8_t request[SLLP_MAX_MESSAGE];
+static uint8_t response[SLLP_MAX_MESSAGE];
+static uint8_t values[GROUP_SIZE], reference[GROUP_SIZE];
+static struct sllp_var vars[NUM_VARS];
+
+// The kernel binops.h had before, a byte at a time from the end
+static void old_xor (uint8_t *data, const uint8_t *mask, uint8_t size)
+{
+    while(size--)
+        data[size] ^= mask[size];
+}
+
+static uint8_t apply (char operation, uint8_t data, uint8_t mask)
+{
+    switch(operation)
+    {
+    case 'A':           return data & mask;
+    case 'O': case 'S': return data | mask;
+    case 'X': case 'T': return data ^ mask;
+    default:            return data & ~mask;
+    }
+}
+
+static double now (void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec*1e-9;
+}
+
+static uint8_t transact (uint32_t len)
+{
+    struct sllp_raw_packet in = {request, len};
+    struct sllp_raw_packet out = {response, 0};
+
+    sllp_process_packet(server, &in, &out);
+    return response[0];
+}
+
+int main (void)
+{
+    const char operations[] = "AXOCST";
+    uint8_t *mask = request + SLLP_HEADER_SIZE + 2;
+    uint32_t len = SLLP_HEADER_SIZE + 2 + GROUP_SIZE;
+    double t;
+    unsigned int i, j;
+
+    server = sllp_server_new();
+    if(!server)
+        return 1;
+
+    for(i = 0; i < NUM_VARS; i++)
+    {
+        vars[i].info.writable = true;
+        vars[i].info.size = i < NUM_VARS - 1 ? VAR_SIZE :
+                            GROUP_SIZE - (NUM_VARS - 1)*VAR_SIZE;
+        vars[i].data = values + i*VAR_SIZE;
+        if(sllp_register_variable(server, &vars[i]))
+            return 1;
+    }
+
+    // The standard groups take IDs 0 to 2, this one is 3
+    request[0] = CMD_CREATE_GROUP;
+    request[1] = NUM_VARS;
+    for(i = 0; i < NUM_VARS; i++)
+        request[SLLP_HEADER_SIZE + i] = i;
+
+    if(transact(SLLP_HEADER_SIZE + NUM_VARS) != CMD_OK)
+    {
+        printf("Couldn't create the group: 0x%02X\n", response[0]);
+        return 1;
+    }
+
+    request[0] = CMD_BIN_OP_GROUP;
+    request[1] = MAX_PAYLOAD_ENCODED;
+    request[2] = 3;
+
+    for(i = 0; i < sizeof(operations) - 1; i++)
+    {
+        for(j = 0; j < GROUP_SIZE; j++)
+        {
+            values[j] = reference[j] = rand();
+            mask[j] = rand();
+        }
+
+        request[3] = operations[i];
+        if(transact(len) != CMD_OK)
+        {
+            printf("Operation '%c' answered 0x%02X\n", operations[i],
+                   response[0]);
+            return 1;
+        }
+
+        for(j = 0; j < GROUP_SIZE; j++)
+        {
+            if(values[j] != apply(operations[i], reference[j], mask[j]))
+            {
+                printf("Operation '%c' is wrong at byte %u\n", operations[i],
+                       j);
+                return 1;
+            }
+        }
+    }
+
+    request[3] = 'X';
+
+    t = now();
+    for(i = 0; i < ROUNDS; i++)
+        transact(len);
+    t = (now() - t)/ROUNDS;
+    printf("CMD_BIN_OP_GROUP request:   %5.2f us\n", t*1e6);
+
+    t = now();
+    for(i = 0; i < ROUNDS; i++)
+    {
+        binops_xor(values, mask, GROUP_SIZE);
+        __asm__ volatile("" : : "r"(values) : "memory");
+    }
+    t = (now() - t)/ROUNDS;
+    printf("binops_xor over the run:    %5.2f us\n", t*1e6);
+
+    t = now();
+    for(i = 0; i < ROUNDS; i++)
+    {
+        for(j = 0; j < NUM_VARS; j++)
+            binops_xor(vars[j].data, mask + j*VAR_SIZE, vars[j].info.size);
+        __asm__ volatile("" : : "r"(values) : "memory");
+    }
+    t = (now() - t)/ROUNDS;
+    printf("binops_xor per variable:    %5.2f us\n", t*1e6);
+
+    t = now();
+    for(i = 0; i < ROUNDS; i++)
+    {
+        for(j = 0; j < NUM_VARS; j++)
+            old_xor(vars[j].data, mask + j*VAR_SIZE, vars[j].info.size);
+        __asm__ volatile("" : : "r"(values) : "memory");
+    }
+    t = (now() - t)/ROUNDS;
+    printf("Old byte loop per variable: %5.2f us\n", t*1e6);
+
+    sllp_server_destroy(server);
+    return 0;
+}
@@ -0,0 +1,144 @@
+/*
+ * Time curve checksums in both modes on a 256-block (4 MiB) curve, through
+ * the requests a client sends: a first checksum, which digests every block to
+ * build the tree of the mode, and the write of one block followed by a
+ * recalculation, which digests that block and its path up the tree.
+ *
+ * Build and run:
+ *
+ *   gcc -std=gnu99 -O2 -o bench_checksum bench_checksum.c sllp_server.c \
+ *       sllp.c md5/md5.c crc32c.c deltarle.c && ./bench_checksum
+ */
+
+#include "sllp_server.h"
+#include "common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define NBLOCKS         256
+#define FULL_ROUNDS     50
+#define WRITE_ROUNDS    5000
+
+static sllp_server_t *server;
+static uint8_t request[SLLP_MAX_MESSAGE];
+static uint8_t response[SLLP_MAX_MESSAGE];
+static uint8_t memory[NBLOCKS*SLLP_CURVE_BLOCK_SIZE];
+
+static void read_block (struct sllp_curve *curve, uint8_t block, uint8_t *data)
+{
+    (void) curve;
+    memcpy(data, memory + block*SLLP_CURVE_BLOCK_SIZE, SLLP_CURVE_BLOCK_SIZE);
+}
+
+static void write_block (struct sllp_curve *curve, uint8_t block,
+                         uint8_t *data)
+{
+    (void) curve;
+    memcpy(memory + block*SLLP_CURVE_BLOCK_SIZE, data, SLLP_CURVE_BLOCK_SIZE);
+}
+
+static double now (void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec*1e-9;
+}
+
+// Send a request whose header and payload are already in request[]
+static void transact (uint32_t len, uint8_t answer)
+{
+    struct sllp_raw_packet in = {request, len};
+    struct sllp_raw_packet out = {response, 0};
+
+    sllp_process_packet(server, &in, &out);
+
+    if(response[0] != answer)
+    {
+        printf("Command 0x%02X answered 0x%02X\n", request[0], response[0]);
+        exit(1);
+    }
+}
+
+static void recalc (enum sllp_checksum mode)
+{
+    request[0] = CMD_CURVE_RECALC_CSUM;
+    request[1] = 2;
+    request[2] = 0;
+    request[3] = mode;
+    transact(4, CMD_CURVE_CSUM);
+}
+
+// A new server, whose trees are yet to be built
+static void start_server (struct sllp_curve *curve)
+{
+    if(server)
+        sllp_server_destroy(server);
+
+    server = sllp_server_new();
+
+    if(!server || sllp_register_curve(server, curve))
+    {
+        printf("Couldn't set up the server\n");
+        exit(1);
+    }
+}
+
+static void bench (const char *name, enum sllp_checksum mode,
+                   struct sllp_curve *curve)
+{
+    double full = 0, write = 0, t;
+    int i;
+
+    for(i = 0; i < FULL_ROUNDS; i++)
+    {
+        start_server(curve);
+
+        t = now();
+        recalc(mode);
+        full += now() - t;
+    }
+    full /= FULL_ROUNDS;
+
+    for(i = 0; i < WRITE_ROUNDS; i++)
+    {
+        uint8_t block = rand() % NBLOCKS;
+
+        request[0] = CMD_CURVE_BLOCK;
+        request[1] = MAX_PAYLOAD_ENCODED;
+        request[2] = 0;
+        request[3] = block;
+        request[4 + block % SLLP_CURVE_BLOCK_SIZE] ^= 0xFF;
+
+        t = now();
+        transact(SLLP_HEADER_SIZE + 2 + SLLP_CURVE_BLOCK_SIZE, CMD_OK);
+        recalc(mode);
+        write += now() - t;
+    }
+    write /= WRITE_ROUNDS;
+
+    printf("%-7s full checksum %5.1f ms (%4.0f MB/s), write+recalc %5.1f us\n",
+           name, full*1e3, sizeof(memory)/full/1e6, write*1e6);
+}
+
+int main (void)
+{
+    static struct sllp_curve curve;
+    unsigned int i;
+
+    for(i = 0; i < sizeof(memory); i++)
+        memory[i] = rand();
+
+    curve.info.writable = true;
+    curve.info.nblocks = NBLOCKS - 1;
+    curve.read_block = read_block;
+    curve.write_block = write_block;
+
+    bench("md5", SLLP_CHECKSUM_MD5, &curve);
+    bench("crc32c", SLLP_CHECKSUM_CRC32C, &curve);
+
+    sllp_server_destroy(server);
+    return 0;
+}
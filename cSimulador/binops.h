@@ -2,34 +2,45 @@
 #define BINOPS_H
 
 #include <stdint.h>
-
-typedef void (*bin_op_function) (uint8_t *data, uint8_t *mask, uint8_t size);
-
-inline void binops_xor(uint8_t *data, uint8_t *mask, uint8_t size)
-{
-    while(size--)
-        data[size] ^= mask[size];
-}
-
-inline void binops_or(uint8_t *data, uint8_t *mask, uint8_t size)
-{
-    while(size--)
-        data[size] ^= mask[size];
+#include <stddef.h>
+#include <string.h>
+
+// Binary operations between the bytes of a value and a mask of the same size.
+// They go a 64-bit word at a time (the compiler is free to widen the loop to
+// vector registers) and then a byte at a time for the tail, so a whole group
+// payload can be handled in a single call.
+
+typedef void (*bin_op_function) (uint8_t *data, const uint8_t *mask,
+                                 size_t size);
+
+#define BINOPS_FUNCTION(name, expr)                                          \
+static inline void binops_##name (uint8_t *data, const uint8_t *mask,        \
+                                  size_t size)                               \
+{                                                                            \
+    size_t i = 0;                                                            \
+                                                                             \
+    for(; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))               \
+    {                                                                        \
+        uint64_t d, m;                                                       \
+        memcpy(&d, data + i, sizeof(d));                                     \
+        memcpy(&m, mask + i, sizeof(m));                                     \
+        d = (expr);                                                          \
+        memcpy(data + i, &d, sizeof(d));                                     \
+    }                                                                        \
+                                                                             \
+    for(; i < size; ++i)                                                     \
+    {                                                                        \
+        uint8_t d = data[i], m = mask[i];                                    \
+        data[i] = (uint8_t)(expr);                                           \
+    }                                                                        \
 }
 
-inline void binops_clear(uint8_t *data, uint8_t *mask, uint8_t size)
-{
-    while(size--)
-        data[size] &= ~mask[size];
-}
-
-inline void binops_and(uint8_t *data, uint8_t *mask, uint8_t size)
-{
-    while(size--)
-        data[size] &= mask[size];
-}
+BINOPS_FUNCTION(and,   d & m)
+BINOPS_FUNCTION(or,    d | m)
+BINOPS_FUNCTION(xor,   d ^ m)
+BINOPS_FUNCTION(clear, d & ~m)
 
-bin_op_function bin_op[256] =
+static const bin_op_function bin_op[256] =
 {
     ['A'] = binops_and,    // And
     ['X'] = binops_xor,    // Xor
@@ -1,204 +1,927 @@
+#define _GNU_SOURCE
 #include "sllp_server.h"
+#include "common.h"
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
-#include <netdb.h>
-#include <sys/types.h> 
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <math.h>
+#include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
-#define BUFSIZE 1024
+
+/*
+ * Simulated PUC served over TCP. Any number of clients (IOC ports) can be
+ * connected at once, all talking to the same SLLP server, so the simulator
+ * behaves like a single device shared by all of them.
+ *
+ * Every NOTIFY_PERIOD ms, changes of subscribed variables are notified to the
+ * clients that subscribed to any. Subscriptions belong to the server, so those
+ * clients share them. Notifications for a client still taking a response wait
+ * for it to be done, so slow clients hold back no one else.
+ *
+ * Usage: cSimulator [-p port] [-m model | -f file]
+ */
+
+#define DEFAULT_PORT	6791
+#define MAX_EVENTS	64
+#define NOTIFY_PERIOD	10
+
 void error(char *msg) {
-  perror(msg);
-  exit(1);
-}
-int main (){
-	struct sllp_var dummy[6];
-	enum sllp_err err;
-	uint8_t dble[8] = {0x7F,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF};
-	uint8_t mb[1] = { 0x03 }; 
-	sllp_server_t *sllp = sllp_server_new();
+	perror(msg);
+	exit(1);
+}
+
+/*
+ * Device models: the variables and curves the simulator exposes
+ */
+
+struct model
+{
+	const char *name;
+	const char *description;
+	void (*init)(sllp_server_t *sllp);
+	void (*tick)(sllp_server_t *sllp, uint32_t now);	// Every loop, or NULL
+};
+
+// Same variables as the original simulator
+static struct sllp_var dummy[6];
+static uint8_t dble[8] = {0x7F,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF};
+static uint8_t mb[1] = { 0x03 };
+
+static void dummy_init(sllp_server_t *sllp)
+{
+	int i;
+
+	for(i = 0; i < 5; i++)
+	{
+		dummy[i].info.writable = i == 0;
+		dummy[i].info.size = 8;
+		dummy[i].data = dble;
+	}
 
-	dummy[0].info.id = 0;
-	dummy[0].info.writable = true;
-	dummy[0].info.size = 8;
-	dummy[0].data = dble;
-
-	err = sllp_register_variable(sllp,&dummy[0]);
-	
-	dummy[1].info.id = 1;
-	dummy[1].info.writable = false;
-	dummy[1].info.size = 8;
-	dummy[1].data = dble;
-	
-	err = sllp_register_variable(sllp,&dummy[1]);
-	
-	dummy[2].info.id = 2;
-	dummy[2].info.writable = false;
-	dummy[2].info.size = 8;
-	dummy[2].data = dble;
-	
-	err = sllp_register_variable(sllp,&dummy[2]);
-	
-	dummy[3].info.id = 3;
-	dummy[3].info.writable = false;
-	dummy[3].info.size = 8;
-	dummy[3].data = dble;
-	
-	err = sllp_register_variable(sllp,&dummy[3]);
-	
-	dummy[4].info.id = 4;
-	dummy[4].info.writable = false;
-	dummy[4].info.size = 8;
-	dummy[4].data = dble;
-	
-	err = sllp_register_variable(sllp,&dummy[4]);
-	
-	dummy[5].info.id = 5;
 	dummy[5].info.writable = true;
 	dummy[5].info.size = 1;
 	dummy[5].data = mb;
-	
-	err = sllp_register_variable(sllp,&dummy[5]);
+
+	for(i = 0; i < 6; i++)
+		if(sllp_register_variable(sllp, &dummy[i]))
+			error("ERROR registering variable");
+}
+
+// PUC with its DACs, ADCs, digital I/O, a waveform curve kept in memory and
+// the history of the ADCs in a ring buffer curve
+#define PUC_CHANNELS		4
+#define PUC_CURVE_BLOCKS	4
+#define PUC_RING_BLOCKS		2
+#define PUC_RING_PERIOD		10
+
+static struct sllp_var puc_vars[2*PUC_CHANNELS + 3];
+static uint8_t puc_dac[PUC_CHANNELS][4];
+static uint8_t puc_adc[PUC_CHANNELS][4];
+static uint8_t puc_din[1];
+static uint8_t puc_dout[1];
+static uint8_t puc_mode[1];
+
+static struct sllp_curve puc_curve;
+static uint8_t puc_curve_data[PUC_CURVE_BLOCKS][SLLP_CURVE_BLOCK_SIZE];
+
+static struct sllp_var *puc_ring_vars[PUC_CHANNELS];
+static struct sllp_ring puc_ring;
+static uint8_t puc_ring_data[PUC_RING_BLOCKS][SLLP_CURVE_BLOCK_SIZE];
+
+static void puc_read_block(struct sllp_curve *curve, uint8_t block, uint8_t *data)
+{
+	(void) curve;
+	memcpy(data, puc_curve_data[block], SLLP_CURVE_BLOCK_SIZE);
+}
+
+static void puc_write_block(struct sllp_curve *curve, uint8_t block, uint8_t *data)
+{
+	(void) curve;
+	memcpy(puc_curve_data[block], data, SLLP_CURVE_BLOCK_SIZE);
+}
+
+static void puc_read_range(struct sllp_curve *curve, uint32_t offset,
+			   uint16_t len, uint8_t *data)
+{
+	(void) curve;
+	memcpy(data, &puc_curve_data[0][0] + offset, len);
+}
+
+static void puc_add(sllp_server_t *sllp, struct sllp_var *var, uint8_t *data,
+		    uint8_t size, bool writable)
+{
+	var->info.writable = writable;
+	var->info.size = size;
+	var->data = data;
+
+	if(sllp_register_variable(sllp, var))
+		error("ERROR registering variable");
+}
+
+static void puc_init(sllp_server_t *sllp)
+{
+	struct sllp_var *var = puc_vars;
+	int i;
+
+	for(i = 0; i < PUC_CHANNELS; i++)
+		puc_add(sllp, var++, puc_dac[i], sizeof(puc_dac[i]), true);
+	for(i = 0; i < PUC_CHANNELS; i++)
+	{
+		puc_ring_vars[i] = var;
+		puc_add(sllp, var++, puc_adc[i], sizeof(puc_adc[i]), false);
+	}
+
+	puc_add(sllp, var++, puc_din, sizeof(puc_din), false);
+	puc_add(sllp, var++, puc_dout, sizeof(puc_dout), true);
+	puc_add(sllp, var++, puc_mode, sizeof(puc_mode), true);
+
+	puc_curve.info.writable = true;
+	puc_curve.info.nblocks = PUC_CURVE_BLOCKS - 1;
+	puc_curve.read_block = puc_read_block;
+	puc_curve.write_block = puc_write_block;
+	puc_curve.read_range = puc_read_range;
+
+	if(sllp_register_curve(sllp, &puc_curve))
+		error("ERROR registering curve");
+
+	if(sllp_ring_init(&puc_ring, puc_ring_vars, PUC_CHANNELS,
+			  puc_ring_data[0], PUC_RING_BLOCKS - 1, PUC_RING_PERIOD) ||
+	   sllp_register_curve(sllp, &puc_ring.curve) ||
+	   sllp_register_variable(sllp, &puc_ring.index_var))
+		error("ERROR registering ring");
+}
+
+static void puc_tick(sllp_server_t *sllp, uint32_t now)
+{
+	sllp_ring_sample(sllp, &puc_ring, now);
+}
+
+static const struct model models[] =
+{
+	{"dummy", "five 8 byte variables and a 1 byte one", dummy_init, NULL},
+	{"puc", "DACs, ADCs, digital I/O, a 4 block curve and ADC history",
+	 puc_init, puc_tick},
+};
+
+#define NUM_MODELS	(sizeof(models)/sizeof(models[0]))
+
+/*
+ * Models loaded from a file (-f), one variable or curve per line, in the order
+ * of their IDs:
+ *
+ *   var[*count]   <size> <rw|ro> [signal]
+ *   curve[*count] <blocks> <rw|ro> [signal]
+ *
+ * where count repeats the line and signal is one of
+ *
+ *   const <value>
+ *   ramp  <amplitude> <period> [offset]
+ *   sine  <amplitude> <period> [offset]
+ *   noise <amplitude> [offset]
+ *
+ * Variables with a signal must be 1, 2, 4 or 8 bytes long and hold signed
+ * integers in the host byte order. Read-only ones follow their signal while
+ * the simulator runs, period in ms, writable ones only start from it. Curves
+ * hold 16 bit little endian samples, filled once along the curve, period in
+ * samples. Anything after a '#' is ignored. A BPM with 100 variables and a
+ * 4 MB curve of ADC samples, for example:
+ *
+ *   var*96 4 ro sine 100000 1000	# Positions and sums
+ *   var*4  4 rw const 1		# Gains
+ *   curve  256 ro noise 2000
+ *
+ * The values of all variables are adjacent in memory, so groups of them are
+ * copied at once. With more than 254 variables, IDs take two bytes.
+ */
+
+enum signal_kind
+{
+	SIGNAL_NONE,
+	SIGNAL_CONST,
+	SIGNAL_RAMP,
+	SIGNAL_SINE,
+	SIGNAL_NOISE,
+};
+
+struct signal
+{
+	enum signal_kind kind;
+	double amplitude;
+	double offset;
+	uint32_t period;
+};
+
+struct file_entry
+{
+	bool is_curve;
+	bool writable;
+	unsigned int size;	// Bytes of a variable or blocks of a curve
+	struct signal signal;
+	struct sllp_var var;
+	struct sllp_curve curve;
+	struct file_entry *next;
+};
+
+static const char *model_path;
+static struct file_entry *file_entries;
+
+static void parse_error(unsigned int line, const char *msg)
+{
+	fprintf(stderr, "%s:%u: %s\n", model_path, line, msg);
+	exit(1);
+}
+
+static double signal_value(const struct signal *signal, uint32_t t)
+{
+	double phase = signal->period ?
+		       (double)(t % signal->period)/signal->period : 0;
+
+	switch(signal->kind)
+	{
+	case SIGNAL_RAMP:
+		return signal->offset + signal->amplitude*phase;
+	case SIGNAL_SINE:
+		return signal->offset + signal->amplitude*sin(2*M_PI*phase);
+	case SIGNAL_NOISE:
+		return signal->offset +
+		       signal->amplitude*(2.0*rand()/RAND_MAX - 1);
+	default:
+		return signal->offset;
+	}
+}
+
+static void store_value(uint8_t *data, unsigned int size, double value)
+{
+	int64_t v = llround(value);
+	int8_t v8 = v;
+	int16_t v16 = v;
+	int32_t v32 = v;
+
+	switch(size)
+	{
+	case 1: memcpy(data, &v8, 1); break;
+	case 2: memcpy(data, &v16, 2); break;
+	case 4: memcpy(data, &v32, 4); break;
+	case 8: memcpy(data, &v, 8); break;
+	}
+}
+
+static void file_read_block(struct sllp_curve *curve, uint8_t block,
+			    uint8_t *data)
+{
+	memcpy(data, (uint8_t *) curve->user + block*SLLP_CURVE_BLOCK_SIZE,
+	       SLLP_CURVE_BLOCK_SIZE);
+}
+
+static void file_write_block(struct sllp_curve *curve, uint8_t block,
+			     uint8_t *data)
+{
+	memcpy((uint8_t *) curve->user + block*SLLP_CURVE_BLOCK_SIZE, data,
+	       SLLP_CURVE_BLOCK_SIZE);
+}
+
+static void file_read_range(struct sllp_curve *curve, uint32_t offset,
+			    uint16_t len, uint8_t *data)
+{
+	memcpy(data, (uint8_t *) curve->user + offset, len);
+}
+
+static void fill_curve(struct file_entry *entry)
+{
+	size_t samples = entry->size*SLLP_CURVE_BLOCK_SIZE/2;
+	uint8_t *data = malloc(2*samples);
+	size_t i;
+
+	if(!data)
+		error("ERROR allocating curve");
+
+	for(i = 0; i < samples; i++)
+	{
+		double value = signal_value(&entry->signal, i);
+		int16_t sample;
+
+		if(value > INT16_MAX)
+			value = INT16_MAX;
+		else if(value < INT16_MIN)
+			value = INT16_MIN;
+
+		sample = lround(value);
+		data[2*i] = (uint16_t) sample;
+		data[2*i + 1] = (uint16_t) sample >> 8;
+	}
+
+	entry->curve.info.writable = entry->writable;
+	entry->curve.info.nblocks = entry->size - 1;
+	entry->curve.read_block = file_read_block;
+	entry->curve.write_block = entry->writable ? file_write_block : NULL;
+	entry->curve.read_range = file_read_range;
+	entry->curve.user = data;
+}
+
+// Number in the current line, or fail
+static double parse_number(unsigned int line, const char *what)
+{
+	char *tok = strtok(NULL, " \t\r\n"), *end;
+	double value;
+
+	if(!tok)
+		parse_error(line, what);
+
+	value = strtod(tok, &end);
+	if(*end)
+		parse_error(line, what);
+
+	return value;
+}
+
+static void parse_signal(unsigned int line, struct signal *signal)
+{
+	char *tok = strtok(NULL, " \t\r\n");
+	double period;
+
+	memset(signal, 0, sizeof(*signal));
+
+	if(!tok)
+		return;
+
+	if(!strcmp(tok, "const"))
+	{
+		signal->kind = SIGNAL_CONST;
+		signal->offset = parse_number(line, "expected a value");
+	}
+	else if(!strcmp(tok, "ramp") || !strcmp(tok, "sine"))
+	{
+		signal->kind = tok[0] == 'r' ? SIGNAL_RAMP : SIGNAL_SINE;
+		signal->amplitude = parse_number(line, "expected an amplitude");
+		period = parse_number(line, "expected a period");
+		if(period < 1 || period > UINT32_MAX)
+			parse_error(line, "invalid period");
+		signal->period = period;
+	}
+	else if(!strcmp(tok, "noise"))
+	{
+		signal->kind = SIGNAL_NOISE;
+		signal->amplitude = parse_number(line, "expected an amplitude");
+	}
+	else
+		parse_error(line, "unknown signal");
+
+	if(signal->kind != SIGNAL_CONST && (tok = strtok(NULL, " \t\r\n")))
+	{
+		char *end;
+
+		signal->offset = strtod(tok, &end);
+		if(*end)
+			parse_error(line, "invalid offset");
+	}
+
+	if(strtok(NULL, " \t\r\n"))
+		parse_error(line, "too many fields");
+}
+
+// Read the entries of the model file, in order
+static void parse_model(void)
+{
+	struct file_entry **tail = &file_entries;
+	unsigned int line = 0;
+	char buf[256];
+	FILE *f;
+
+	if(!(f = fopen(model_path, "r")))
+		error("ERROR opening model");
+
+	while(fgets(buf, sizeof(buf), f))
+	{
+		struct file_entry entry;
+		char *tok, *count_str, *end;
+		long count = 1;
+		double size;
+
+		line++;
+		buf[strcspn(buf, "#")] = '\0';
+
+		if(!(tok = strtok(buf, " \t\r\n")))
+			continue;
+
+		if((count_str = strchr(tok, '*')))
+		{
+			*count_str++ = '\0';
+			count = strtol(count_str, &end, 10);
+			if(*end || count < 1)
+				parse_error(line, "invalid count");
+		}
+
+		memset(&entry, 0, sizeof(entry));
+
+		if(!strcmp(tok, "var"))
+			entry.is_curve = false;
+		else if(!strcmp(tok, "curve"))
+			entry.is_curve = true;
+		else
+			parse_error(line, "expected var or curve");
+
+		size = parse_number(line, entry.is_curve ? "expected blocks" :
+							   "expected a size");
+		if(entry.is_curve ? size < 1 || size > 256 :
+				    size < 1 || size > SIZE_MASK)
+			parse_error(line, entry.is_curve ? "invalid blocks" :
+							   "invalid size");
+		entry.size = size;
+
+		if(!(tok = strtok(NULL, " \t\r\n")) ||
+		   (strcmp(tok, "rw") && strcmp(tok, "ro")))
+			parse_error(line, "expected rw or ro");
+		entry.writable = tok[1] == 'w';
+
+		parse_signal(line, &entry.signal);
+
+		if(!entry.is_curve && entry.signal.kind != SIGNAL_NONE &&
+		   entry.size != 1 && entry.size != 2 && entry.size != 4 &&
+		   entry.size != 8)
+			parse_error(line, "signals need 1, 2, 4 or 8 bytes");
+
+		while(count--)
+		{
+			if(!(*tail = malloc(sizeof(entry))))
+				error("ERROR allocating model");
+			**tail = entry;
+			tail = &(*tail)->next;
+		}
+	}
+
+	if(ferror(f))
+		error("ERROR reading model");
+	fclose(f);
+}
+
+static void file_init(sllp_server_t *sllp)
+{
+	struct file_entry *entry;
+	unsigned int nvars = 0, ncurves = 0;
+	size_t values = 0;
+	uint8_t *data;
+
+	parse_model();
+
+	for(entry = file_entries; entry; entry = entry->next)
+		if(entry->is_curve)
+			ncurves++;
+		else
+		{
+			nvars++;
+			values += entry->size;
+		}
+
+	if(nvars > 254 && sllp_server_wide_ids(sllp, true))
+		error("ERROR enabling wide IDs");
+
+	if(!(data = calloc(1, values ? values : 1)))
+		error("ERROR allocating variables");
+
+	for(entry = file_entries; entry; entry = entry->next)
+	{
+		if(entry->is_curve)
+		{
+			fill_curve(entry);
+			if(sllp_register_curve(sllp, &entry->curve))
+				error("ERROR registering curve");
+			continue;
+		}
+
+		entry->var.info.writable = entry->writable;
+		entry->var.info.size = entry->size;
+		entry->var.data = data;
+		data += entry->size;
+
+		if(entry->signal.kind != SIGNAL_NONE)
+			store_value(entry->var.data, entry->size,
+				    signal_value(&entry->signal, 0));
+
+		if(sllp_register_variable(sllp, &entry->var))
+			error("ERROR registering variable");
+	}
+
+	printf("loaded %u variables (%zu bytes) and %u curves from %s\n",
+	       nvars, values, ncurves, model_path);
+}
+
+static void file_tick(sllp_server_t *sllp, uint32_t now)
+{
+	struct file_entry *entry;
+
+	(void) sllp;
+
+	for(entry = file_entries; entry; entry = entry->next)
+		if(!entry->is_curve && !entry->writable &&
+		   entry->signal.kind > SIGNAL_CONST)
+			store_value(entry->var.data, entry->size,
+				    signal_value(&entry->signal, now));
+}
+
+static struct model file_model = {NULL, "loaded from a file", file_init,
+				  file_tick};
+
+/*
+ * Connections. Each one owns buffers for a whole message each way, so curve
+ * blocks are served without any allocation. Messages that arrive whole in a
+ * single read are processed right where they were read.
+ */
+
+struct connection
+{
+	int fd;
+	bool subscriber;	// Sent CMD_SUBSCRIBE, so takes notifications
+	struct connection *prev, *next;
+	size_t in_len;		// Bytes read
+	size_t in_used;		// Bytes of those already fed to the decoder
+	size_t out_len;		// Bytes of the response
+	size_t out_sent;	// Bytes of the response already sent
+	size_t pending_len;	// Bytes of the notifications waiting for it
+	struct sllp_decoder decoder;
+	uint8_t in[SLLP_MAX_MESSAGE];
+	uint8_t out[SLLP_MAX_MESSAGE];
+	uint8_t pending[SLLP_MAX_MESSAGE];
+};
+
+static struct connection *connections;
+
+static int set_events(int epfd, struct connection *conn, uint32_t events)
+{
+	struct epoll_event ev;
+
+	ev.events = events;
+	ev.data.ptr = conn;
+
+	return epoll_ctl(epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+}
+
+// Send what's left of the response, then the notifications that waited for
+// it. Returns 1 when done, 0 if the socket is full and -1 on errors.
+static int flush(struct connection *conn)
+{
+	do
+	{
+		while(conn->out_sent < conn->out_len)
+		{
+			ssize_t n = send(conn->fd, conn->out + conn->out_sent,
+					 conn->out_len - conn->out_sent,
+					 MSG_NOSIGNAL);
+
+			if(n < 0)
+				return errno == EAGAIN || errno == EWOULDBLOCK ?
+				       0 : -1;
+
+			conn->out_sent += n;
+		}
+
+		memcpy(conn->out, conn->pending, conn->pending_len);
+		conn->out_len = conn->pending_len;
+		conn->out_sent = conn->pending_len = 0;
+	}while(conn->out_len);
+
+	return 1;
+}
+
+// Whether a request subscribes to a variable, by itself or within a batch
+static bool subscribes(const uint8_t *data, size_t len)
+{
+	const uint8_t *end = data + len;
+	uint8_t code;
+	uint32_t size;
+	unsigned int header = header_decode(data, len, &code, &size);
+
+	if(!header || size > len - header)
+		return false;
+
+	if(code != CMD_BATCH)
+		return code == CMD_SUBSCRIBE;
+
+	// Batches don't nest
+	for(data += header; data < end; data += header + size)
+	{
+		header = header_decode(data, end - data, &code, &size);
+
+		if(!header || size > (size_t)(end - data) - header)
+			return false;
+		if(code == CMD_SUBSCRIBE)
+			return true;
+	}
+
+	return false;
+}
+
+// Answer the complete messages received, one at a time. Returns -1 if the
+// connection must be closed.
+static int serve(sllp_server_t *sllp, int epfd, struct connection *conn)
+{
+	int done;
+
+	while((done = flush(conn)) > 0 && conn->in_used < conn->in_len)
+	{
+		struct sllp_raw_packet request;
+		struct sllp_raw_packet response = {conn->out, 0};
+
+		conn->in_used += sllp_decoder_feed(&conn->decoder,
+						   conn->in + conn->in_used,
+						   conn->in_len - conn->in_used,
+						   &request);
+		if(!request.len)
+			continue;
+
+		if(subscribes(request.data, request.len))
+			conn->subscriber = true;
+
+		sllp_process_packet(sllp, &request, &response);
+		conn->out_len = response.len;
+	}
+
+	if(done < 0)
+		return -1;
+
+	// Stop reading until the client takes the response
+	return set_events(epfd, conn, done ? EPOLLIN : EPOLLOUT);
+}
+
+static void close_connection(int epfd, struct connection *conn)
+{
+	epoll_ctl(epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+	close(conn->fd);
+
+	if(conn->prev)
+		conn->prev->next = conn->next;
+	else
+		connections = conn->next;
+	if(conn->next)
+		conn->next->prev = conn->prev;
+
+	free(conn);
+}
+
+static void accept_connections(int epfd, int parentfd)
+{
+	struct sockaddr_in clientaddr;
+	socklen_t clientlen = sizeof(clientaddr);
+	int childfd;
+
+	while((childfd = accept4(parentfd, (struct sockaddr *) &clientaddr,
+				 &clientlen, SOCK_NONBLOCK)) >= 0)
+	{
+		struct connection *conn = malloc(sizeof(*conn));
+		struct epoll_event ev;
+		int optval = 1;
+
+		if(!conn)
+		{
+			close(childfd);
+			continue;
+		}
+
+		conn->fd = childfd;
+		conn->subscriber = false;
+		conn->in_len = conn->in_used = 0;
+		conn->out_len = conn->out_sent = 0;
+		conn->pending_len = 0;
+		sllp_decoder_init(&conn->decoder);
+
+		// Replies are single messages, send them right away
+		setsockopt(childfd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
+
+		ev.events = EPOLLIN;
+		ev.data.ptr = conn;
+
+		if(epoll_ctl(epfd, EPOLL_CTL_ADD, childfd, &ev) < 0)
+		{
+			close(childfd);
+			free(conn);
+			continue;
+		}
+
+		conn->prev = NULL;
+		conn->next = connections;
+		if(connections)
+			connections->prev = conn;
+		connections = conn;
+
+		printf("connection from %s:%d\n", inet_ntoa(clientaddr.sin_addr),
+		       ntohs(clientaddr.sin_port));
+		clientlen = sizeof(clientaddr);
+	}
+}
+
+static uint32_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+// Times the commands in the server statistics
+static uint32_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+// Send the changes of subscribed variables to the subscribers. Those still
+// busy with a response get them queued after it, unless so many are queued
+// already that the client is not keeping up at all, which loses it the
+// connection rather than values.
+static void notify(sllp_server_t *sllp, int epfd)
+{
+	static uint8_t data[SLLP_MAX_MESSAGE];
+	struct sllp_raw_packet notification = {data, 0};
+	struct connection *conn, *next;
+	bool any = false;
+
+	for(conn = connections; conn && !any; conn = conn->next)
+		any = conn->subscriber;
+
+	if(!any)
+		return;
+
+	sllp_server_notify(sllp, now_ms(), &notification);
+	if(!notification.len)
+		return;
+
+	for(conn = connections; conn; conn = next)
+	{
+		next = conn->next;
+
+		if(!conn->subscriber)
+			continue;
+
+		if(conn->out_len)
+		{
+			if(conn->pending_len + notification.len >
+			   sizeof(conn->pending))
+			{
+				close_connection(epfd, conn);
+				continue;
+			}
+
+			memcpy(conn->pending + conn->pending_len, data,
+			       notification.len);
+			conn->pending_len += notification.len;
+			continue;
+		}
+
+		memcpy(conn->out, data, notification.len);
+		conn->out_len = notification.len;
+
+		if(serve(sllp, epfd, conn) < 0)
+			close_connection(epfd, conn);
+	}
+}
+
+static void usage(const char *prog)
+{
+	size_t i;
+
+	fprintf(stderr, "Usage: %s [-p port] [-m model | -f file]\n\nModels:\n", prog);
+	for(i = 0; i < NUM_MODELS; i++)
+		fprintf(stderr, "  %-8s %s%s\n", models[i].name,
+			models[i].description, i ? "" : " (default)");
+	exit(1);
+}
+
+int main (int argc, char *argv[]){
+	const struct model *model = &models[0];
+	int portno = DEFAULT_PORT; /* port to listen on */
+	int opt, e;
+	size_t i;
+
+	while((opt = getopt(argc, argv, "p:m:f:h")) != -1)
+	{
+		switch(opt)
+		{
+		case 'p':
+			portno = atoi(optarg);
+			break;
+
+		case 'm':
+			for(i = 0; i < NUM_MODELS; i++)
+				if(!strcmp(optarg, models[i].name))
+					break;
+			if(i == NUM_MODELS)
+				usage(argv[0]);
+			model = &models[i];
+			break;
+
+		case 'f':
+			model_path = file_model.name = optarg;
+			model = &file_model;
+			break;
+
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	sllp_server_t *sllp = sllp_server_new();
+	if(!sllp)
+		error("ERROR creating server");
+
+	model->init(sllp);
+	sllp_register_clock(sllp, now_us);
 
 	int parentfd; /* parent socket */
-	int childfd; /* child socket */
-	int portno; /* port to listen on */
-	int clientlen; /* byte size of client's address */
 	struct sockaddr_in serveraddr; /* server's addr */
-	struct sockaddr_in clientaddr; /* client addr */
-	struct hostent *hostp; /* client host info */
-	char *hostaddrp; /* dotted decimal host addr string */
 	int optval; /* flag value for setsockopt */
-	int n; /* message byte size */
-
-	portno = 6791;
 
-	 /* 
-	  * socket: create the parent socket 
-	  */
-	parentfd = socket(AF_INET, SOCK_STREAM, 0);
-	if (parentfd < 0) 
+	parentfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (parentfd < 0)
 		error("ERROR opening socket");
 
-	/* setsockopt: Handy debugging trick that lets 
-	* us rerun the server immediately after we kill it; 
-	* otherwise we have to wait about 20 secs. 
-	* Eliminates "ERROR on binding: Address already in use" error. 
-	*/
+	/* setsockopt: lets us rerun the server immediately after we kill it */
 	optval = 1;
-	setsockopt(parentfd, SOL_SOCKET, SO_REUSEADDR, 
+	setsockopt(parentfd, SOL_SOCKET, SO_REUSEADDR,
 	     (const void *)&optval , sizeof(int));
 
-	/*
-	 * build the server's Internet address
-	 */
-	bzero((char *) &serveraddr, sizeof(serveraddr));
-
-	 /* this is an Internet address */
+	memset(&serveraddr, 0, sizeof(serveraddr));
 	serveraddr.sin_family = AF_INET;
-
-	/* let the system figure out our IP address */
 	serveraddr.sin_addr.s_addr = htonl(INADDR_ANY);
-
-	/* this is the port we will listen on */
 	serveraddr.sin_port = htons((unsigned short)portno);
 
-	/* 
-	* bind: associate the parent socket with a port 
-	*/
-	if (bind(parentfd, (struct sockaddr *) &serveraddr, 
-	 sizeof(serveraddr)) < 0) 
-	error("ERROR on binding");
-
-	  /* 
-	   * listen: make this socket ready to accept connection requests 
-	  */
-	if (listen(parentfd, 5) < 0) /* allow 5 requests to queue up */ 
-		 error("ERROR on listen");
-
-	/* 
-	* main loop: wait for a connection request, echo input line, 
-	* then close connection.
-	*/
-	/* 
-	* accept: wait for a connection request 
-	*/
-	clientlen = sizeof(clientaddr);
-	childfd = accept(parentfd, (struct sockaddr *) &clientaddr, &clientlen);
-	if (childfd < 0) 
-		error("ERROR on accept");
-   
-	/* 
-	* gethostbyaddr: determine who sent the message 
-	*/
-	hostp = gethostbyaddr((const char *)&clientaddr.sin_addr.s_addr, 
-	sizeof(clientaddr.sin_addr.s_addr), AF_INET);
-	if (hostp == NULL)
-		error("ERROR on gethostbyaddr");
-	hostaddrp = inet_ntoa(clientaddr.sin_addr);
-	if (hostaddrp == NULL)
-		error("ERROR on inet_ntoa\n");
-	printf("server established connection with %s (%s)\n", 
-	hostp->h_name, hostaddrp);
-	uint8_t *bufresponse;
-	uint8_t *buf; /* message buffer */
-	//uint8_t *bufresponse;
-	uint8_t *auxbuf;
-	struct sllp_raw_packet request;
-	struct sllp_raw_packet response;
-	int i =0;
+	if (bind(parentfd, (struct sockaddr *) &serveraddr,
+	 sizeof(serveraddr)) < 0)
+		error("ERROR on binding");
+
+	if (listen(parentfd, SOMAXCONN) < 0)
+		error("ERROR on listen");
+
+	int epfd = epoll_create1(0);
+	if (epfd < 0)
+		error("ERROR on epoll_create1");
+
+	struct epoll_event ev, events[MAX_EVENTS];
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL; /* the listening socket */
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, parentfd, &ev) < 0)
+		error("ERROR on epoll_ctl");
+
+	printf("serving model %s on port %d\n", model->name, portno);
+
 	while (1) {
-    		if(i == 1000)
-			break;
-    
-		/* 
-		* read: read input string from the client
-		*/
-		//bzero(buf, BUFSIZE);
-		//bzero(bufresponse, BUFSIZE);
-
-		buf = (uint8_t*)malloc(sizeof(uint8_t)*BUFSIZE);
-		
-		n = read(childfd, (char*)buf, BUFSIZE);
-		printf("n=%d\n",n);
-		auxbuf = (uint8_t*)malloc(n*sizeof(uint8_t));
-		if (n < 0) 
-			error("ERROR reading from socket");
-	
-		memcpy(auxbuf,buf,n);
-
-		//printf("server received %d bytes: b[0]=%d b[1]=%d\n\r",n,auxbuf[0],auxbuf[1]);
-
-		free(buf);
-
-		request.data = auxbuf;
-		request.len = n;
-
-		bufresponse = (uint8_t*)malloc(sizeof(uint8_t)*BUFSIZE);
-		response.data = bufresponse;
-		
-		sllp_process_packet (sllp,&request,&response);
-		/* 
-		* write: echo the input string back to the client 
-		*/
-		//printf("response: %d\n\r",response.len);
-		n = write(childfd, (char*)response.data, response.len);
-		if (n < 0) 
-			error("ERROR writing to socket");
-	
-		//printf("server sent %d bytes: ", n);
-		//for(i=0;i<response.len;i++)
-		//	printf("%d ",response.data[i]);		
-		//printf("\n");
-		free(auxbuf);
-		free(bufresponse);
-		i++;
-	}
-		
-		sllp_server_destroy(sllp);
-		close(childfd);
+		int n = epoll_wait(epfd, events, MAX_EVENTS, NOTIFY_PERIOD);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			error("ERROR on epoll_wait");
+		}
+
+		for (e = 0; e < n; e++) {
+			struct connection *conn = events[e].data.ptr;
+
+			if (!conn) {
+				accept_connections(epfd, parentfd);
+				continue;
+			}
+
+			if (events[e].events & (EPOLLERR | EPOLLHUP)) {
+				close_connection(epfd, conn);
+				continue;
+			}
+
+			/* everything read so far is decoded before reading again */
+			if (events[e].events & EPOLLIN &&
+			    conn->in_used == conn->in_len) {
+				ssize_t len = read(conn->fd, conn->in, sizeof(conn->in));
+
+				if (len == 0 || (len < 0 && errno != EAGAIN &&
+						 errno != EWOULDBLOCK)) {
+					close_connection(epfd, conn);
+					continue;
+				}
+
+				conn->in_len = len > 0 ? len : 0;
+				conn->in_used = 0;
+			}
+
+			if (serve(sllp, epfd, conn) < 0)
+				close_connection(epfd, conn);
+		}
+
+		if (model->tick)
+			model->tick(sllp, now_ms());
+
+		notify(sllp, epfd);
+	}
+
+	sllp_server_destroy(sllp);
+	close(parentfd);
 	return 0;
 }
-
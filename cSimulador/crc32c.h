@@ -0,0 +1,20 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Update a CRC-32C (Castagnoli) with len more bytes. Start with crc = 0 and
+ * feed the data in as many pieces as wanted; the result is the same as for a
+ * single call. Uses the CRC instructions of SSE4.2 or ARMv8 when available.
+ *
+ * @param crc [input] CRC of the data so far, 0 for none
+ * @param data [input] The next bytes
+ * @param len [input] Number of bytes in data
+ *
+ * @return The CRC of the data so far, including these bytes
+ */
+uint32_t crc32c (uint32_t crc, const uint8_t *data, size_t len);
+
+#endif
@@ -0,0 +1,134 @@
+#include "deltarle.h"
+
+#define SHORT_MIN       (-64)
+#define SHORT_MAX       63
+#define RUN             0x80
+#define LITERALS        0xC0
+#define COUNT_MAX       64
+
+static uint16_t get_sample (const uint8_t *data, size_t i)
+{
+    return data[2*i] | (data[2*i + 1] << 8);
+}
+
+static void put_sample (uint8_t *data, size_t i, uint16_t sample)
+{
+    data[2*i] = sample;
+    data[2*i + 1] = sample >> 8;
+}
+
+size_t deltarle_encode (const uint8_t *data, size_t len, uint8_t *out,
+                        size_t max)
+{
+    size_t count = len/2, i = 0, n = 0;
+    uint16_t prev = 0;
+    int16_t last = 0;
+
+    while(i < count)
+    {
+        int16_t delta = get_sample(data, i) - prev;
+
+        // Run of the last difference
+        if(i > 0 && delta == last)
+        {
+            size_t run = 1;
+            while(run < COUNT_MAX && i + run < count &&
+                  (int16_t)(get_sample(data, i + run) -
+                            get_sample(data, i + run - 1)) == last)
+                ++run;
+
+            if(n + 1 > max)
+                return 0;
+            out[n++] = RUN | (run - 1);
+            prev = get_sample(data, i + run - 1);
+            i += run;
+        }
+        // Short difference
+        else if(delta >= SHORT_MIN && delta <= SHORT_MAX)
+        {
+            if(n + 1 > max)
+                return 0;
+            out[n++] = delta & 0x7F;
+            prev = get_sample(data, i);
+            last = delta;
+            ++i;
+        }
+        // Literals, up to the next difference that codes shorter
+        else
+        {
+            size_t lits = 1;
+            int16_t before = delta;
+            while(lits < COUNT_MAX && i + lits < count)
+            {
+                int16_t d = get_sample(data, i + lits) -
+                            get_sample(data, i + lits - 1);
+                if((d >= SHORT_MIN && d <= SHORT_MAX) || d == before)
+                    break;
+                before = d;
+                ++lits;
+            }
+
+            if(n + 1 + 2*lits > max)
+                return 0;
+            out[n++] = LITERALS | (lits - 1);
+
+            size_t k;
+            for(k = 0; k < lits; ++k, ++i)
+            {
+                last = get_sample(data, i) - prev;
+                prev = get_sample(data, i);
+                out[n++] = (uint16_t) last;
+                out[n++] = (uint16_t) last >> 8;
+            }
+        }
+    }
+
+    return n;
+}
+
+bool deltarle_decode (const uint8_t *data, size_t size, uint8_t *out,
+                      size_t len)
+{
+    size_t count = len/2, i = 0, n = 0;
+    uint16_t prev = 0;
+    int16_t last = 0;
+
+    while(n < size)
+    {
+        uint8_t token = data[n++];
+        size_t k, times = (token & (COUNT_MAX - 1)) + 1;
+
+        if(!(token & RUN))
+        {
+            if(i == count)
+                return false;
+            // Sign extend the 7 bits
+            last = (int16_t)((token ^ 0x40) - 0x40);
+            prev += last;
+            put_sample(out, i++, prev);
+        }
+        else if((token & LITERALS) == RUN)
+        {
+            if(times > count - i)
+                return false;
+            for(k = 0; k < times; ++k)
+            {
+                prev += last;
+                put_sample(out, i++, prev);
+            }
+        }
+        else
+        {
+            if(times > count - i || 2*times > size - n)
+                return false;
+            for(k = 0; k < times; ++k, n += 2)
+            {
+                last = data[n] | (data[n + 1] << 8);
+                prev += last;
+                put_sample(out, i++, prev);
+            }
+        }
+    }
+
+    return i == count;
+}
@@ -0,0 +1,43 @@
+#ifndef DELTARLE_H
+#define DELTARLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Compress len bytes of 16-bit samples, least significant byte first, as the
+ * differences between consecutive samples, with runs of equal differences
+ * collapsed. Ramps shrink to a few bytes, and other smooth curves to about
+ * half. Each token is one of:
+ *
+ *   0ddddddd           A difference between -64 and 63
+ *   10nnnnnn           The last difference, n+1 more times
+ *   11nnnnnn d0 d1...  n+1 differences of two bytes each, least significant
+ *                      first
+ *
+ * @param data [input] The samples, len bytes long
+ * @param len [input] Number of bytes in data, even
+ * @param out [output] The compressed samples
+ * @param max [input] Room in out
+ *
+ * @return The size of the compressed samples, or 0 if they take more than max
+ *         bytes
+ */
+size_t deltarle_encode (const uint8_t *data, size_t len, uint8_t *out,
+                        size_t max);
+
+/**
+ * Decompress the output of deltarle_encode.
+ *
+ * @param data [input] The compressed samples
+ * @param size [input] Number of bytes in data
+ * @param out [output] The samples
+ * @param len [input] Number of bytes the samples must take, even
+ *
+ * @return Whether data held exactly len bytes of samples
+ */
+bool deltarle_decode (const uint8_t *data, size_t size, uint8_t *out,
+                      size_t len);
+
+#endif
@@ -7,7 +7,16 @@
 #define SLLP_HEADER_SIZE        2
 #define SLLP_CURVE_BLOCK_SIZE   16384
 #define SLLP_MAX_PAYLOAD        (SLLP_CURVE_BLOCK_SIZE+2)
-#define SLLP_MAX_MESSAGE        (SLLP_HEADER_SIZE+SLLP_MAX_PAYLOAD)
+
+// The size byte of the header holds sizes up to 254, and 255 for
+// SLLP_MAX_PAYLOAD. Other sizes need an extended header: SLLP_EXTENDED_FRAME,
+// the command code and then the size in 7 bit groups, least significant first,
+// with the high bit set in all but the last byte (LEB128). Only servers that
+// offer CAP_EXTENDED_SIZE understand them, and only answer with them requests
+// that came in one.
+#define SLLP_EXTENDED_FRAME     0xFF
+#define SLLP_MAX_HEADER_SIZE    5
+#define SLLP_MAX_MESSAGE        (SLLP_MAX_HEADER_SIZE+SLLP_MAX_PAYLOAD)
 
 enum sllp_err
 {
@@ -24,9 +33,61 @@ enum sllp_err
     SLLP_ERR_MAX
 };
 
+// How curve checksums are computed. Each block is digested, and the digests
+// are combined in a binary tree whose root is the checksum of the curve.
+enum sllp_checksum
+{
+    SLLP_CHECKSUM_MD5,              // MD5 (default)
+    SLLP_CHECKSUM_CRC32C,           // CRC-32C, big endian in the first 4 bytes,
+                                    // the other 12 zeroed
+
+    SLLP_CHECKSUM_MAX
+};
+
+// What a server did since it started, or since its statistics were reset
+struct sllp_command_stats
+{
+    uint32_t count;                 // Requests handled
+    uint32_t time;                  // Time spent handling them, in ticks of
+                                    // the server's clock
+};
+
+struct sllp_stats
+{
+    struct sllp_command_stats command[256];     // By command code
+    uint32_t malformed;             // Requests whose size didn't match
+    uint32_t unsupported;           // Requests with an unknown code
+};
+
+// Optional protocol features a server may offer, and its limits (see
+// CMD_QUERY_CAPS). Servers too old to tell offer none.
+enum sllp_capability
+{
+    SLLP_CAP_WIDE_IDS = 0x01,           // Variable and group IDs take two
+                                        // bytes, most significant first
+    SLLP_CAP_CRC32C = 0x02,             // Curve checksums can be CRC-32C
+    SLLP_CAP_EXTENDED_SIZE = 0x04,      // Headers may be extended, for
+                                        // payloads of any size up to
+                                        // SLLP_MAX_PAYLOAD
+    SLLP_CAP_COMPRESSED_CURVES = 0x08,  // Curve blocks may go compressed
+    SLLP_CAP_BATCH = 0x10,              // Several requests may go in a batch
+    SLLP_CAP_SUBSCRIPTIONS = 0x20,      // Changes of variables can be notified
+    SLLP_CAP_ATOMIC = 0x40,             // Compare and swap, and fetch and add
+    SLLP_CAP_CURVE_RANGE = 0x80,        // Parts of curves can be read
+    SLLP_CAP_STATS = 0x100,             // Statistics can be queried
+};
+
+struct sllp_capabilities
+{
+    uint32_t flags;                 // enum sllp_capability, ORed
+    uint32_t max_payload;           // Largest payload of a message
+    uint16_t max_groups;            // Groups, standard ones included
+    uint16_t max_subscriptions;     // Variables subscribed to at once
+};
+
 struct sllp_var_info
 {
-    uint8_t id;                     // ID of the variable, used in the protocol.
+    uint16_t id;                    // ID of the variable, used in the protocol.
     bool    writable;               // Determine if the variable is writable.
     uint8_t size;                   // Indicates how many bytes 'data' contains.
 };
@@ -36,7 +97,8 @@ struct sllp_curve_info
     uint8_t id;                     // ID of the curve, used in the protocol.
     bool    writable;               // Determine if the curve is writable.
     uint8_t nblocks;                // How many 16kB blocks the curve contains.
-    uint8_t checksum[16];           // MD5 checksum of the curve
+    uint8_t checksum[16];           // Checksum of the curve, see
+                                    // enum sllp_checksum
 };
 
 struct sllp_var
@@ -59,6 +121,11 @@ struct sllp_curve
 
     void    *user;                 // The user can make use of this variable as
                                    // he wishes. It is not touched by SLLP.
+
+    // Optional. Read len bytes, starting offset bytes into the curve, into
+    // data. Without it, partial reads read the blocks they span whole.
+    void (*read_range) (struct sllp_curve *curve, uint32_t offset,
+                        uint16_t len, uint8_t *data);
 };
 
 /**
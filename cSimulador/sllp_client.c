@@ -1,5 +1,6 @@
 #include "sllp_client.h"
 #include "common.h"
+#include "deltarle.h"
 
 #include <stdlib.h>
 #include <stdint.h>
@@ -14,6 +15,13 @@ struct sllp_client
     struct sllp_groups_list groups;
     struct sllp_curves_list curves;
     struct sllp_status      status;
+    sllp_notify_t           notify;
+    void                    *notify_user;
+    bool                    extended;       // Send extended headers
+    bool                    compress;       // Send curve blocks compressed
+    unsigned int            id_size;        // Bytes of variable and group IDs
+    enum sllp_checksum      checksum;       // Mode of curve checksums
+    struct sllp_capabilities caps;
 };
 
 static char bin_op_code[BIN_OP_COUNT] =
@@ -63,6 +71,51 @@ static bool curves_list_contains (struct sllp_curves_list *list,
     return false;
 }
 
+// Variable and group IDs, one or two bytes long (most significant first)
+static inline uint16_t get_id (sllp_client_t *client, const uint8_t *data)
+{
+    return client->id_size == 2 ? (data[0] << 8) | data[1] : data[0];
+}
+
+// Returns the number of bytes written
+static inline unsigned int put_id (sllp_client_t *client, uint8_t *data,
+                                   uint16_t id)
+{
+    if(client->id_size == 2)
+        *data++ = id >> 8;
+    *data = id;
+
+    return client->id_size;
+}
+
+// Hand each value of a CMD_NOTIFY payload to the notification function
+static enum sllp_err dispatch_notification (sllp_client_t *client,
+                                            const uint8_t *payload,
+                                            uint32_t size)
+{
+    const uint8_t *end = payload + size;
+
+    while(payload < end)
+    {
+        if(payload + client->id_size > end ||
+           get_id(client, payload) >= client->vars.count)
+            return SLLP_ERR_COMM;
+
+        struct sllp_var_info *var = &client->vars.list[get_id(client, payload)];
+        payload += client->id_size;
+
+        if(payload + var->size > end)
+            return SLLP_ERR_COMM;
+
+        if(client->notify)
+            client->notify(var, payload, client->notify_user);
+
+        payload += var->size;
+    }
+
+    return SLLP_SUCCESS;
+}
+
 static enum sllp_err command(sllp_client_t *client, struct sllp_message *request,
                              struct sllp_message *response)
 {
@@ -75,47 +128,58 @@ static enum sllp_err command(sllp_client_t *client, struct sllp_message *request
         uint32_t size;
     }send_buf, recv_buf;
 
-    // Prepare buffer with the message to be sent
-    send_buf.data[0] = request->code;      // Code in the first byte
-
-    if(request->payload_size < MAX_PAYLOAD_ENCODED)  // Size in the second byte
-        send_buf.data[1] = request->payload_size;
-    else if(request->payload_size == MAX_PAYLOAD)
-        send_buf.data[1] = MAX_PAYLOAD_ENCODED;
-    else
+    // Prepare buffer with the message to be sent. With extended headers, the
+    // response may be of any size too.
+    if(request->payload_size > MAX_PAYLOAD ||
+       (header_needs_extended(request->payload_size) && !client->extended))
         return SLLP_ERR_PARAM_INVALID;
 
+    unsigned int header = header_encode(send_buf.data, request->code,
+                                        request->payload_size,
+                                        client->extended);
+
     // Payload in the subsequent bytes
-    memcpy(&send_buf.data[2], request->payload, request->payload_size);
+    memcpy(&send_buf.data[header], request->payload, request->payload_size);
 
     // Send request
-    send_buf.size = 2 + request->payload_size;
+    send_buf.size = header + request->payload_size;
     if(client->send(send_buf.data, &send_buf.size))
         return SLLP_ERR_COMM;
 
-    // Receive response
-    if(client->recv(recv_buf.data, &recv_buf.size))
-        return SLLP_ERR_COMM;
+    // Receive response, dispatching the notifications that come before it
+    uint8_t code;
+    uint32_t size;
 
-    // Must receive, at least, command and size
-    if(recv_buf.size < 2)
-        return SLLP_ERR_COMM;
+    do
+    {
+        if(client->recv(recv_buf.data, &recv_buf.size))
+            return SLLP_ERR_COMM;
 
-    // Copy command code
-    response->code = recv_buf.data[0];
+        // Must receive, at least, command and size, and then the whole payload
+        header = header_decode(recv_buf.data, recv_buf.size, &code, &size);
 
-    // Decode size
-    if(recv_buf.data[1] == MAX_PAYLOAD_ENCODED)
-        response->payload_size = MAX_PAYLOAD;
-    else
-        response->payload_size = recv_buf.data[1];
+        if(!header || recv_buf.size != header + size)
+            return SLLP_ERR_COMM;
+
+        if(code == CMD_NOTIFY &&
+           dispatch_notification(client, &recv_buf.data[header], size))
+            return SLLP_ERR_COMM;
+    }while(code == CMD_NOTIFY);
 
-    // Copy response
-    memcpy(response->payload, &recv_buf.data[2], recv_buf.size);
+    // Copy command code, size and response
+    response->code = code;
+    response->payload_size = size;
+    memcpy(response->payload, &recv_buf.data[header], size);
 
     return SLLP_SUCCESS;
 }
 
+static uint32_t get_u32 (const uint8_t *data)
+{
+    return ((uint32_t) data[0] << 24) | ((uint32_t) data[1] << 16) |
+           ((uint32_t) data[2] << 8)  |  (uint32_t) data[3];
+}
+
 static enum sllp_err update_vars_list(sllp_client_t *client)
 {
     if(!client)
@@ -213,36 +277,48 @@ static enum sllp_err update_groups_list(sllp_client_t *client)
         grp->id         = i;
         grp->size       = 0;
         grp->writable   = response.payload[i] & WRITABLE_MASK;
-        grp->vars.count = response.payload[i] & SIZE_MASK;
-        grp->vars.list  = malloc(grp->vars.count * sizeof(*grp->vars.list));
-
-        // Check vars list allocation
-        if(!grp->vars.list)
-        {
-            err_code = SLLP_ERR_OUT_OF_MEMORY;
-            goto err;
-        }
 
-        // Query each group's variables list
+        // Query each group's variables list. Groups with more variables than
+        // the groups list can count are only sized by this answer.
         struct sllp_message grp_response, grp_request = {
-            .code           = CMD_QUERY_GROUP,
-            .payload_size   = 1,
-            .payload        = {i}
+            .code           = CMD_QUERY_GROUP
         };
 
+        grp_request.payload_size = put_id(client, grp_request.payload, i);
+
         if(command(client, &grp_request, &grp_response) ||
-                   grp_response.code != CMD_GROUP)
+                   grp_response.code != CMD_GROUP ||
+                   grp_response.payload_size % client->id_size)
         {
             err_code = SLLP_ERR_COMM;
             goto err;
         }
 
-        // Each byte in the response is a variable id
+        grp->vars.count = grp_response.payload_size / client->id_size;
+        grp->vars.list  = malloc(grp->vars.count * sizeof(*grp->vars.list));
+
+        // Check vars list allocation
+        if(!grp->vars.list)
+        {
+            err_code = SLLP_ERR_OUT_OF_MEMORY;
+            goto err;
+        }
+
+        // The response is the list of variable IDs
         unsigned int j;
         struct sllp_var_info *var;
-        for(j = 0; j < grp_response.payload_size; ++j)
+        for(j = 0; j < grp->vars.count; ++j)
         {
-            var = &client->vars.list[grp_response.payload[j]];
+            uint16_t id = get_id(client,
+                                 &grp_response.payload[j*client->id_size]);
+
+            if(id >= client->vars.count)
+            {
+                err_code = SLLP_ERR_COMM;
+                goto err;
+            }
+
+            var = &client->vars.list[id];
             grp->vars.list[j] = var;
             grp->size += var->size;
         }
@@ -251,9 +327,9 @@ static enum sllp_err update_groups_list(sllp_client_t *client)
     return SLLP_SUCCESS;
 
 err:
-    while(i)
-        if(client->groups.list[i].vars.list)
-            free(client->groups.list[i--].vars.list);
+    do
+        free(client->groups.list[i].vars.list);
+    while(i--);
 
     free(client->groups.list);
     client->groups.count = 0;
@@ -333,6 +409,14 @@ sllp_client_t *sllp_client_new (sllp_comm_func_t send_func,
     client->status.status = 0;
     client->initialized = false;
 
+    client->notify = NULL;
+    client->notify_user = NULL;
+    client->extended = false;
+    client->compress = false;
+    client->id_size = 1;
+    client->checksum = SLLP_CHECKSUM_MD5;
+    memset(&client->caps, 0, sizeof(client->caps));
+
     return client;
 }
 
@@ -361,6 +445,35 @@ enum sllp_err sllp_client_destroy (sllp_client_t *client)
     return SLLP_SUCCESS;
 }
 
+// Servers that don't know the query offer nothing
+static enum sllp_err update_capabilities (sllp_client_t *client)
+{
+    struct sllp_message response, request = {
+        .code = CMD_QUERY_CAPS,
+        .payload_size = 0
+    };
+
+    memset(&client->caps, 0, sizeof(client->caps));
+
+    if(command(client, &request, &response))
+        return SLLP_ERR_COMM;
+
+    if(response.code == CMD_ERR_OP_NOT_SUPPORTED)
+        return SLLP_SUCCESS;
+
+    if(response.code != CMD_CAPS || response.payload_size != CAPS_SIZE)
+        return SLLP_ERR_COMM;
+
+    uint8_t *p = response.payload;
+
+    client->caps.flags = get_u32(&p[0]);
+    client->caps.max_payload = get_u32(&p[4]);
+    client->caps.max_groups = (p[8] << 8) | p[9];
+    client->caps.max_subscriptions = (p[10] << 8) | p[11];
+
+    return SLLP_SUCCESS;
+}
+
 enum sllp_err sllp_client_init(sllp_client_t *client)
 {
     if(!client)
@@ -368,6 +481,19 @@ enum sllp_err sllp_client_init(sllp_client_t *client)
 
     enum sllp_err err;
 
+    if((err = update_capabilities(client)))
+        return err;
+
+    // IDs as wide as the server has them, before any of them is sent
+    client->id_size = client->caps.flags & CAP_WIDE_IDS ? 2 : 1;
+
+    // Faster ways for servers that can take them
+    if(client->caps.flags & CAP_EXTENDED_SIZE)
+        client->extended = true;
+
+    if(client->caps.flags & CAP_COMPRESSED_CURVES)
+        client->compress = true;
+
     if((err = update_vars_list(client)))
         return err;
 
@@ -411,6 +537,16 @@ enum sllp_err sllp_get_curves_list (sllp_client_t *client,
     return SLLP_SUCCESS;
 }
 
+enum sllp_err sllp_get_capabilities (sllp_client_t *client,
+                                     struct sllp_capabilities **caps)
+{
+    if(!client || !caps)
+        return SLLP_ERR_PARAM_INVALID;
+
+    *caps = &client->caps;
+    return SLLP_SUCCESS;
+}
+
 enum sllp_err sllp_get_status (sllp_client_t* client,
                                struct sllp_status **status)
 {
@@ -431,12 +567,11 @@ enum sllp_err sllp_read_var (sllp_client_t *client, struct sllp_var_info *var,
     // Prepare message to be sent
     struct sllp_message response, request =
     {
-        .code = CMD_READ_VAR,
-        .payload = {var->id},
-        .payload_size = 1
-
+        .code = CMD_READ_VAR
     };
 
+    request.payload_size = put_id(client, request.payload, var->id);
+
     if(command(client, &request, &response))
         return SLLP_ERR_COMM;
 
@@ -469,12 +604,13 @@ enum sllp_err sllp_write_var (sllp_client_t *client, struct sllp_var_info *var,
 
     // Prepare message to be sent
     struct sllp_message request = {
-        .code = CMD_WRITE_VAR,
-        .payload = {var->id},
-        .payload_size = 1 + var->size
+        .code = CMD_WRITE_VAR
     }, response;
 
-    memcpy(&request.payload[1], value, var->size);
+    unsigned int id_size = put_id(client, request.payload, var->id);
+
+    memcpy(&request.payload[id_size], value, var->size);
+    request.payload_size = id_size + var->size;
 
     if(command(client, &request, &response))
        return SLLP_ERR_COMM;
@@ -496,15 +632,15 @@ enum sllp_err sllp_read_group (sllp_client_t *client, struct sllp_group *grp,
 
     // Prepare message to be sent
     struct sllp_message response, request = {
-        .code = CMD_READ_GROUP,
-        .payload = {grp->id},
-        .payload_size = 1
+        .code = CMD_READ_GROUP
     };
 
+    request.payload_size = put_id(client, request.payload, grp->id);
+
     if(command(client, &request, &response))
         return SLLP_ERR_COMM;
 
-    if(response.code != CMD_VAR_READING)
+    if(response.code != CMD_GROUP_READING)
         return SLLP_ERR_COMM;   //TODO: better error?
 
     // Give back answer
@@ -524,12 +660,13 @@ enum sllp_err sllp_write_group (sllp_client_t *client, struct sllp_group *grp,
 
     // Prepare message to be sent
     struct sllp_message response, request = {
-        .code = CMD_WRITE_GROUP,
-        .payload = {grp->id},
-        .payload_size = 1 + grp->size
+        .code = CMD_WRITE_GROUP
     };
 
-    memcpy(&request.payload[1], values, grp->size);
+    unsigned int id_size = put_id(client, request.payload, grp->id);
+
+    memcpy(&request.payload[id_size], values, grp->size);
+    request.payload_size = id_size + grp->size;
 
     if(command(client, &request, &response))
        return SLLP_ERR_COMM;
@@ -554,12 +691,14 @@ enum sllp_err sllp_bin_op_var (sllp_client_t *client, enum sllp_bin_op op,
 
     // Prepare message to be sent
     struct sllp_message response, request = {
-        .code = CMD_BIN_OP_VAR,
-        .payload = {var->id, bin_op_code[op]},
-        .payload_size = 2 + var->size
+        .code = CMD_BIN_OP_VAR
     };
 
-    memcpy(&request.payload[2], mask, var->size);
+    unsigned int id_size = put_id(client, request.payload, var->id);
+
+    request.payload[id_size] = bin_op_code[op];
+    memcpy(&request.payload[id_size + 1], mask, var->size);
+    request.payload_size = id_size + 1 + var->size;
 
     if(command(client, &request, &response))
        return SLLP_ERR_COMM;
@@ -584,12 +723,14 @@ enum sllp_err sllp_bin_op_group (sllp_client_t *client, enum sllp_bin_op op,
 
     // Prepare message to be sent
     struct sllp_message response, request = {
-        .code = CMD_BIN_OP_GROUP,
-        .payload = {grp->id, bin_op_code[op]},
-        .payload_size = 2 + grp->size
+        .code = CMD_BIN_OP_GROUP
     };
 
-    memcpy(&request.payload[2], mask, grp->size);
+    unsigned int id_size = put_id(client, request.payload, grp->id);
+
+    request.payload[id_size] = bin_op_code[op];
+    memcpy(&request.payload[id_size + 1], mask, grp->size);
+    request.payload_size = id_size + 1 + grp->size;
 
     if(command(client, &request, &response))
        return SLLP_ERR_COMM;
@@ -600,6 +741,116 @@ enum sllp_err sllp_bin_op_group (sllp_client_t *client, enum sllp_bin_op op,
     return SLLP_SUCCESS;
 }
 
+// Compare and swap of size bytes, for a variable or a group. expected gets the
+// value found when it's not the expected one.
+static enum sllp_err cas (sllp_client_t *client, enum command_code code,
+                          enum command_code reply, uint16_t id, uint16_t size,
+                          uint8_t *expected, uint8_t *value, bool *swapped)
+{
+    struct sllp_message response, request = {
+        .code = code
+    };
+
+    unsigned int id_size = put_id(client, request.payload, id);
+
+    memcpy(&request.payload[id_size], expected, size);
+    memcpy(&request.payload[id_size + size], value, size);
+    request.payload_size = id_size + 2*size;
+
+    if(command(client, &request, &response))
+        return SLLP_ERR_COMM;
+
+    if(response.code != reply || response.payload_size != size)
+        return SLLP_ERR_COMM;
+
+    *swapped = !memcmp(response.payload, expected, size);
+    if(!*swapped)
+        memcpy(expected, response.payload, size);
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_cas_var (sllp_client_t *client, struct sllp_var_info *var,
+                            uint8_t *expected, uint8_t *value, bool *swapped)
+{
+    if(!client || !var || !expected || !value || !swapped)
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(!vars_list_contains(&client->vars, var))
+        return SLLP_ERR_PARAM_INVALID;
+
+    return cas(client, CMD_CAS_VAR, CMD_VAR_READING, var->id, var->size,
+               expected, value, swapped);
+}
+
+enum sllp_err sllp_cas_group (sllp_client_t *client, struct sllp_group *grp,
+                              uint8_t *expected, uint8_t *values,
+                              bool *swapped)
+{
+    if(!client || !grp || !expected || !values || !swapped)
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(!groups_list_contains(&client->groups, grp))
+        return SLLP_ERR_PARAM_INVALID;
+
+    return cas(client, CMD_CAS_GROUP, CMD_GROUP_READING, grp->id, grp->size,
+               expected, values, swapped);
+}
+
+// Fetch and add of size bytes, for a variable or a group
+static enum sllp_err fetch_add (sllp_client_t *client, enum command_code code,
+                                enum command_code reply, uint16_t id,
+                                uint16_t size, uint8_t *addend, uint8_t *old)
+{
+    struct sllp_message response, request = {
+        .code = code
+    };
+
+    unsigned int id_size = put_id(client, request.payload, id);
+
+    memcpy(&request.payload[id_size], addend, size);
+    request.payload_size = id_size + size;
+
+    if(command(client, &request, &response))
+        return SLLP_ERR_COMM;
+
+    if(response.code != reply || response.payload_size != size)
+        return SLLP_ERR_COMM;
+
+    if(old)
+        memcpy(old, response.payload, size);
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_fetch_add_var (sllp_client_t *client,
+                                  struct sllp_var_info *var, uint8_t *addend,
+                                  uint8_t *old)
+{
+    if(!client || !var || !addend)
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(!vars_list_contains(&client->vars, var))
+        return SLLP_ERR_PARAM_INVALID;
+
+    return fetch_add(client, CMD_FETCH_ADD_VAR, CMD_VAR_READING, var->id,
+                     var->size, addend, old);
+}
+
+enum sllp_err sllp_fetch_add_group (sllp_client_t *client,
+                                    struct sllp_group *grp, uint8_t *addends,
+                                    uint8_t *old)
+{
+    if(!client || !grp || !addends)
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(!groups_list_contains(&client->groups, grp))
+        return SLLP_ERR_PARAM_INVALID;
+
+    return fetch_add(client, CMD_FETCH_ADD_GROUP, CMD_GROUP_READING, grp->id,
+                     grp->size, addends, old);
+}
+
 enum sllp_err sllp_create_group (sllp_client_t *client,
                                  struct sllp_var_info **vars_list)
 {
@@ -612,20 +863,20 @@ enum sllp_err sllp_create_group (sllp_client_t *client,
         .payload_size = 0
     }, response;
 
-    struct sllp_var_info *varp = vars_list[request.payload_size];
+    struct sllp_var_info **varp;
 
-    while(varp && (request.payload_size < client->vars.count))
+    for(varp = vars_list; *varp; ++varp)
     {
-        if(!vars_list_contains(&client->vars, varp))
+        if(!vars_list_contains(&client->vars, *varp) ||
+           request.payload_size + client->id_size > MAX_PAYLOAD)
             return SLLP_ERR_PARAM_INVALID;
 
-        request.payload[request.payload_size++] = (varp++)->id;
+        request.payload_size += put_id(client,
+                                       &request.payload[request.payload_size],
+                                       (*varp)->id);
     }
 
-    if(!request.payload_size)
-        return SLLP_ERR_PARAM_INVALID;
-
-    if(!command(client, &request, &response))
+    if(command(client, &request, &response))
         return SLLP_ERR_COMM;
 
     if(response.code != CMD_OK)
@@ -646,9 +897,11 @@ enum sllp_err sllp_remove_all_groups (sllp_client_t *client)
         .payload_size = 0
     };
 
-    if(!command(client, &request, &response) || response.code != CMD_OK)
+    if(command(client, &request, &response) || response.code != CMD_OK)
         return SLLP_ERR_COMM;
 
+    update_groups_list(client);
+
     return SLLP_SUCCESS;
 }
 
@@ -666,15 +919,34 @@ enum sllp_err sllp_request_curve_block (sllp_client_t *client,
         return SLLP_ERR_PARAM_OUT_OF_RANGE;
 
     struct sllp_message response, request = {
-        .code = CMD_CURVE_TRANSMIT,
+        .code = client->compress ? CMD_CURVE_TRANSMIT_COMPRESSED :
+                                   CMD_CURVE_TRANSMIT,
         .payload = {curve->id, offset},
         .payload_size = 2
     };
 
-    if(!command(client, &request, &response) || response.code != CMD_CURVE_BLOCK)
+    if(command(client, &request, &response))
         return SLLP_ERR_COMM;
 
-    memcpy(data, response.payload + 2, CURVE_BLOCK);
+    // Servers without compression get asked again, and not anymore
+    if(client->compress && response.code == CMD_ERR_OP_NOT_SUPPORTED)
+    {
+        client->compress = false;
+        return sllp_request_curve_block(client, curve, offset, data);
+    }
+
+    // The server sends the block raw when it doesn't shrink
+    if(response.code == CMD_CURVE_BLOCK_COMPRESSED && client->compress)
+    {
+        if(!deltarle_decode(response.payload + 2, response.payload_size - 2,
+                            data, CURVE_BLOCK))
+            return SLLP_ERR_COMM;
+    }
+    else if(response.code == CMD_CURVE_BLOCK &&
+            response.payload_size == 2 + CURVE_BLOCK)
+        memcpy(data, response.payload + 2, CURVE_BLOCK);
+    else
+        return SLLP_ERR_COMM;
 
     return SLLP_SUCCESS;
 }
@@ -698,14 +970,71 @@ enum sllp_err sllp_send_curve_block (sllp_client_t *client,
         .payload_size = MAX_PAYLOAD
     };
 
-    memcpy(data, &request.payload[2], CURVE_BLOCK);
+    // Compressed only if it shrinks, to a size the header can tell
+    size_t size = 0;
+
+    if(client->compress)
+        size = deltarle_encode(data, CURVE_BLOCK, &request.payload[2],
+                               client->extended ? CURVE_BLOCK - 1 :
+                                                  MAX_PAYLOAD_ENCODED - 1 - 2);
+
+    if(size)
+    {
+        request.code = CMD_CURVE_BLOCK_COMPRESSED;
+        request.payload_size = 2 + size;
+    }
+    else
+        memcpy(&request.payload[2], data, CURVE_BLOCK);
+
+    if(command(client, &request, &response))
+        return SLLP_ERR_COMM;
+
+    // Servers without compression get it again raw, and from now on
+    if(size && response.code == CMD_ERR_OP_NOT_SUPPORTED)
+    {
+        client->compress = false;
+        return sllp_send_curve_block(client, curve, offset, data);
+    }
 
-    if(!command(client, &request, &response) || response.code != CMD_OK)
+    if(response.code != CMD_OK)
         return SLLP_ERR_COMM;
 
     return SLLP_SUCCESS;
 }
 
+enum sllp_err sllp_request_curve_range (sllp_client_t *client,
+                                        struct sllp_curve_info *curve,
+                                        uint32_t offset, uint16_t len,
+                                        uint8_t *data)
+{
+    if(!client || !curve || !data)
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(!curves_list_contains(&client->curves, curve))
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(!len || len > MAX_PAYLOAD - 5)
+        return SLLP_ERR_PARAM_OUT_OF_RANGE;
+
+    // ID, offset and length, most significant first
+    struct sllp_message response, request = {
+        .code = CMD_CURVE_READ_RANGE,
+        .payload = {curve->id, offset >> 24, offset >> 16, offset >> 8, offset,
+                    len >> 8, len},
+        .payload_size = 7
+    };
+
+    if(command(client, &request, &response))
+        return SLLP_ERR_COMM;
+
+    if(response.code != CMD_CURVE_RANGE || response.payload_size != 5u + len)
+        return SLLP_ERR_COMM;
+
+    memcpy(data, response.payload + 5, len);
+
+    return SLLP_SUCCESS;
+}
+
 enum sllp_err sllp_recalc_checksum (sllp_client_t *client,
                                     struct sllp_curve_info *curve)
 {
@@ -715,19 +1044,365 @@ enum sllp_err sllp_recalc_checksum (sllp_client_t *client,
     if(!curves_list_contains(&client->curves, curve))
         return SLLP_ERR_PARAM_INVALID;
 
+    // MD5 checksums go to the curves list, the others come in the answer
     struct sllp_message response, request = {
         .code = CMD_CURVE_RECALC_CSUM,
-        .payload = {curve->id},
-        .payload_size = 1
+        .payload = {curve->id, client->checksum},
+        .payload_size = client->checksum == SLLP_CHECKSUM_MD5 ? 1 : 2
     };
 
+    if(command(client, &request, &response))
+        return SLLP_ERR_COMM;
+
+    if(client->checksum == SLLP_CHECKSUM_MD5)
+    {
+        if(response.code != CMD_OK)
+            return SLLP_ERR_COMM;
+
+        update_curves_list(client);
+        return SLLP_SUCCESS;
+    }
+
+    if(response.code != CMD_CURVE_CSUM ||
+       response.payload_size != sizeof(curve->checksum))
+        return SLLP_ERR_COMM;
+
+    memcpy(curve->checksum, response.payload, sizeof(curve->checksum));
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_set_checksum_mode (sllp_client_t *client,
+                                      enum sllp_checksum mode)
+{
+    if(!client || mode >= SLLP_CHECKSUM_MAX)
+        return SLLP_ERR_PARAM_INVALID;
+
+    client->checksum = mode;
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_register_notify (sllp_client_t *client, sllp_notify_t notify,
+                                    void *user)
+{
+    if(!client)
+        return SLLP_ERR_PARAM_INVALID;
+
+    client->notify = notify;
+    client->notify_user = user;
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_subscribe (sllp_client_t *client, struct sllp_var_info *var,
+                              uint16_t interval, uint32_t deadband)
+{
+    if(!client || !var)
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(!vars_list_contains(&client->vars, var))
+        return SLLP_ERR_PARAM_INVALID;
+
+    struct sllp_message response, request = {
+        .code = CMD_SUBSCRIBE
+    };
+
+    // ID, then interval and deadband, most significant first
+    uint8_t *p = request.payload + put_id(client, request.payload, var->id);
+
+    *p++ = interval >> 8;
+    *p++ = interval;
+    *p++ = deadband >> 24;
+    *p++ = deadband >> 16;
+    *p++ = deadband >> 8;
+    *p++ = deadband;
+    request.payload_size = p - request.payload;
+
     if(command(client, &request, &response))
         return SLLP_ERR_COMM;
 
     if(response.code != CMD_OK)
         return SLLP_ERR_COMM;
 
-    update_curves_list(client);
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_unsubscribe (sllp_client_t *client,
+                                struct sllp_var_info *var)
+{
+    if(!client)
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(var && !vars_list_contains(&client->vars, var))
+        return SLLP_ERR_PARAM_INVALID;
+
+    struct sllp_message response, request = {
+        .code = CMD_UNSUBSCRIBE,
+        .payload_size = 0
+    };
+
+    if(var)
+        request.payload_size = put_id(client, request.payload, var->id);
+
+    if(command(client, &request, &response))
+        return SLLP_ERR_COMM;
+
+    if(response.code != CMD_OK)
+        return SLLP_ERR_COMM;
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_process_notification (sllp_client_t *client,
+                                         const uint8_t *data, uint32_t size)
+{
+    if(!client || !data)
+        return SLLP_ERR_PARAM_INVALID;
+
+    uint8_t code;
+    uint32_t payload_size;
+    unsigned int header = header_decode(data, size, &code, &payload_size);
+
+    if(!header || size != header + payload_size || code != CMD_NOTIFY)
+        return SLLP_ERR_PARAM_INVALID;
+
+    return dispatch_notification(client, &data[header], payload_size);
+}
+
+enum sllp_err sllp_query_stats (sllp_client_t *client,
+                                struct sllp_stats *stats)
+{
+    if(!client || !stats)
+        return SLLP_ERR_PARAM_INVALID;
+
+    memset(stats, 0, sizeof(*stats));
+
+    // Commands come in code order, as many as fit a response
+    unsigned int first = 0;
+    bool more = true;
+
+    while(more && first < 256)
+    {
+        struct sllp_message response, request = {
+            .code = CMD_QUERY_STATS,
+            .payload = {first},
+            .payload_size = 1
+        };
+
+        if(command(client, &request, &response))
+            return SLLP_ERR_COMM;
+
+        if(response.code != CMD_STATS || response.payload_size < 8 ||
+           (response.payload_size - 8) % 9)
+            return SLLP_ERR_COMM;
+
+        stats->malformed = get_u32(&response.payload[0]);
+        stats->unsupported = get_u32(&response.payload[4]);
+
+        uint8_t *entry = &response.payload[8];
+        uint8_t *end = response.payload + response.payload_size;
+
+        for(; entry < end; entry += 9)
+        {
+            stats->command[entry[0]].count = get_u32(&entry[1]);
+            stats->command[entry[0]].time = get_u32(&entry[5]);
+            first = entry[0] + 1;
+        }
+
+        // A response with room for another entry had them all
+        more = response.payload_size + 9 > MAX_PAYLOAD_ENCODED - 1;
+    }
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_use_extended_headers (sllp_client_t *client, bool enable)
+{
+    if(!client)
+        return SLLP_ERR_PARAM_INVALID;
+
+    client->extended = enable;
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_batch_init (struct sllp_batch *batch)
+{
+    if(!batch)
+        return SLLP_ERR_PARAM_INVALID;
+
+    batch->size = 0;
+    batch->count = 0;
+    batch->executed = 0;
+
+    return SLLP_SUCCESS;
+}
+
+// Queue a request of the given code on var, with size bytes of data after the
+// ID (and the extra byte, if any), answered with reply.
+static enum sllp_err batch_add (sllp_client_t *client, struct sllp_batch *batch,
+                                enum command_code code,
+                                struct sllp_var_info *var, int extra,
+                                uint8_t *data, uint8_t size, uint8_t reply)
+{
+    uint32_t payload_size = client->id_size + (extra >= 0) + size;
+
+    if(batch->count == SLLP_BATCH_MAX_REQUESTS ||
+       batch->size + HEADER_SIZE + payload_size > MAX_PAYLOAD)
+        return SLLP_ERR_OUT_OF_MEMORY;
+
+    uint8_t *p = &batch->requests[batch->size];
+
+    p += header_encode(p, code, payload_size, false);
+    p += put_id(client, p, var->id);
+    if(extra >= 0)
+        *p++ = extra;
+    if(data)
+        memcpy(p, data, size);
+
+    batch->size += HEADER_SIZE + payload_size;
+
+    batch->list[batch->count].reply = reply;
+    batch->list[batch->count].value = NULL;
+    batch->list[batch->count].size = 0;
+    batch->list[batch->count].result = SLLP_ERR_COMM;
+    ++batch->count;
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_batch_read_var (sllp_client_t *client,
+                                   struct sllp_batch *batch,
+                                   struct sllp_var_info *var, uint8_t *value)
+{
+    if(!client || !batch || !var || !value)
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(!vars_list_contains(&client->vars, var))
+        return SLLP_ERR_PARAM_INVALID;
+
+    enum sllp_err err = batch_add(client, batch, CMD_READ_VAR, var, -1, NULL, 0,
+                                  CMD_VAR_READING);
+    if(err)
+        return err;
+
+    batch->list[batch->count - 1].value = value;
+    batch->list[batch->count - 1].size = var->size;
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_batch_write_var (sllp_client_t *client,
+                                    struct sllp_batch *batch,
+                                    struct sllp_var_info *var, uint8_t *value)
+{
+    if(!client || !batch || !var || !value)
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(!vars_list_contains(&client->vars, var))
+        return SLLP_ERR_PARAM_INVALID;
+
+    return batch_add(client, batch, CMD_WRITE_VAR, var, -1, value, var->size, CMD_OK);
+}
+
+enum sllp_err sllp_batch_bin_op_var (sllp_client_t *client,
+                                     struct sllp_batch *batch,
+                                     enum sllp_bin_op op,
+                                     struct sllp_var_info *var,
+                                     uint8_t *mask)
+{
+    if(!client || !batch || !var || !mask)
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(!vars_list_contains(&client->vars, var))
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(op >= BIN_OP_COUNT)
+        return SLLP_ERR_PARAM_OUT_OF_RANGE;
+
+    return batch_add(client, batch, CMD_BIN_OP_VAR, var, bin_op_code[op], mask,
+                     var->size, CMD_OK);
+}
+
+enum sllp_err sllp_batch_submit (sllp_client_t *client,
+                                 struct sllp_batch *batch)
+{
+    if(!client || !batch)
+        return SLLP_ERR_PARAM_INVALID;
+
+    struct sllp_message response, request = {
+        .code = CMD_BATCH,
+        .payload_size = batch->size
+    };
+
+    memcpy(request.payload, batch->requests, batch->size);
+
+    if(command(client, &request, &response))
+        return SLLP_ERR_COMM;
+
+    if(response.code != CMD_BATCH_REPLY)
+        return SLLP_ERR_COMM;
+
+    // One answer per request executed, in order
+    uint8_t *p = response.payload;
+    uint8_t *end = response.payload + response.payload_size;
+    enum sllp_err err = SLLP_SUCCESS;
+    unsigned int i;
+
+    batch->executed = 0;
+
+    for(i = 0; i < batch->count; ++i)
+    {
+        uint8_t code;
+        uint32_t size;
+        unsigned int header = header_decode(p, end - p, &code, &size);
+
+        if(!header || size > (uint32_t)(end - p) - header)
+        {
+            // Not executed
+            batch->executed = i;
+            for(; i < batch->count; ++i)
+                batch->list[i].result = SLLP_ERR_COMM;
+            return SLLP_ERR_COMM;
+        }
+
+        if(code == batch->list[i].reply && size == batch->list[i].size)
+        {
+            if(batch->list[i].value)
+                memcpy(batch->list[i].value, &p[header], size);
+            batch->list[i].result = SLLP_SUCCESS;
+        }
+        else
+        {
+            batch->list[i].result = SLLP_ERR_COMM;
+            err = SLLP_ERR_COMM;
+        }
+
+        p += header + size;
+    }
+
+    batch->executed = batch->count;
+
+    return err;
+}
+
+enum sllp_err sllp_use_compression (sllp_client_t *client, bool enable)
+{
+    if(!client)
+        return SLLP_ERR_PARAM_INVALID;
+
+    client->compress = enable;
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_use_wide_ids (sllp_client_t *client, bool enable)
+{
+    if(!client)
+        return SLLP_ERR_PARAM_INVALID;
+
+    client->id_size = enable ? 2 : 1;
 
     return SLLP_SUCCESS;
 }
@@ -1,7 +1,9 @@
 #include "sllp_server.h"
 #include "common.h"
 #include "md5/md5.h"
+#include "crc32c.h"
 #include "binops.h"
+#include "deltarle.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -9,342 +11,1769 @@
 #define VARIABLE_MIN_SIZE       1
 #define VARIABLE_MAX_SIZE       127
 
-#define MAX_VARIABLES           128
-#define MAX_GROUPS              8
-#define MAX_CURVES              64
+// IDs travel in a single byte, or in two (most significant first) once the
+// server is switched to wide IDs. Curve IDs always take a single byte, as a
+// curve block reply has no room for a second one.
+#define MAX_CURVES              256
+
+// A group must fit a bin op payload (ID, operation and values)
+#define MAX_GROUP_SIZE(id_size) (MAX_PAYLOAD - (id_size) - 1)
+
+// Subscriptions to changes of a variable, reported by sllp_server_notify
+struct subscription
+{
+    uint16_t id;                        // ID of the variable
+    bool     fresh;                     // Not notified since subscribed
+    uint16_t interval;                  // Least time between notifications, ms
+    uint32_t deadband;                  // Least change notified (integers)
+    uint32_t sent_at;                   // When the last notification was built
+    uint8_t  sent[VARIABLE_MAX_SIZE];   // Value in the last notification
+};
+
+// Notifications stay short enough for the size byte
+#define NOTIFY_MAX_PAYLOAD      (MAX_PAYLOAD_ENCODED - 1)
+
+// Curve checksums. Blocks are digested in the mode each request asks for and
+// the digests are combined in pairs, up a binary tree whose root is the
+// checksum of the curve. Where a node has no right child, the left one moves
+// up unchanged, so a single block curve has the digest of its data.
+
+static void digest (enum sllp_checksum mode, uint8_t *data, unsigned int len,
+                    uint8_t *out)
+{
+    if(mode == SLLP_CHECKSUM_CRC32C)
+    {
+        uint32_t crc = crc32c(0, data, len);
+
+        memset(out, 0, CURVE_CSUM_SIZE);
+        out[0] = crc >> 24;
+        out[1] = crc >> 16;
+        out[2] = crc >> 8;
+        out[3] = crc;
+        return;
+    }
+
+    MD5_CTX md5ctx;
+
+    MD5Init(&md5ctx);
+    MD5Update(&md5ctx, data, len);
+    MD5Final(out, &md5ctx);
+}
+
+// Digest of a node from its two children, which must be adjacent in memory
+static void digest_children (enum sllp_checksum mode, uint8_t *children,
+                             uint8_t *out)
+{
+    uint8_t node[CURVE_CSUM_SIZE];
+
+    digest(mode, children, 2*CURVE_CSUM_SIZE, node);
+    memcpy(out, node, CURVE_CSUM_SIZE);
+}
+
+#ifdef SLLP_SERVER_STATIC
+
+// Variables, curves and the standard groups are described by constant tables
+// built from sllp_server_config.h (see sllp_server_static.h). Only the groups
+// created by the client take RAM.
+
+#include "sllp_server_static.h"
 
 // Private server group structure
 struct server_group
 {
-    uint8_t id;                         // ID of the group
-    bool    writable;                   // Whether all variables in the group
+    uint8_t  id;                        // ID of the group
+    bool     writable;                  // Whether all variables in the group
                                         // are writable
     struct
     {
-        struct sllp_var_info *list[MAX_VARIABLES]; // List of variables
-        uint8_t              count;                // Number of variables
+        const uint8_t *list;            // IDs of the variables, or NULL for
+                                        // the range first..first+count-1
+        uint8_t        first;           // First ID of a range
+        uint8_t        count;           // Number of variables
     }vars;
 
-    uint8_t size;                       // Sum of the sizes of all variables in
+    uint16_t size;                      // Sum of the sizes of all variables in
                                         // the group
 };
 
-static void group_init        (struct server_group *grp, uint8_t id);
-static void group_add_var     (struct server_group *grp, struct sllp_var *var);
-static void group_to_mod_list (sllp_server_t *server, struct server_group *grp);
-
-
 struct sllp_server
 {
     struct
     {
-        struct sllp_var *list[MAX_VARIABLES];
-        uint32_t count;
-    }vars;
+        struct server_group list[SLLP_STATIC_MAX_GROUPS];   // Created groups
+        uint8_t count;                  // Including the standard groups
+    }groups;
 
     struct
     {
-        struct server_group list[MAX_GROUPS];
-        uint32_t count;
-    }groups;
+        uint8_t  list[SLLP_STATIC_MAX_GROUP_VARS];
+        uint16_t count;
+    }members;                           // IDs of the created groups' variables
 
     struct
     {
-        struct sllp_curve *list[MAX_CURVES];
-        uint32_t count;
-    }curves;
+        struct subscription list[SLLP_STATIC_MAX_SUBSCRIPTIONS + 1];
+        uint16_t count;
+        uint16_t next;                  // Where the next notification starts
+    }subs;
 
-    struct sllp_var *modified_list[MAX_VARIABLES+1];
     sllp_hook_t hook;
+    struct sllp_seqlock *seqlock;
+    sllp_clock_t clock;
+    struct sllp_stats stats;
 };
 
-sllp_server_t *sllp_server_new (void)
+typedef const struct sllp_var server_var_t;
+
+#define STATIC_VAR_RO(name, size, value)                                     \
+    {{SLLP_VAR_ID(name), false, (size)}, (uint8_t *) &(value), NULL},
+#define STATIC_VAR_RW(name, size, value)                                     \
+    {{SLLP_VAR_ID(name), true, (size)}, (uint8_t *) &(value), NULL},
+#define STATIC_INFO_RO(name, size, value)   READ_ONLY | (size),
+#define STATIC_INFO_RW(name, size, value)   WRITABLE | (size),
+#define STATIC_CURVE(name, curve)           &(curve),
+
+// One spare entry each, so empty configurations still make valid arrays
+static const struct sllp_var static_vars[SLLP_STATIC_VAR_COUNT + 1] =
 {
-    struct sllp_server *server = (struct sllp_server*) malloc(sizeof(*server));
+    SLLP_STATIC_READ_VARS(STATIC_VAR_RO)
+    SLLP_STATIC_WRITE_VARS(STATIC_VAR_RW)
+};
 
-    if(!server)
-        return NULL;
+// Payload of CMD_VARS_LIST
+static const uint8_t static_vars_list[SLLP_STATIC_VAR_COUNT + 1] =
+{
+    SLLP_STATIC_READ_VARS(STATIC_INFO_RO)
+    SLLP_STATIC_WRITE_VARS(STATIC_INFO_RW)
+};
 
-    memset(server, 0, sizeof(*server));
+static struct sllp_curve *const static_curves[SLLP_STATIC_CURVE_COUNT + 1] =
+{
+    SLLP_STATIC_CURVES(STATIC_CURVE)
+};
 
-    server->groups.count = GROUP_STANDARD_COUNT;
+static const struct server_group static_groups[GROUP_STANDARD_COUNT] =
+{
+    [GROUP_ALL_ID]   = {GROUP_ALL_ID, SLLP_STATIC_READ_COUNT == 0,
+                        {NULL, 0, SLLP_STATIC_VAR_COUNT},
+                        SLLP_STATIC_READ_SIZE + SLLP_STATIC_WRITE_SIZE},
+    [GROUP_READ_ID]  = {GROUP_READ_ID, SLLP_STATIC_READ_COUNT == 0,
+                        {NULL, 0, SLLP_STATIC_READ_COUNT},
+                        SLLP_STATIC_READ_SIZE},
+    [GROUP_WRITE_ID] = {GROUP_WRITE_ID, true,
+                        {NULL, SLLP_STATIC_READ_COUNT, SLLP_STATIC_WRITE_COUNT},
+                        SLLP_STATIC_WRITE_SIZE},
+};
 
-    group_init(&server->groups.list[GROUP_ALL_ID],   GROUP_ALL_ID);
-    group_init(&server->groups.list[GROUP_READ_ID],  GROUP_ALL_ID);
-    group_init(&server->groups.list[GROUP_WRITE_ID], GROUP_ALL_ID);
+// Every list and the values of the group of all variables must fit a message
+typedef char static_check_vars[SLLP_STATIC_VAR_COUNT < MAX_PAYLOAD_ENCODED ?
+                               1 : -1];
+typedef char static_check_size[SLLP_STATIC_READ_SIZE + SLLP_STATIC_WRITE_SIZE
+                               <= MAX_GROUP_SIZE(1) ? 1 : -1];
+typedef char static_check_curves[SLLP_STATIC_CURVE_COUNT*CURVE_INFO_SIZE <
+                                 MAX_PAYLOAD_ENCODED ? 1 : -1];
 
-    server->groups.count = GROUP_STANDARD_COUNT;
+static struct sllp_server static_server;
 
-    return server;
+static inline unsigned int id_size (sllp_server_t *server)
+{
+    (void) server;
+    return 1;
 }
 
-enum sllp_err sllp_server_destroy (sllp_server_t* server)
+static inline uint32_t max_group_size (sllp_server_t *server)
 {
-    if(!server)
-        return SLLP_ERR_PARAM_INVALID;
+    return MAX_GROUP_SIZE(id_size(server));
+}
 
-    free(server);
+// Capabilities and limits that depend on the configuration
 
-    return SLLP_SUCCESS;
+static inline uint32_t config_caps (sllp_server_t *server)
+{
+    (void) server;
+#ifdef SLLP_STATIC_BATCH
+    uint32_t caps = CAP_BATCH;
+#else
+    uint32_t caps = 0;
+#endif
+    return SLLP_STATIC_MAX_SUBSCRIPTIONS ? caps | CAP_SUBSCRIPTIONS : caps;
 }
 
-enum sllp_err sllp_register_variable (sllp_server_t *server,
-                                      struct sllp_var *var)
+static inline uint32_t max_groups (sllp_server_t *server)
 {
-    if(!server || !var)
-        return SLLP_ERR_PARAM_INVALID;
-
-    // Check variable fields
-    if(var->info.size < VARIABLE_MIN_SIZE || var->info.size > VARIABLE_MAX_SIZE)
-        return SLLP_ERR_PARAM_OUT_OF_RANGE;
+    (void) server;
+    return GROUP_STANDARD_COUNT + SLLP_STATIC_MAX_GROUPS;
+}
 
-    if(!var->data)
-        return SLLP_ERR_PARAM_INVALID;
+static inline uint32_t max_subscriptions (sllp_server_t *server)
+{
+    (void) server;
+    return SLLP_STATIC_MAX_SUBSCRIPTIONS;
+}
 
-    // Check vars limit
-    if(server->vars.count == MAX_VARIABLES)
-        return SLLP_ERR_OUT_OF_MEMORY;
+// Lookups
 
-    // Check if the variable is already in the list
-    unsigned int i;
-    for(i = 0; i < server->vars.count; ++i)
-        if(server->vars.list[i] == var)
-            return SLLP_ERR_DUPLICATE;
+static inline uint32_t vars_count (sllp_server_t *server)
+{
+    (void) server;
+    return SLLP_STATIC_VAR_COUNT;
+}
 
-    // Add to the variables list
-    server->vars.list[server->vars.count] = var;
+static inline server_var_t *get_var (sllp_server_t *server, uint16_t id)
+{
+    (void) server;
+    return &static_vars[id];
+}
 
-    // Adjust var id
-    var->info.id = server->vars.count++;
+static inline const struct server_group *get_group (sllp_server_t *server,
+                                                    uint16_t id)
+{
+    if(id < GROUP_STANDARD_COUNT)
+        return &static_groups[id];
+    return &server->groups.list[id - GROUP_STANDARD_COUNT];
+}
 
-    // Add to the group containing all variables
-    group_add_var(&server->groups.list[GROUP_ALL_ID], var);
+static inline uint16_t group_var_id (const struct server_group *grp,
+                                     unsigned int i)
+{
+    return grp->vars.list ? grp->vars.list[i] : grp->vars.first + i;
+}
 
-    // Add either to the WRITABLE or to the READ_ONLY group
-    if(var->info.writable)
-        group_add_var(&server->groups.list[GROUP_WRITE_ID], var);
-    else
-        group_add_var(&server->groups.list[GROUP_READ_ID], var);
+static inline uint32_t curves_count (sllp_server_t *server)
+{
+    (void) server;
+    return SLLP_STATIC_CURVE_COUNT;
+}
 
-    return SLLP_SUCCESS;
+static inline struct sllp_curve *get_curve (sllp_server_t *server, uint8_t id)
+{
+    (void) server;
+    return static_curves[id];
 }
 
-enum sllp_err sllp_register_curve (sllp_server_t *sllp,
-                                   struct sllp_curve *curve)
+// Groups. Members of created groups are packed one after the other in
+// server->members, in creation order.
+
+static bool group_add_var (sllp_server_t *server, struct server_group *grp,
+                           server_var_t *var)
 {
-    if(!sllp || !curve)
-        return SLLP_ERR_PARAM_INVALID;
+    unsigned int slot = (grp->vars.list - server->members.list) +
+                        grp->vars.count;
 
-    // Check variable fields
-    if(!curve->read_block)
-        return SLLP_ERR_PARAM_INVALID;
+    if(slot == SLLP_STATIC_MAX_GROUP_VARS)
+        return false;
 
-    if(curve->info.writable && !curve->write_block)
-        return SLLP_ERR_PARAM_INVALID;
+    server->members.list[slot] = var->info.id;
+    ++grp->vars.count;
+    grp->size += var->info.size;
+    grp->writable &= var->info.writable;
 
-    // Check curves limit
-    if(sllp->curves.count == MAX_CURVES)
-        return SLLP_ERR_OUT_OF_MEMORY;
+    return true;
+}
 
-    // Check if the curve is already in the list
-    unsigned int i;
-    for(i = 0; i < sllp->curves.count; ++i)
-        if(sllp->curves.list[i] == curve)
-            return SLLP_ERR_DUPLICATE;
+// Start a new group, which only counts once group_commit is called
+static struct server_group *group_new (sllp_server_t *server)
+{
+    if(server->groups.count == GROUP_STANDARD_COUNT + SLLP_STATIC_MAX_GROUPS)
+        return NULL;
 
-    // Add to the curves list
-    sllp->curves.list[sllp->curves.count] = curve;
+    struct server_group *grp =
+            &server->groups.list[server->groups.count - GROUP_STANDARD_COUNT];
 
-    // Adjust curve id
-    curve->info.id = sllp->curves.count++;
+    grp->id = server->groups.count;
+    grp->writable = true;
+    grp->vars.list = &server->members.list[server->members.count];
+    grp->vars.first = 0;
+    grp->vars.count = 0;
+    grp->size = 0;
 
-    return SLLP_SUCCESS;
+    return grp;
 }
 
-enum sllp_err sllp_register_hook(sllp_server_t* sllp, sllp_hook_t hook)
+static void group_commit (sllp_server_t *server, struct server_group *grp)
 {
-    if(!sllp || !hook)
-        return SLLP_ERR_PARAM_INVALID;
-
-    sllp->hook = hook;
+    server->members.count += grp->vars.count;
+    ++server->groups.count;
+}
 
-    return SLLP_SUCCESS;
+static void groups_remove (sllp_server_t *server)
+{
+    server->groups.count = GROUP_STANDARD_COUNT;
+    server->members.count = 0;
 }
 
-struct raw_message
+// Subscriptions
+
+static bool subs_reserve (sllp_server_t *server)
 {
-    uint8_t command_code;
-    uint8_t encoded_size;
-    uint8_t payload[];
-}__attribute__((packed));
+    return server->subs.count < SLLP_STATIC_MAX_SUBSCRIPTIONS;
+}
 
-struct message
+// Batches
+
+#ifdef SLLP_STATIC_BATCH
+static uint8_t static_batch[MAX_MESSAGE];
+#endif
+
+static uint8_t *batch_buffer (sllp_server_t *server)
 {
-    enum command_code command_code;
-    uint16_t payload_size;
-    uint8_t *payload;
-};
+    (void) server;
+#ifdef SLLP_STATIC_BATCH
+    return static_batch;
+#else
+    return NULL;
+#endif
+}
 
-static void message_set_answer(struct message *msg, enum command_code code);
+// Values of a group, one variable at a time. Static variables are separate
+// objects, so there is nothing to merge.
 
-static void query_vars_list (sllp_server_t *server, struct message *recv_msg,
-                             struct message *send_msg)
+static void group_gather (sllp_server_t *server, const struct server_group *grp,
+                          uint8_t *payload)
 {
-    // Check payload size
-    if(recv_msg->payload_size != 0)
+    unsigned int i;
+    for(i = 0; i < grp->vars.count; ++i)
     {
-        message_set_answer(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
-        return;
+        server_var_t *var = get_var(server, group_var_id(grp, i));
+        memcpy(payload, var->data, var->info.size);
+        payload += var->info.size;
     }
+}
 
-    // Set answer's command_code and payload_size
-    message_set_answer(send_msg, CMD_VARS_LIST);
-
-    // Variables are in order of their ID's
-    struct sllp_var *var;
-
-    // Add each variable to the response
+static void group_scatter (sllp_server_t *server,
+                           const struct server_group *grp,
+                           const uint8_t *payload)
+{
     unsigned int i;
-    for(i = 0; i < server->vars.count; ++i)
+    for(i = 0; i < grp->vars.count; ++i)
     {
-        var = server->vars.list[i];
-        send_msg->payload[i]  = var->info.writable ? WRITABLE : READ_ONLY;
-        send_msg->payload[i] += var->info.size;
+        server_var_t *var = get_var(server, group_var_id(grp, i));
+        memcpy(var->data, payload, var->info.size);
+        payload += var->info.size;
     }
-    send_msg->payload_size = server->vars.count;
 }
 
-static void query_groups_list (sllp_server_t *server, struct message *recv_msg,
-                               struct message *send_msg)
+static void group_bin_op (sllp_server_t *server, const struct server_group *grp,
+                          bin_op_function op, const uint8_t *mask)
 {
-    // Check payload size
-    if(recv_msg->payload_size != 0)
+    unsigned int i;
+    for(i = 0; i < grp->vars.count; ++i)
     {
-        message_set_answer(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
-        return;
+        server_var_t *var = get_var(server, group_var_id(grp, i));
+        op(var->data, mask, var->info.size);
+        mask += var->info.size;
     }
+}
 
-    // Set answer's command_code and payload_size
-    message_set_answer(send_msg, CMD_GROUPS_LIST);
+// Curves. There is no RAM to keep a digest of every block, so checksums are
+// computed from the whole curve, keeping only the subtrees still waiting for
+// a right sibling.
 
-    // Add each group to the response
-    struct server_group *grp;
+static void curve_block_written (sllp_server_t *server, uint8_t id,
+                                 uint8_t block, uint8_t *data)
+{
+    (void) server; (void) id; (void) block; (void) data;
+}
+
+static bool curve_checksum (sllp_server_t *server, uint8_t id,
+                            enum sllp_checksum mode, uint8_t *checksum)
+{
+    struct sllp_curve *curve = get_curve(server, id);
+
+    uint8_t block[CURVE_BLOCK];
+    uint8_t node[10][CURVE_CSUM_SIZE];  // Pending subtrees, left to right
+    uint8_t height[10];
+    unsigned int n = 0;
 
     unsigned int i;
-    for(i = 0; i < server->groups.count; ++i)
+    for(i = 0; i < curve->info.nblocks + 1u; ++i)
     {
-        grp = &server->groups.list[i];
-        send_msg->payload[i]  = grp->writable ? WRITABLE : READ_ONLY;
-        send_msg->payload[i] += grp->vars.count;
+        curve->read_block(curve, (uint8_t)i, block);
+        digest(mode, block, CURVE_BLOCK, node[n]);
+        height[n++] = 0;
+
+        // Like the carries of a binary counter
+        for(; n > 1 && height[n-2] == height[n-1]; --n)
+        {
+            digest_children(mode, node[n-2], node[n-2]);
+            ++height[n-2];
+        }
     }
-    send_msg->payload_size = server->groups.count;
+
+    // Subtrees on the right edge move up unchanged until they meet a sibling
+    for(; n > 1; --n)
+        digest_children(mode, node[n-2], node[n-2]);
+
+    memcpy(checksum, node[0], CURVE_CSUM_SIZE);
+    return true;
 }
 
-static void query_group (sllp_server_t *server, struct message *recv_msg,
-                         struct message *send_msg)
+static void curve_forget_checksum (sllp_server_t *server, uint8_t id)
 {
-    // Check payload size
-    if(recv_msg->payload_size != 1)
-    {
-        message_set_answer(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
-        return;
-    }
+    (void) server; (void) id;
+}
 
-    // Set answer code
-    message_set_answer(send_msg, CMD_GROUP);
+// Hooks get the affected variables one at a time
 
-    // Check ID
-    uint8_t group_id = recv_msg->payload[0];
-    if(group_id >= server->groups.count)
-    {
-        message_set_answer(send_msg, CMD_ERR_INVALID_ID);
-        return;
-    }
+static void hook_var (sllp_server_t *server, enum sllp_operation op,
+                      server_var_t *var)
+{
+    if(server->hook)
+        server->hook(op, var);
+}
 
-    // Get desired group
-    struct server_group *grp = &server->groups.list[group_id];
+static void hook_group (sllp_server_t *server, enum sllp_operation op,
+                        const struct server_group *grp)
+{
+    if(!server->hook)
+        return;
 
     unsigned int i;
     for(i = 0; i < grp->vars.count; ++i)
-        send_msg->payload[i] = grp->vars.list[i]->id;
-
-    send_msg->payload_size = grp->vars.count;
+        server->hook(op, get_var(server, group_var_id(grp, i)));
 }
 
-static void query_curves_list (sllp_server_t *server, struct message *recv_msg,
-                               struct message *send_msg)
+sllp_server_t *sllp_server_new (void)
 {
-    // Check payload size
-    if(recv_msg->payload_size != 0)
-    {
-        message_set_answer(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
-        return;
-    }
+    sllp_server_t *server = &static_server;
 
-    message_set_answer(send_msg, CMD_CURVES_LIST);
+    server->groups.count = GROUP_STANDARD_COUNT;
+    server->members.count = 0;
+    server->subs.count = 0;
+    server->subs.next = 0;
+    server->hook = NULL;
+    server->seqlock = NULL;
+    server->clock = NULL;
+    memset(&server->stats, 0, sizeof(server->stats));
 
-    struct sllp_curve *curve;
-    uint8_t *payloadp = send_msg->payload;
     unsigned int i;
-    for(i = 0; i < server->curves.count; ++i)
+    for(i = 0; i < SLLP_STATIC_CURVE_COUNT; ++i)
+        static_curves[i]->info.id = i;
+
+    return server;
+}
+
+enum sllp_err sllp_server_destroy (sllp_server_t* server)
+{
+    if(!server)
+        return SLLP_ERR_PARAM_INVALID;
+
+    return SLLP_SUCCESS;
+}
+
+// Checksums always come from the whole curve, so there is nothing to update
+enum sllp_err sllp_curve_block_changed (sllp_server_t *server,
+                                        struct sllp_curve *curve,
+                                        uint8_t block)
+{
+    if(!server || !curve || curve->info.id >= curves_count(server) ||
+       get_curve(server, curve->info.id) != curve)
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(block > curve->info.nblocks)
+        return SLLP_ERR_PARAM_OUT_OF_RANGE;
+
+    return SLLP_SUCCESS;
+}
+
+#else
+
+#define INITIAL_CAPACITY        8
+
+// A run of group values that are adjacent in memory, copied at once
+struct group_segment
+{
+    uint8_t  *data;                     // Value of the first variable
+    uint16_t  size;                     // Sum of the sizes of the variables
+};
+
+// Private server group structure
+struct server_group
+{
+    uint16_t id;                        // ID of the group
+    bool     writable;                  // Whether all variables in the group
+                                        // are writable
+    struct
     {
-        curve = server->curves.list[i];
+        uint16_t *list;                 // IDs of the variables
+        uint32_t  count;                // Number of variables
+        uint32_t  capacity;             // Number of IDs list can hold
+    }vars;
 
-        (*payloadp++) = curve->info.writable;
+    struct
+    {
+        struct group_segment *list;     // Where the values are, in order
+        uint32_t  count;
+        uint32_t  capacity;
+    }segments;
+
+    uint16_t size;                      // Sum of the sizes of all variables in
+                                        // the group
+};
+
+// Checksum tree of a curve, kept up to date as blocks are written
+struct curve_tree
+{
+    bool     built;                     // Whether every leaf is known
+    uint16_t blocks;                    // Number of blocks of the curve
+    uint16_t leaves;                    // Index of the first leaf, a power of 2
+    uint8_t  node[][CURVE_CSUM_SIZE];   // 2*leaves nodes, the root at index 1
+};
+
+// Trees are made by the first checksum in their mode
+struct server_curve
+{
+    struct sllp_curve *curve;
+    struct curve_tree *tree[SLLP_CHECKSUM_MAX];     // By enum sllp_checksum
+};
+
+// Registries grow as objects are registered. Objects are stored at the index
+// given by their ID, so every lookup is a single array access.
+struct sllp_server
+{
+    struct
+    {
+        struct sllp_var **list;
+        uint32_t count;
+        uint32_t capacity;
+    }vars;
+
+    struct
+    {
+        struct server_group *list;
+        uint32_t count;
+        uint32_t capacity;
+    }groups;
+
+    struct
+    {
+        struct server_curve *list;
+        uint32_t count;
+        uint32_t capacity;
+    }curves;
+
+    struct
+    {
+        struct subscription *list;
+        uint32_t count;
+        uint32_t capacity;
+        uint32_t next;                  // Where the next notification starts
+    }subs;
+
+    uint8_t *batch;                     // Answers within batches
+    sllp_hook_t hook;
+    struct sllp_seqlock *seqlock;
+    bool wide_ids;
+    sllp_clock_t clock;
+    struct sllp_stats stats;
+};
+
+// Make room for one more entry in a list, doubling its capacity when full.
+// New entries are zeroed.
+static bool list_reserve (void **list, uint32_t *capacity, uint32_t count,
+                          size_t entry_size)
+{
+    if(count < *capacity)
+        return true;
+
+    uint32_t new_capacity = *capacity ? 2*(*capacity) : INITIAL_CAPACITY;
+    uint8_t *new_list = realloc(*list, new_capacity*entry_size);
+
+    if(!new_list)
+        return false;
+
+    memset(new_list + (*capacity)*entry_size, 0,
+           (new_capacity - *capacity)*entry_size);
+
+    *list = new_list;
+    *capacity = new_capacity;
+
+    return true;
+}
+
+#define LIST_RESERVE(l) list_reserve((void **) &(l).list, &(l).capacity,     \
+                                     (l).count, sizeof(*(l).list))
+
+typedef struct sllp_var server_var_t;
+
+static inline unsigned int id_size (sllp_server_t *server)
+{
+    return server->wide_ids ? 2 : 1;
+}
+
+// The variables and groups lists describe each one in a single byte. With
+// single byte IDs, keep them short enough for the size byte.
+static inline uint32_t max_vars (sllp_server_t *server)
+{
+    return server->wide_ids ? MAX_PAYLOAD : MAX_PAYLOAD_ENCODED - 1;
+}
+
+static inline uint32_t max_group_size (sllp_server_t *server)
+{
+    return MAX_GROUP_SIZE(id_size(server));
+}
+
+// Capabilities and limits that depend on the configuration. Batches and
+// subscriptions take memory as needed.
+
+static inline uint32_t config_caps (sllp_server_t *server)
+{
+    return (server->wide_ids ? CAP_WIDE_IDS : 0) | CAP_BATCH |
+           CAP_SUBSCRIPTIONS;
+}
+
+static inline uint32_t max_groups (sllp_server_t *server)
+{
+    return max_vars(server);
+}
+
+// One subscription per variable
+static inline uint32_t max_subscriptions (sllp_server_t *server)
+{
+    return max_vars(server);
+}
+
+// Lookups
+
+static inline uint32_t vars_count (sllp_server_t *server)
+{
+    return server->vars.count;
+}
+
+static inline server_var_t *get_var (sllp_server_t *server, uint16_t id)
+{
+    return server->vars.list[id];
+}
+
+static inline const struct server_group *get_group (sllp_server_t *server,
+                                                    uint16_t id)
+{
+    return &server->groups.list[id];
+}
+
+static inline uint16_t group_var_id (const struct server_group *grp,
+                                     unsigned int i)
+{
+    return grp->vars.list[i];
+}
+
+static inline uint32_t curves_count (sllp_server_t *server)
+{
+    return server->curves.count;
+}
+
+static inline struct sllp_curve *get_curve (sllp_server_t *server, uint8_t id)
+{
+    return server->curves.list[id].curve;
+}
+
+// Curves
+
+static struct curve_tree *curve_tree_new (const struct sllp_curve *curve)
+{
+    unsigned int blocks = curve->info.nblocks + 1;
+    unsigned int leaves = 1;
+
+    while(leaves < blocks)
+        leaves *= 2;
+
+    struct curve_tree *tree = malloc(sizeof(*tree) +
+                                     2*leaves*sizeof(tree->node[0]));
+    if(!tree)
+        return NULL;
+
+    tree->built = false;
+    tree->blocks = blocks;
+    tree->leaves = leaves;
+
+    return tree;
+}
+
+static void curve_tree_node (enum sllp_checksum mode, struct curve_tree *tree,
+                             unsigned int k)
+{
+    // First leaf under the right child
+    unsigned int first = 2*k + 1;
+    while(first < tree->leaves)
+        first *= 2;
+
+    if(first - tree->leaves >= tree->blocks)
+    {
+        memcpy(tree->node[k], tree->node[2*k], sizeof(tree->node[k]));
+        return;
+    }
+
+    digest_children(mode, tree->node[2*k], tree->node[k]);
+}
+
+// A written block costs its own digest plus one per level of the tree, at
+// most 8 for the 256 blocks a curve can have
+static void curve_block_written (sllp_server_t *server, uint8_t id,
+                                 uint8_t block, uint8_t *data)
+{
+    unsigned int mode;
+    for(mode = 0; mode < SLLP_CHECKSUM_MAX; ++mode)
+    {
+        struct curve_tree *tree = server->curves.list[id].tree[mode];
+
+        // Until the first checksum, the other leaves are unknown anyway
+        if(!tree || !tree->built)
+            continue;
+
+        digest(mode, data, CURVE_BLOCK, tree->node[tree->leaves + block]);
+
+        unsigned int k;
+        for(k = (tree->leaves + block)/2; k; k /= 2)
+            curve_tree_node(mode, tree, k);
+    }
+}
+
+// Only the first checksum of a curve in a mode reads it whole, to fill the
+// tree. Fails if there's no memory for the tree.
+static bool curve_checksum (sllp_server_t *server, uint8_t id,
+                            enum sllp_checksum mode, uint8_t *checksum)
+{
+    struct sllp_curve *curve = server->curves.list[id].curve;
+    struct curve_tree **treep = &server->curves.list[id].tree[mode];
+
+    if(!*treep && !(*treep = curve_tree_new(curve)))
+        return false;
+
+    struct curve_tree *tree = *treep;
+
+    if(!tree->built)
+    {
+        uint8_t block[CURVE_BLOCK];
+        unsigned int i;
+
+        for(i = 0; i < tree->blocks; ++i)
+        {
+            curve->read_block(curve, (uint8_t)i, block);
+            digest(mode, block, CURVE_BLOCK, tree->node[tree->leaves + i]);
+        }
+
+        for(i = tree->leaves - 1; i; --i)
+            curve_tree_node(mode, tree, i);
+
+        tree->built = true;
+    }
+
+    memcpy(checksum, tree->node[1], CURVE_CSUM_SIZE);
+    return true;
+}
+
+// For curves changing too often to keep their trees up to date: the next
+// checksum request reads them whole
+static void curve_forget_checksum (sllp_server_t *server, uint8_t id)
+{
+    unsigned int mode;
+    for(mode = 0; mode < SLLP_CHECKSUM_MAX; ++mode)
+        if(server->curves.list[id].tree[mode])
+            server->curves.list[id].tree[mode]->built = false;
+}
+
+// Groups
+
+// The IDs list of a group outlives it, so groups created after the client
+// removes them reuse the memory
+static void group_init (struct server_group *grp, uint16_t id)
+{
+    grp->id = id;
+    grp->writable = true;
+    grp->vars.count = 0;
+    grp->segments.count = 0;
+    grp->size = 0;
+}
+
+// Make room for one more variable, after which group_add_var can't fail
+static bool group_reserve (struct server_group *grp)
+{
+    return LIST_RESERVE(grp->vars) && LIST_RESERVE(grp->segments);
+}
+
+// Variables are added to the gather list as they join the group. When the
+// value of a variable starts where the previous one ends, the segment of the
+// previous one just grows, so variables kept in a single struct or array are
+// read and written with a single copy.
+static bool group_add_var (sllp_server_t *server, struct server_group *grp,
+                           server_var_t *var)
+{
+    (void) server;
+
+    if(!group_reserve(grp))
+        return false;
+
+    struct group_segment *last = grp->segments.count ?
+            &grp->segments.list[grp->segments.count - 1] : NULL;
+
+    if(last && last->data + last->size == var->data)
+        last->size += var->info.size;
+    else
+    {
+        last = &grp->segments.list[grp->segments.count++];
+        last->data = var->data;
+        last->size = var->info.size;
+    }
+
+    grp->vars.list[grp->vars.count++] = var->info.id;
+    grp->size += var->info.size;
+    grp->writable &= var->info.writable;
+
+    return true;
+}
+
+// Start a new group, which only counts once group_commit is called
+static struct server_group *group_new (sllp_server_t *server)
+{
+    if(server->groups.count == max_vars(server) ||
+       !LIST_RESERVE(server->groups))
+        return NULL;
+
+    struct server_group *grp = &server->groups.list[server->groups.count];
+    group_init(grp, server->groups.count);
+
+    return grp;
+}
+
+static void group_commit (sllp_server_t *server, struct server_group *grp)
+{
+    (void) grp;
+    ++server->groups.count;
+}
+
+static void groups_remove (sllp_server_t *server)
+{
+    server->groups.count = GROUP_STANDARD_COUNT;
+}
+
+// Subscriptions
+
+static bool subs_reserve (sllp_server_t *server)
+{
+    return LIST_RESERVE(server->subs);
+}
+
+// Batches, allocated by the first one
+
+static uint8_t *batch_buffer (sllp_server_t *server)
+{
+    if(!server->batch)
+        server->batch = malloc(MAX_MESSAGE);
+
+    return server->batch;
+}
+
+static void group_gather (sllp_server_t *server, const struct server_group *grp,
+                          uint8_t *payload)
+{
+    (void) server;
+
+    const struct group_segment *seg = grp->segments.list;
+    const struct group_segment *end = seg + grp->segments.count;
+
+    for(; seg != end; payload += seg->size, ++seg)
+        memcpy(payload, seg->data, seg->size);
+}
+
+static void group_scatter (sllp_server_t *server,
+                           const struct server_group *grp,
+                           const uint8_t *payload)
+{
+    (void) server;
+
+    const struct group_segment *seg = grp->segments.list;
+    const struct group_segment *end = seg + grp->segments.count;
+
+    for(; seg != end; payload += seg->size, ++seg)
+        memcpy(seg->data, payload, seg->size);
+}
+
+// Bin ops work byte by byte, so they apply to whole segments as well
+static void group_bin_op (sllp_server_t *server, const struct server_group *grp,
+                          bin_op_function op, const uint8_t *mask)
+{
+    (void) server;
+
+    const struct group_segment *seg = grp->segments.list;
+    const struct group_segment *end = seg + grp->segments.count;
+
+    for(; seg != end; mask += seg->size, ++seg)
+        op(seg->data, mask, seg->size);
+}
+
+// Hooks get the affected variables one at a time
+
+static void hook_var (sllp_server_t *server, enum sllp_operation op,
+                      server_var_t *var)
+{
+    if(server->hook)
+        server->hook(op, var);
+}
+
+static void hook_group (sllp_server_t *server, enum sllp_operation op,
+                        const struct server_group *grp)
+{
+    if(!server->hook)
+        return;
+
+    unsigned int i;
+    for(i = 0; i < grp->vars.count; ++i)
+        server->hook(op, get_var(server, group_var_id(grp, i)));
+}
+
+sllp_server_t *sllp_server_new (void)
+{
+    struct sllp_server *server = (struct sllp_server*) malloc(sizeof(*server));
+
+    if(!server)
+        return NULL;
+
+    memset(server, 0, sizeof(*server));
+
+    // Standard groups
+    server->groups.list = calloc(GROUP_STANDARD_COUNT,
+                                 sizeof(*server->groups.list));
+
+    if(!server->groups.list)
+    {
+        sllp_server_destroy(server);
+        return NULL;
+    }
+
+    server->groups.capacity = GROUP_STANDARD_COUNT;
+
+    group_init(&server->groups.list[GROUP_ALL_ID],   GROUP_ALL_ID);
+    group_init(&server->groups.list[GROUP_READ_ID],  GROUP_READ_ID);
+    group_init(&server->groups.list[GROUP_WRITE_ID], GROUP_WRITE_ID);
+
+    server->groups.count = GROUP_STANDARD_COUNT;
+
+    return server;
+}
+
+enum sllp_err sllp_server_destroy (sllp_server_t* server)
+{
+    if(!server)
+        return SLLP_ERR_PARAM_INVALID;
+
+    // Groups removed by the client keep their lists for reuse
+    unsigned int i;
+    if(server->groups.list)
+        for(i = 0; i < server->groups.capacity; ++i)
+        {
+            free(server->groups.list[i].vars.list);
+            free(server->groups.list[i].segments.list);
+        }
+
+    if(server->curves.list)
+        for(i = 0; i < server->curves.count; ++i)
+        {
+            unsigned int mode;
+            for(mode = 0; mode < SLLP_CHECKSUM_MAX; ++mode)
+                free(server->curves.list[i].tree[mode]);
+        }
+
+    free(server->groups.list);
+    free(server->vars.list);
+    free(server->curves.list);
+    free(server->subs.list);
+    free(server->batch);
+    free(server);
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_server_wide_ids (sllp_server_t *server, bool enable)
+{
+    if(!server)
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(server->vars.count || server->groups.count > GROUP_STANDARD_COUNT)
+        return SLLP_ERR_PARAM_INVALID;
+
+    server->wide_ids = enable;
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_register_variable (sllp_server_t *server,
+                                      struct sllp_var *var)
+{
+    if(!server || !var)
+        return SLLP_ERR_PARAM_INVALID;
+
+    // Check variable fields
+    if(var->info.size < VARIABLE_MIN_SIZE || var->info.size > VARIABLE_MAX_SIZE)
+        return SLLP_ERR_PARAM_OUT_OF_RANGE;
+
+    if(!var->data)
+        return SLLP_ERR_PARAM_INVALID;
+
+    // Check if the variable is already in the list. A registered variable
+    // sits at the index given by its ID.
+    if(var->info.id < server->vars.count &&
+       server->vars.list[var->info.id] == var)
+        return SLLP_ERR_DUPLICATE;
+
+    // Check vars limit. Every variable also goes to the group of all
+    // variables, whose values must fit a single message.
+    struct server_group *all = &server->groups.list[GROUP_ALL_ID];
+
+    if(server->vars.count == max_vars(server) ||
+       all->size + var->info.size > max_group_size(server))
+        return SLLP_ERR_OUT_OF_MEMORY;
+
+    // Make room in the variables list
+    if(!LIST_RESERVE(server->vars))
+        return SLLP_ERR_OUT_OF_MEMORY;
+
+    // Adjust var id
+    var->info.id = server->vars.count;
+
+    // Add to the group containing all variables and either to the WRITABLE or
+    // to the READ_ONLY group
+    struct server_group *access = &server->groups.list[var->info.writable ?
+                                                       GROUP_WRITE_ID :
+                                                       GROUP_READ_ID];
+
+    if(!group_reserve(all) || !group_reserve(access))
+        return SLLP_ERR_OUT_OF_MEMORY;
+
+    group_add_var(server, all, var);
+    group_add_var(server, access, var);
+
+    // Add to the variables list
+    server->vars.list[server->vars.count++] = var;
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_register_curve (sllp_server_t *sllp,
+                                   struct sllp_curve *curve)
+{
+    if(!sllp || !curve)
+        return SLLP_ERR_PARAM_INVALID;
+
+    // Check variable fields
+    if(!curve->read_block)
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(curve->info.writable && !curve->write_block)
+        return SLLP_ERR_PARAM_INVALID;
+
+    // Check if the curve is already in the list
+    if(curve->info.id < sllp->curves.count &&
+       sllp->curves.list[curve->info.id].curve == curve)
+        return SLLP_ERR_DUPLICATE;
+
+    // Check curves limit
+    if(sllp->curves.count == MAX_CURVES || !LIST_RESERVE(sllp->curves))
+        return SLLP_ERR_OUT_OF_MEMORY;
+
+    // Add to the curves list
+    sllp->curves.list[sllp->curves.count].curve = curve;
+
+    // Adjust curve id
+    curve->info.id = sllp->curves.count++;
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_curve_block_changed (sllp_server_t *server,
+                                        struct sllp_curve *curve,
+                                        uint8_t block)
+{
+    if(!server || !curve || curve->info.id >= curves_count(server) ||
+       get_curve(server, curve->info.id) != curve)
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(block > curve->info.nblocks)
+        return SLLP_ERR_PARAM_OUT_OF_RANGE;
+
+    uint8_t data[CURVE_BLOCK];
+    curve->read_block(curve, block, data);
+    curve_block_written(server, curve->info.id, block, data);
+
+    return SLLP_SUCCESS;
+}
+
+#endif  /* SLLP_SERVER_STATIC */
+
+// Consistent copies of the variables. Without a seqlock, values are copied as
+// they are.
+
+static inline uint32_t snapshot_begin (sllp_server_t *server)
+{
+    if(!server->seqlock)
+        return 0;
+
+    uint32_t seq;
+    while((seq = __atomic_load_n(&server->seqlock->seq, __ATOMIC_ACQUIRE)) & 1)
+        ;
+
+    return seq;
+}
+
+// Whether the values copied since snapshot_begin may have changed meanwhile
+static inline bool snapshot_retry (sllp_server_t *server, uint32_t seq)
+{
+    if(!server->seqlock)
+        return false;
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&server->seqlock->seq, __ATOMIC_RELAXED) != seq;
+}
+
+static inline uint16_t get_id (sllp_server_t *server, const uint8_t *data)
+{
+    return id_size(server) == 2 ? (data[0] << 8) | data[1] : data[0];
+}
+
+static inline uint8_t *put_id (sllp_server_t *server, uint8_t *data,
+                               uint16_t id)
+{
+    if(id_size(server) == 2)
+        *data++ = id >> 8;
+    *data++ = id & 0xFF;
+    return data;
+}
+
+enum sllp_err sllp_register_hook(sllp_server_t* sllp, sllp_hook_t hook)
+{
+    if(!sllp || !hook)
+        return SLLP_ERR_PARAM_INVALID;
+
+    sllp->hook = hook;
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_register_seqlock (sllp_server_t *server,
+                                     struct sllp_seqlock *lock)
+{
+    if(!server)
+        return SLLP_ERR_PARAM_INVALID;
+
+    server->seqlock = lock;
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_register_clock (sllp_server_t *server, sllp_clock_t clock)
+{
+    if(!server)
+        return SLLP_ERR_PARAM_INVALID;
+
+    server->clock = clock;
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_server_stats (sllp_server_t *server,
+                                 struct sllp_stats *stats)
+{
+    if(!server || !stats)
+        return SLLP_ERR_PARAM_INVALID;
+
+    memcpy(stats, &server->stats, sizeof(*stats));
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_server_reset_stats (sllp_server_t *server)
+{
+    if(!server)
+        return SLLP_ERR_PARAM_INVALID;
+
+    memset(&server->stats, 0, sizeof(server->stats));
+
+    return SLLP_SUCCESS;
+}
+
+struct raw_message
+{
+    uint8_t command_code;
+    uint8_t encoded_size;
+    uint8_t payload[];
+}__attribute__((packed));
+
+struct message
+{
+    enum command_code command_code;
+    uint16_t payload_size;
+    uint8_t *payload;
+    bool extended;                      // Came with an extended header
+};
+
+static void message_set_answer(struct message *msg, enum command_code code);
+
+static void query_vars_list (sllp_server_t *server, struct message *recv_msg,
+                             struct message *send_msg)
+{
+    // Check payload size
+    if(recv_msg->payload_size != 0)
+    {
+        message_set_answer(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
+        return;
+    }
+
+    // Set answer's command_code and payload_size
+    message_set_answer(send_msg, CMD_VARS_LIST);
+
+#ifdef SLLP_SERVER_STATIC
+    // Precomputed
+    memcpy(send_msg->payload, static_vars_list, SLLP_STATIC_VAR_COUNT);
+#else
+    // Variables are in order of their ID's
+    server_var_t *var;
+
+    // Add each variable to the response
+    unsigned int i;
+    for(i = 0; i < server->vars.count; ++i)
+    {
+        var = server->vars.list[i];
+        send_msg->payload[i]  = var->info.writable ? WRITABLE : READ_ONLY;
+        send_msg->payload[i] += var->info.size;
+    }
+#endif
+    send_msg->payload_size = vars_count(server);
+}
+
+static void query_groups_list (sllp_server_t *server, struct message *recv_msg,
+                               struct message *send_msg)
+{
+    // Check payload size
+    if(recv_msg->payload_size != 0)
+    {
+        message_set_answer(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
+        return;
+    }
+
+    // Set answer's command_code and payload_size
+    message_set_answer(send_msg, CMD_GROUPS_LIST);
+
+    // Add each group to the response
+    const struct server_group *grp;
+
+    unsigned int i;
+    for(i = 0; i < server->groups.count; ++i)
+    {
+        grp = get_group(server, i);
+        send_msg->payload[i]  = grp->writable ? WRITABLE : READ_ONLY;
+
+        // Bigger groups report the largest count that fits. Their members
+        // are listed in full by CMD_QUERY_GROUP.
+        send_msg->payload[i] += grp->vars.count > SIZE_MASK ?
+                                SIZE_MASK : grp->vars.count;
+    }
+    send_msg->payload_size = server->groups.count;
+}
+
+static void query_group (sllp_server_t *server, struct message *recv_msg,
+                         struct message *send_msg)
+{
+    // Check payload size
+    if(recv_msg->payload_size != id_size(server))
+    {
+        message_set_answer(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
+        return;
+    }
+
+    // Set answer code
+    message_set_answer(send_msg, CMD_GROUP);
+
+    // Check ID
+    uint16_t group_id = get_id(server, recv_msg->payload);
+    if(group_id >= server->groups.count)
+    {
+        message_set_answer(send_msg, CMD_ERR_INVALID_ID);
+        return;
+    }
+
+    // Get desired group
+    const struct server_group *grp = get_group(server, group_id);
+
+    uint8_t *payloadp = send_msg->payload;
+    unsigned int i;
+    for(i = 0; i < grp->vars.count; ++i)
+        payloadp = put_id(server, payloadp, group_var_id(grp, i));
+
+    send_msg->payload_size = payloadp - send_msg->payload;
+}
+
+static void query_curves_list (sllp_server_t *server, struct message *recv_msg,
+                               struct message *send_msg)
+{
+    // Check payload size
+    if(recv_msg->payload_size != 0)
+    {
+        message_set_answer(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
+        return;
+    }
+
+    message_set_answer(send_msg, CMD_CURVES_LIST);
+
+    struct sllp_curve *curve;
+    uint8_t *payloadp = send_msg->payload;
+    unsigned int i;
+    for(i = 0; i < curves_count(server); ++i)
+    {
+        curve = get_curve(server, i);
+
+        (*payloadp++) = curve->info.writable;
         (*payloadp++) = curve->info.nblocks;
         memcpy(payloadp, curve->info.checksum, sizeof(curve->info.checksum));
         payloadp += sizeof(curve->info.checksum);
     }
-    send_msg->payload_size = server->curves.count*CURVE_INFO_SIZE;
+    send_msg->payload_size = curves_count(server)*CURVE_INFO_SIZE;
+}
+
+static inline uint8_t *put_u32 (uint8_t *data, uint32_t value)
+{
+    *data++ = value >> 24;
+    *data++ = value >> 16;
+    *data++ = value >> 8;
+    *data++ = value;
+    return data;
+}
+
+// Features offered (4 bytes), then the largest payload (4 bytes), how many
+// groups there may be and how many variables may be subscribed to (2 bytes
+// each), all most significant first
+static void query_caps (sllp_server_t *server, struct message *recv_msg,
+                        struct message *send_msg)
+{
+    if(recv_msg->payload_size != 0)
+    {
+        message_set_answer(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
+        return;
+    }
+
+    uint32_t caps = CAP_CRC32C | CAP_EXTENDED_SIZE | CAP_COMPRESSED_CURVES |
+                    CAP_ATOMIC | CAP_CURVE_RANGE | CAP_STATS |
+                    config_caps(server);
+
+    message_set_answer(send_msg, CMD_CAPS);
+
+    uint8_t *p = send_msg->payload;
+    p = put_u32(p, caps);
+    p = put_u32(p, MAX_PAYLOAD);
+    *p++ = max_groups(server) >> 8;
+    *p++ = max_groups(server);
+    *p++ = max_subscriptions(server) >> 8;
+    *p++ = max_subscriptions(server);
+
+    send_msg->payload_size = CAPS_SIZE;
+}
+
+// The counts of malformed and unsupported requests, then code, count and time
+// of every command handled at least once, from the code in the request (or 0)
+// on. Entries that don't fit are left to a request starting after the last
+// one sent.
+static void query_stats (sllp_server_t *server, struct message *recv_msg,
+                         struct message *send_msg)
+{
+    if(recv_msg->payload_size > 1)
+    {
+        message_set_answer(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
+        return;
+    }
+
+    unsigned int code = recv_msg->payload_size ? recv_msg->payload[0] : 0;
+
+    uint8_t *p = send_msg->payload;
+    uint8_t *end = send_msg->payload + MAX_PAYLOAD_ENCODED - 1;
+
+    p = put_u32(p, server->stats.malformed);
+    p = put_u32(p, server->stats.unsupported);
+
+    for(; code < 256 && p + 9 <= end; ++code)
+    {
+        const struct sllp_command_stats *cmd = &server->stats.command[code];
+
+        if(!cmd->count)
+            continue;
+
+        *p++ = code;
+        p = put_u32(p, cmd->count);
+        p = put_u32(p, cmd->time);
+    }
+
+    send_msg->command_code = CMD_STATS;
+    send_msg->payload_size = p - send_msg->payload;
+}
+
+static void read_var (sllp_server_t *server, struct message *recv_msg,
+                      struct message *send_msg)
+{
+    // Check payload size
+    if(recv_msg->payload_size != id_size(server))
+    {
+        message_set_answer(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
+        return;
+    }
+
+    // Check ID
+    uint16_t var_id = get_id(server, recv_msg->payload);
+
+    if(var_id >= vars_count(server))
+    {
+        message_set_answer(send_msg, CMD_ERR_INVALID_ID);
+        return;
+    }
+
+    // Get desired variable
+    server_var_t *var = get_var(server, var_id);
+
+    hook_var(server, SLLP_OP_READ, var);
+
+    // Set answer
+    message_set_answer(send_msg, CMD_VAR_READING);
+    send_msg->payload_size = var->info.size;
+
+    uint32_t seq;
+    do
+    {
+        seq = snapshot_begin(server);
+        memcpy(send_msg->payload, var->data, var->info.size);
+    }while(snapshot_retry(server, seq));
+}
+
+static void read_group (sllp_server_t *server, struct message *recv_msg,
+                        struct message *send_msg)
+{
+    // Check payload size
+    if(recv_msg->payload_size != id_size(server))
+    {
+        message_set_answer(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
+        return;
+    }
+
+    // Check group ID
+    uint16_t group_id = get_id(server, recv_msg->payload);
+
+    if(group_id >= server->groups.count)
+    {
+        message_set_answer(send_msg, CMD_ERR_INVALID_ID);
+        return;
+    }
+
+    // Get desired group
+    const struct server_group *grp = get_group(server, group_id);
+
+    // Call hook
+    hook_group(server, SLLP_OP_READ, grp);
+
+    // Gather group's values
+    message_set_answer(send_msg, CMD_GROUP_READING);
+
+    uint32_t seq;
+    do
+    {
+        seq = snapshot_begin(server);
+        group_gather(server, grp, send_msg->payload);
+    }while(snapshot_retry(server, seq));
+
+    send_msg->payload_size = grp->size;
+}
+
+static void write_var (sllp_server_t *server, struct message *recv_msg,
+                       struct message *send_msg)
+{
+    // Check if body has at least the ID and one byte
+    // Check payload size
+    if(recv_msg->payload_size < id_size(server) + 1)
+    {
+        message_set_answer(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
+        return;
+    }
+
+    // Check ID
+    uint16_t var_id = get_id(server, recv_msg->payload);
+
+    if(var_id >= vars_count(server))
+    {
+        message_set_answer(send_msg, CMD_ERR_INVALID_ID);
+        return;
+    }
+
+    // Get desired var
+    server_var_t *var = get_var(server, var_id);
+
+    // Check payload size
+    if(recv_msg->payload_size != id_size(server) + var->info.size)
+    {
+        message_set_answer(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
+        return;
+    }
+
+    // Check write permission
+    if(!var->info.writable)
+    {
+        message_set_answer(send_msg, CMD_ERR_READ_ONLY);
+        return;
+    }
+
+    // Everything is OK, perform operation
+    memcpy(var->data, recv_msg->payload + id_size(server), var->info.size);
+
+    // Call hook
+    hook_var(server, SLLP_OP_WRITE, var);
+
+    // Set answer code
+    message_set_answer(send_msg, CMD_OK);
+}
+
+static void bin_op_var (sllp_server_t *server, struct message *recv_msg,
+                        struct message *send_msg)
+{
+    // Check if body has at least the ID and the binary operation
+    if(recv_msg->payload_size < id_size(server) + 1)
+    {
+        message_set_answer(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
+        return;
+    }
+
+    // Check ID
+    uint16_t var_id = get_id(server, recv_msg->payload);
+
+    if(var_id >= vars_count(server))
+    {
+        message_set_answer(send_msg, CMD_ERR_INVALID_ID);
+        return;
+    }
+
+    // Get desired var
+    server_var_t *var = get_var(server, var_id);
+
+    // Get operation
+    unsigned char operation = recv_msg->payload[id_size(server)];
+
+    // Check operation
+    if(!bin_op[operation])
+    {
+        message_set_answer(send_msg, CMD_ERR_OP_NOT_SUPPORTED);
+        return;
+    }
+
+    // Check payload size
+    if(recv_msg->payload_size != id_size(server) + 1 + var->info.size)
+    {
+        message_set_answer(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
+        return;
+    }
+
+    // Check write permission
+    if(!var->info.writable)
+    {
+        message_set_answer(send_msg, CMD_ERR_READ_ONLY);
+        return;
+    }
+
+    // Everything is OK, perform operation
+    bin_op[operation](var->data, recv_msg->payload + id_size(server) + 1,
+                      var->info.size);
+
+    // Call hook
+    hook_var(server, SLLP_OP_WRITE, var);
+
+    // Set answer code
+    message_set_answer(send_msg, CMD_OK);
+    return;
+}
+
+static void write_group (sllp_server_t *server, struct message *recv_msg,
+                         struct message *send_msg)
+{
+    // Check if body has at least the ID
+    if(recv_msg->payload_size < id_size(server))
+    {
+        message_set_answer(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
+        return;
+    }
+
+    // Check ID
+    uint16_t group_id = get_id(server, recv_msg->payload);
+
+    if(group_id >= server->groups.count)
+    {
+        message_set_answer(send_msg, CMD_ERR_INVALID_ID);
+        return;
+    }
+
+    // Get desired group
+    const struct server_group *grp = get_group(server, group_id);
+
+    // Check payload size
+    if(recv_msg->payload_size != id_size(server) + grp->size)
+    {
+        message_set_answer(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
+        return;
+    }
+
+    // Check write permission
+    if(!grp->writable)
+    {
+        message_set_answer(send_msg, CMD_ERR_READ_ONLY);
+        return;
+    }
+
+    // Everything is OK, scatter the values
+    group_scatter(server, grp, recv_msg->payload + id_size(server));
+
+    // Call hook
+    hook_group(server, SLLP_OP_WRITE, grp);
+
+    message_set_answer(send_msg, CMD_OK);
+}
+
+static void bin_op_group (sllp_server_t *server, struct message *recv_msg,
+                          struct message *send_msg)
+{
+    // Check if body has at least the ID and the binary operation
+    if(recv_msg->payload_size < id_size(server) + 1)
+    {
+        message_set_answer(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
+        return;
+    }
+
+    // Check ID
+    uint16_t group_id = get_id(server, recv_msg->payload);
+
+    if(group_id >= server->groups.count)
+    {
+        message_set_answer(send_msg, CMD_ERR_INVALID_ID);
+        return;
+    }
+
+    // Get desired group
+    const struct server_group *grp = get_group(server, group_id);
+
+    // Get operation
+    unsigned char operation = recv_msg->payload[id_size(server)];
+
+    // Check operation
+    if(!bin_op[operation])
+    {
+        message_set_answer(send_msg, CMD_ERR_OP_NOT_SUPPORTED);
+        return;
+    }
+
+    // Check payload size
+    if(recv_msg->payload_size != id_size(server) + 1 + grp->size)
+    {
+        message_set_answer(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
+        return;
+    }
+
+    // Check write permission
+    if(!grp->writable)
+    {
+        message_set_answer(send_msg, CMD_ERR_READ_ONLY);
+        return;
+    }
+
+    // Everything is OK, apply the masks
+    group_bin_op(server, grp, bin_op[operation],
+                 recv_msg->payload + id_size(server) + 1);
+
+    // Call hook
+    hook_group(server, SLLP_OP_WRITE, grp);
+
+    message_set_answer(send_msg, CMD_OK);
+}
+
+// Add addend to the integer value, both size bytes long in the byte order of
+// the device, wrapping around. Negative addends are in two's complement.
+static void add_value (uint8_t *value, const uint8_t *addend, size_t size)
+{
+    unsigned int carry = 0;
+    size_t i;
+
+    for(i = 0; i < size; ++i)
+    {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        size_t k = size - 1 - i;
+#else
+        size_t k = i;
+#endif
+        carry += value[k] + addend[k];
+        value[k] = carry;
+        carry >>= 8;
+    }
 }
 
-static void read_var (sllp_server_t *server, struct message *recv_msg,
-                      struct message *send_msg)
+// Compare and swap: the value is replaced only if it equals the expected one.
+// Either way the answer is the value found, so the client tells by comparing.
+static void cas_var (sllp_server_t *server, struct message *recv_msg,
+                     struct message *send_msg)
 {
-    // Check payload size
-    if(recv_msg->payload_size != 1)
+    // Check if body has at least the ID and one byte
+    if(recv_msg->payload_size < id_size(server) + 1)
     {
         message_set_answer(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
         return;
     }
 
     // Check ID
-    uint8_t var_id = recv_msg->payload[0];
+    uint16_t var_id = get_id(server, recv_msg->payload);
 
-    if(var_id >= server->vars.count)
+    if(var_id >= vars_count(server))
     {
         message_set_answer(send_msg, CMD_ERR_INVALID_ID);
         return;
     }
 
-    // Get desired variable
-    struct sllp_var *var = server->vars.list[var_id];
+    // Get desired var
+    server_var_t *var = get_var(server, var_id);
 
-    if(server->hook)
+    // Check payload size: expected and new values
+    if(recv_msg->payload_size != id_size(server) + 2*var->info.size)
     {
-        server->modified_list[0] = var;
-        server->modified_list[1] = NULL;
-        server->hook(SLLP_OP_READ, server->modified_list);
+        message_set_answer(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
+        return;
     }
 
-    // Set answer
+    // Check write permission
+    if(!var->info.writable)
+    {
+        message_set_answer(send_msg, CMD_ERR_READ_ONLY);
+        return;
+    }
+
+    const uint8_t *expected = recv_msg->payload + id_size(server);
+
+    hook_var(server, SLLP_OP_READ, var);
+
     message_set_answer(send_msg, CMD_VAR_READING);
     send_msg->payload_size = var->info.size;
-    memcpy(send_msg->payload, var->data, var->info.size);
+
+    uint32_t seq;
+    do
+    {
+        seq = snapshot_begin(server);
+        memcpy(send_msg->payload, var->data, var->info.size);
+    }while(snapshot_retry(server, seq));
+
+    if(!memcmp(send_msg->payload, expected, var->info.size))
+    {
+        memcpy(var->data, expected + var->info.size, var->info.size);
+        hook_var(server, SLLP_OP_WRITE, var);
+    }
 }
 
-static void read_group (sllp_server_t *server, struct message *recv_msg,
-                        struct message *send_msg)
+static void cas_group (sllp_server_t *server, struct message *recv_msg,
+                       struct message *send_msg)
 {
-    // Check payload size
-    if(recv_msg->payload_size != 1)
+    // Check if body has at least the ID
+    if(recv_msg->payload_size < id_size(server))
     {
         message_set_answer(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
         return;
     }
 
-    // Check group ID
-    uint8_t group_id = recv_msg->payload[0];
+    // Check ID
+    uint16_t group_id = get_id(server, recv_msg->payload);
 
     if(group_id >= server->groups.count)
     {
@@ -353,55 +1782,70 @@ static void read_group (sllp_server_t *server, struct message *recv_msg,
     }
 
     // Get desired group
-    struct server_group *grp = &server->groups.list[group_id];
+    const struct server_group *grp = get_group(server, group_id);
 
-    // Call hook
-    if(server->hook)
+    // Check payload size: expected and new values
+    if(recv_msg->payload_size != id_size(server) + 2*grp->size)
+    {
+        message_set_answer(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
+        return;
+    }
+
+    // Check write permission
+    if(!grp->writable)
     {
-        group_to_mod_list(server, grp);
-        server->hook(SLLP_OP_READ, server->modified_list);
+        message_set_answer(send_msg, CMD_ERR_READ_ONLY);
+        return;
     }
 
-    // Iterate over group's variables
+    const uint8_t *expected = recv_msg->payload + id_size(server);
+
+    hook_group(server, SLLP_OP_READ, grp);
+
     message_set_answer(send_msg, CMD_GROUP_READING);
+    send_msg->payload_size = grp->size;
 
-    struct sllp_var *var;
-    unsigned int i;
-    uint8_t *payloadp = send_msg->payload;
-    for(i = 0; i < grp->vars.count; ++i)
+    uint32_t seq;
+    do
+    {
+        seq = snapshot_begin(server);
+        group_gather(server, grp, send_msg->payload);
+    }while(snapshot_retry(server, seq));
+
+    // All the values or none
+    if(!memcmp(send_msg->payload, expected, grp->size))
     {
-        var = server->vars.list[grp->vars.list[i]->id];
-        memcpy(payloadp, var->data, var->info.size);
-        payloadp += var->info.size;
+        group_scatter(server, grp, expected + grp->size);
+        hook_group(server, SLLP_OP_WRITE, grp);
     }
-    send_msg->payload_size = grp->size;
 }
 
-static void write_var (sllp_server_t *server, struct message *recv_msg,
-                       struct message *send_msg)
+// Fetch and add: the value is incremented, as an integer, and the answer is
+// the value before
+static void fetch_add_var (sllp_server_t *server, struct message *recv_msg,
+                           struct message *send_msg)
 {
-    // Check if body has at least one byte bytes (ID)
-    // Check payload size
-    if(recv_msg->payload_size < 2)
+    // Check if body has at least the ID and one byte
+    if(recv_msg->payload_size < id_size(server) + 1)
     {
         message_set_answer(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
         return;
     }
 
     // Check ID
-    uint8_t var_id = recv_msg->payload[0];
+    uint16_t var_id = get_id(server, recv_msg->payload);
 
-    if(var_id >= server->vars.count)
+    if(var_id >= vars_count(server))
     {
         message_set_answer(send_msg, CMD_ERR_INVALID_ID);
         return;
     }
 
     // Get desired var
-    struct sllp_var *var = server->vars.list[var_id];
+    server_var_t *var = get_var(server, var_id);
 
     // Check payload size
-    if(recv_msg->payload_size != 1 + var->info.size)
+    if(recv_msg->payload_size != id_size(server) + var->info.size)
     {
         message_set_answer(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
         return;
@@ -414,276 +1858,367 @@ static void write_var (sllp_server_t *server, struct message *recv_msg,
         return;
     }
 
-    // Everything is OK, perform operation
-    memcpy(var->data, recv_msg->payload + 1, var->info.size);
+    hook_var(server, SLLP_OP_READ, var);
 
-    // Call hook
-    if(server->hook)
+    message_set_answer(send_msg, CMD_VAR_READING);
+    send_msg->payload_size = var->info.size;
+
+    uint32_t seq;
+    do
     {
-        server->modified_list[0] = var;
-        server->modified_list[1] = NULL;
-        server->hook(SLLP_OP_WRITE, server->modified_list);
-    }
+        seq = snapshot_begin(server);
+        memcpy(send_msg->payload, var->data, var->info.size);
+    }while(snapshot_retry(server, seq));
 
-    // Set answer code
-    message_set_answer(send_msg, CMD_OK);
+    add_value(var->data, recv_msg->payload + id_size(server), var->info.size);
+
+    hook_var(server, SLLP_OP_WRITE, var);
 }
 
-static void bin_op_var (sllp_server_t *server, struct message *recv_msg,
-                        struct message *send_msg)
+static void fetch_add_group (sllp_server_t *server, struct message *recv_msg,
+                             struct message *send_msg)
 {
-    // Check if body has at least two bytes (ID + binary operation)
-    if(recv_msg->payload_size < 2)
+    // Check if body has at least the ID
+    if(recv_msg->payload_size < id_size(server))
     {
         message_set_answer(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
         return;
     }
 
     // Check ID
-    uint8_t var_id = recv_msg->payload[0];
+    uint16_t group_id = get_id(server, recv_msg->payload);
 
-    if(var_id >= server->vars.count)
+    if(group_id >= server->groups.count)
     {
         message_set_answer(send_msg, CMD_ERR_INVALID_ID);
         return;
     }
 
-    // Get desired var
-    struct sllp_var *var = server->vars.list[var_id];
-
-    // Get operation
-    unsigned char operation = recv_msg->payload[1];
-
-    // Check operation
-    if(!bin_op[operation])
-    {
-        message_set_answer(send_msg, CMD_ERR_OP_NOT_SUPPORTED);
-        return;
-    }
+    // Get desired group
+    const struct server_group *grp = get_group(server, group_id);
 
     // Check payload size
-    if(recv_msg->payload_size != 2 + var->info.size)
+    if(recv_msg->payload_size != id_size(server) + grp->size)
     {
         message_set_answer(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
         return;
     }
 
     // Check write permission
-    if(!var->info.writable)
+    if(!grp->writable)
     {
         message_set_answer(send_msg, CMD_ERR_READ_ONLY);
         return;
     }
 
-    // Everything is OK, perform operation
-    bin_op[operation](var->data, recv_msg->payload + 2, var->info.size);
+    hook_group(server, SLLP_OP_READ, grp);
 
-    // Call hook
-    if(server->hook)
+    message_set_answer(send_msg, CMD_GROUP_READING);
+    send_msg->payload_size = grp->size;
+
+    uint32_t seq;
+    do
+    {
+        seq = snapshot_begin(server);
+        group_gather(server, grp, send_msg->payload);
+    }while(snapshot_retry(server, seq));
+
+    // Each variable is an integer of its own, with its own addend
+    const uint8_t *addend = recv_msg->payload + id_size(server);
+    unsigned int i;
+
+    for(i = 0; i < grp->vars.count; ++i)
     {
-        server->modified_list[0] = var;
-        server->modified_list[1] = NULL;
-        server->hook(SLLP_OP_WRITE, server->modified_list);
+        server_var_t *var = get_var(server, group_var_id(grp, i));
+        add_value(var->data, addend, var->info.size);
+        addend += var->info.size;
     }
 
-    // Set answer code
-    message_set_answer(send_msg, CMD_OK);
-    return;
+    hook_group(server, SLLP_OP_WRITE, grp);
 }
 
-static void write_group (sllp_server_t *server, struct message *recv_msg,
-                         struct message *send_msg)
+static void create_group (sllp_server_t *server, struct message *recv_msg,
+                          struct message *send_msg)
 {
-    // Check if body has at least one byte (ID)
-    if(recv_msg->payload_size < 1)
+    unsigned int count = recv_msg->payload_size / id_size(server);
+
+    // Check if there's at least one variable to put on the group
+    if(count < 1 || count > vars_count(server) ||
+       recv_msg->payload_size % id_size(server))
     {
         message_set_answer(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
         return;
     }
 
-    // Check ID
-    uint8_t group_id = recv_msg->payload[0];
+    // Check if there's available space for the new group
+    struct server_group *grp = group_new(server);
 
-    if(group_id >= server->groups.count)
+    if(!grp)
     {
-        message_set_answer(send_msg, CMD_ERR_INVALID_ID);
+        message_set_answer(send_msg, CMD_ERR_INSUFFICIENT_MEMORY);
         return;
     }
 
-    // Get desired group
-    struct server_group *grp = &server->groups.list[group_id];
+    // Populate group
+    unsigned int i;
+    for(i = 0; i < count; ++i)
+    {
+        // Check var ID
+        uint16_t var_id = get_id(server, recv_msg->payload + i*id_size(server));
 
-    // Check payload size
-    if(recv_msg->payload_size != 1 + grp->size)
+        if(var_id >= vars_count(server))
+        {
+            message_set_answer(send_msg, CMD_ERR_INVALID_ID);
+            return;
+        }
+
+        // Values of the group must fit a single message
+        server_var_t *var = get_var(server, var_id);
+
+        if(grp->size + var->info.size > max_group_size(server) ||
+           !group_add_var(server, grp, var))
+        {
+            message_set_answer(send_msg, CMD_ERR_INSUFFICIENT_MEMORY);
+            return;
+        }
+    }
+
+    // Group created
+    group_commit(server, grp);
+
+    // Prepare answer
+    message_set_answer(send_msg, CMD_OK);
+    return;
+}
+
+static void remove_groups (sllp_server_t *server, struct message *recv_msg,
+                           struct message *send_msg)
+{
+    if(recv_msg->payload_size != 0)
     {
         message_set_answer(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
         return;
     }
 
-    // Check write permission
-    if(!grp->writable)
+    groups_remove(server);
+    message_set_answer(send_msg, CMD_OK);
+}
+
+// Curve of the block a payload starts with (curve ID and block offset), or
+// NULL, with the error answered, if there's no such block.
+static struct sllp_curve *curve_of_block (sllp_server_t *server,
+                                          struct message *recv_msg,
+                                          struct message *send_msg)
+{
+    // Check curve ID
+    uint8_t curve_id = recv_msg->payload[0];
+
+    if(curve_id >= curves_count(server))
     {
-        message_set_answer(send_msg, CMD_ERR_READ_ONLY);
-        return;
+        message_set_answer(send_msg, CMD_ERR_INVALID_ID);
+        return NULL;
     }
 
-    // Everything is OK, iterate
-    struct sllp_var *var;
-    uint8_t *payloadp = recv_msg->payload + 1;
-    unsigned int i;
+    // Get curve
+    struct sllp_curve *curve = get_curve(server, curve_id);
 
-    for(i = 0; i < grp->vars.count; ++i)
+    uint8_t block_offset = recv_msg->payload[1];
+
+    if(block_offset > curve->info.nblocks)
     {
-        var = server->vars.list[grp->vars.list[i]->id];
-        memcpy(var->data, payloadp, var->info.size);
-        payloadp += var->info.size;
+        message_set_answer(send_msg, CMD_ERR_INVALID_VALUE);
+        return NULL;
     }
 
-    // Call hook
-    if(server->hook)
+    return curve;
+}
+
+static void request_curve_block (sllp_server_t *server,
+                                 struct message *recv_msg,
+                                 struct message *send_msg)
+{
+    // Check payload size
+    if(recv_msg->payload_size != 2)
     {
-        group_to_mod_list(server, grp);
-        server->hook(SLLP_OP_WRITE, server->modified_list);
+        message_set_answer(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
+        return;
     }
 
-    message_set_answer(send_msg, CMD_OK);
+    struct sllp_curve *curve = curve_of_block(server, recv_msg, send_msg);
+    if(!curve)
+        return;
+
+    uint8_t block_offset = recv_msg->payload[1];
+
+    message_set_answer(send_msg, CMD_CURVE_BLOCK);
+    send_msg->payload[0] = curve->info.id;
+    send_msg->payload[1] = block_offset;
+
+    curve->read_block(curve, block_offset, send_msg->payload + 2);
+    send_msg->payload_size = 2 + CURVE_BLOCK;
+
+    if(recv_msg->command_code != CMD_CURVE_TRANSMIT_COMPRESSED)
+        return;
+
+    // Compressed only if it shrinks, to a size the header of the client can
+    // tell. Otherwise the raw block goes.
+    uint8_t packed[CURVE_BLOCK];
+    size_t max = recv_msg->extended ? CURVE_BLOCK - 1 :
+                                      MAX_PAYLOAD_ENCODED - 1 - 2;
+    size_t size = deltarle_encode(send_msg->payload + 2, CURVE_BLOCK, packed,
+                                  max);
+
+    if(size)
+    {
+        message_set_answer(send_msg, CMD_CURVE_BLOCK_COMPRESSED);
+        memcpy(send_msg->payload + 2, packed, size);
+        send_msg->payload_size = 2 + size;
+    }
 }
 
-static void bin_op_group (sllp_server_t *server, struct message *recv_msg,
-                          struct message *send_msg)
+// Part of a curve: ID, offset (4 bytes) and length (2 bytes), most
+// significant first. The answer repeats ID and offset before the bytes.
+static void read_curve_range (sllp_server_t *server, struct message *recv_msg,
+                              struct message *send_msg)
 {
-    // Check if body has at least two bytes (ID + binary operation)
-    if(recv_msg->payload_size < 2)
+    if(recv_msg->payload_size != 7)
     {
         message_set_answer(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
         return;
     }
 
-    // Check ID
-    uint8_t group_id = recv_msg->payload[0];
+    // Check curve ID
+    uint8_t curve_id = recv_msg->payload[0];
 
-    if(group_id >= server->groups.count)
+    if(curve_id >= curves_count(server))
     {
         message_set_answer(send_msg, CMD_ERR_INVALID_ID);
         return;
     }
 
-    // Get desired group
-    struct server_group *grp = &server->groups.list[group_id];
+    struct sllp_curve *curve = get_curve(server, curve_id);
 
-    // Get operation
-    unsigned char operation = recv_msg->payload[1];
+    const uint8_t *p = recv_msg->payload + 1;
+    uint32_t offset = ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) |
+                      ((uint32_t) p[2] << 8)  |  (uint32_t) p[3];
+    uint32_t len = (p[4] << 8) | p[5];
+    uint32_t size = (curve->info.nblocks + 1)*CURVE_BLOCK;
 
-    // Check operation
-    if(!bin_op[operation])
+    if(!len || len > MAX_PAYLOAD - 5 || offset > size || len > size - offset)
     {
-        message_set_answer(send_msg, CMD_ERR_OP_NOT_SUPPORTED);
+        message_set_answer(send_msg, CMD_ERR_INVALID_VALUE);
         return;
     }
 
-    // Check payload size
-    if(recv_msg->payload_size != 2 + grp->size)
+    // Not worth reading what the header of the client can't tell
+    if(!recv_msg->extended && header_needs_extended(5 + len))
     {
-        message_set_answer(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
+        message_set_answer(send_msg, CMD_ERR_INSUFFICIENT_MEMORY);
         return;
     }
 
-    // Check write permission
-    if(!grp->writable)
+    message_set_answer(send_msg, CMD_CURVE_RANGE);
+    memcpy(send_msg->payload, recv_msg->payload, 5);
+    send_msg->payload_size = 5 + len;
+
+    uint8_t *data = send_msg->payload + 5;
+
+    if(curve->read_range)
     {
-        message_set_answer(send_msg, CMD_ERR_READ_ONLY);
+        curve->read_range(curve, offset, len, data);
         return;
     }
 
-    // Everything is OK, iterate
-    struct sllp_var *var;
-    uint8_t *payloadp = recv_msg->payload + 2;
+    uint8_t block[CURVE_BLOCK];
 
-    unsigned int i;
-    for(i = 0; i < grp->vars.count; ++i)
+    while(len)
     {
-        var = server->vars.list[grp->vars.list[i]->id];
-        bin_op[operation](var->data, payloadp, var->info.size);
-        payloadp += var->info.size;
-    }
+        uint32_t start = offset % CURVE_BLOCK;
+        uint32_t chunk = CURVE_BLOCK - start < len ? CURVE_BLOCK - start : len;
 
-    // Call hook
-    if(server->hook)
-    {
-        group_to_mod_list(server, grp);
-        server->hook(SLLP_OP_WRITE, server->modified_list);
+        curve->read_block(curve, offset / CURVE_BLOCK, block);
+        memcpy(data, block + start, chunk);
+
+        data += chunk;
+        offset += chunk;
+        len -= chunk;
     }
+}
 
+static void write_curve_block (sllp_server_t *server, struct sllp_curve *curve,
+                               uint8_t block_offset, uint8_t *data,
+                               struct message *send_msg)
+{
+    curve->write_block(curve, block_offset, data);
+    curve_block_written(server, curve->info.id, block_offset, data);
     message_set_answer(send_msg, CMD_OK);
 }
 
-static void create_group (sllp_server_t *server, struct message *recv_msg,
-                          struct message *send_msg)
+static void curve_block (sllp_server_t *server, struct message *recv_msg,
+                         struct message *send_msg)
 {
-    // Check if there's at least one variable to put on the group
-    if(recv_msg->payload_size < 1 ||
-       recv_msg->payload_size > server->vars.count)
+    if(recv_msg->payload_size != 2 + CURVE_BLOCK)
     {
         message_set_answer(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
         return;
     }
 
-    // Check if there's available space for the new group
-    if(server->groups.count == MAX_GROUPS)
+    struct sllp_curve *curve = curve_of_block(server, recv_msg, send_msg);
+    if(!curve)
+        return;
+
+    // Check write permission
+    if(!curve->info.writable)
     {
-        message_set_answer(send_msg, CMD_ERR_INSUFFICIENT_MEMORY);
+        message_set_answer(send_msg, CMD_ERR_READ_ONLY);
         return;
     }
 
-    struct server_group *grp = &server->groups.list[server->groups.count];
-
-    // Initialize group id
-    group_init(grp, server->groups.count);
+    write_curve_block(server, curve, recv_msg->payload[1],
+                      recv_msg->payload + 2, send_msg);
+}
 
-    // Populate group
-    int i;
-    for(i = 0; i < recv_msg->payload_size; ++i)
+static void curve_block_compressed (sllp_server_t *server,
+                                    struct message *recv_msg,
+                                    struct message *send_msg)
+{
+    if(recv_msg->payload_size < 2)
     {
-        // Check var ID
-        uint8_t var_id = recv_msg->payload[i];
-
-        if(var_id >= server->vars.count)
-        {
-            message_set_answer(send_msg, CMD_ERR_INVALID_ID);
-            return;
-        }
-
-        // Add var by ID
-        group_add_var(grp, server->vars.list[var_id]);
+        message_set_answer(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
+        return;
     }
 
-    // Group created
-    ++server->groups.count;
+    struct sllp_curve *curve = curve_of_block(server, recv_msg, send_msg);
+    if(!curve)
+        return;
+
+    // Check write permission
+    if(!curve->info.writable)
+    {
+        message_set_answer(send_msg, CMD_ERR_READ_ONLY);
+        return;
+    }
 
-    // Prepare answer
-    message_set_answer(send_msg, CMD_OK);
-    return;
-}
+    uint8_t block[CURVE_BLOCK];
 
-static void remove_groups (sllp_server_t *server, struct message *recv_msg,
-                           struct message *send_msg)
-{
-    if(recv_msg->payload_size != 0)
+    if(!deltarle_decode(recv_msg->payload + 2, recv_msg->payload_size - 2,
+                        block, CURVE_BLOCK))
     {
-        message_set_answer(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
+        message_set_answer(send_msg, CMD_ERR_INVALID_VALUE);
         return;
     }
 
-    server->groups.count = GROUP_STANDARD_COUNT;
-    message_set_answer(send_msg, CMD_OK);
+    write_curve_block(server, curve, recv_msg->payload[1], block, send_msg);
 }
 
-static void request_curve_block (sllp_server_t *server,
-                                 struct message *recv_msg,
-                                 struct message *send_msg)
+// The curve ID, optionally followed by the checksum mode. Without one, the MD5
+// checksum goes to the curves list. With one, the checksum is answered, so
+// clients using different modes don't disturb each other. MD5 ones still go
+// to the curves list too.
+static void recalc_curve_csum (sllp_server_t *server, struct message *recv_msg,
+                               struct message *send_msg)
 {
-    // Check payload size
-    if(recv_msg->payload_size != 2)
+    if(recv_msg->payload_size != 1 && recv_msg->payload_size != 2)
     {
         message_set_answer(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
         return;
@@ -692,97 +2227,166 @@ static void request_curve_block (sllp_server_t *server,
     // Check curve ID
     uint8_t curve_id = recv_msg->payload[0];
 
-    if(curve_id >= server->curves.count)
+    if(curve_id >= curves_count(server))
     {
         message_set_answer(send_msg, CMD_ERR_INVALID_ID);
         return;
     }
 
-    // Get curve
-    struct sllp_curve *curve = server->curves.list[curve_id];
-
-    uint8_t block_offset = recv_msg->payload[1];
+    // Check mode
+    uint8_t mode = recv_msg->payload_size == 2 ? recv_msg->payload[1] :
+                                                 SLLP_CHECKSUM_MD5;
 
-    if(block_offset > curve->info.nblocks)
+    if(mode >= SLLP_CHECKSUM_MAX)
     {
         message_set_answer(send_msg, CMD_ERR_INVALID_VALUE);
         return;
     }
 
-    message_set_answer(send_msg, CMD_CURVE_BLOCK);
-    send_msg->payload[0] = curve->info.id;
-    send_msg->payload[1] = block_offset;
+    // Calculate checksum
+    uint8_t checksum[CURVE_CSUM_SIZE];
 
-    curve->read_block(curve, block_offset, send_msg->payload + 2);
-    send_msg->payload_size = 2 + CURVE_BLOCK;
+    if(!curve_checksum(server, curve_id, mode, checksum))
+    {
+        message_set_answer(send_msg, CMD_ERR_INSUFFICIENT_MEMORY);
+        return;
+    }
+
+    if(mode == SLLP_CHECKSUM_MD5)
+        memcpy(get_curve(server, curve_id)->info.checksum, checksum,
+               CURVE_CSUM_SIZE);
+
+    if(recv_msg->payload_size == 1)
+    {
+        message_set_answer(send_msg, CMD_OK);
+        return;
+    }
+
+    message_set_answer(send_msg, CMD_CURVE_CSUM);
+    memcpy(send_msg->payload, checksum, CURVE_CSUM_SIZE);
+    send_msg->payload_size = CURVE_CSUM_SIZE;
 }
 
-static void curve_block (sllp_server_t *server, struct message *recv_msg,
-                         struct message *send_msg)
+// Subscriptions, common to both builds
+
+static struct subscription *find_subscription (sllp_server_t *server,
+                                               uint16_t var_id)
 {
-    if(recv_msg->payload_size != 2 + CURVE_BLOCK)
+    unsigned int i;
+    for(i = 0; i < server->subs.count; ++i)
+        if(server->subs.list[i].id == var_id)
+            return &server->subs.list[i];
+    return NULL;
+}
+
+static void remove_subscription (sllp_server_t *server,
+                                 struct subscription *sub)
+{
+    *sub = server->subs.list[--server->subs.count];
+}
+
+// Whether value differs from the last one notified by more than the deadband.
+// Only integers of 1, 2, 4 or 8 bytes, in the byte order of the device, have a
+// magnitude; other variables are notified on any change.
+static bool value_changed (const struct subscription *sub,
+                           const uint8_t *value, uint8_t size)
+{
+    if(!memcmp(sub->sent, value, size))
+        return false;
+
+    if(!sub->deadband)
+        return true;
+
+    int64_t a, b;
+
+    switch(size)
+    {
+    case 1: { int8_t x, y;  memcpy(&x, value, 1); memcpy(&y, sub->sent, 1);
+              a = x; b = y; break; }
+    case 2: { int16_t x, y; memcpy(&x, value, 2); memcpy(&y, sub->sent, 2);
+              a = x; b = y; break; }
+    case 4: { int32_t x, y; memcpy(&x, value, 4); memcpy(&y, sub->sent, 4);
+              a = x; b = y; break; }
+    case 8: memcpy(&a, value, 8); memcpy(&b, sub->sent, 8); break;
+    default: return true;
+    }
+
+    uint64_t diff = a > b ? (uint64_t) a - (uint64_t) b :
+                            (uint64_t) b - (uint64_t) a;
+
+    return diff > sub->deadband;
+}
+
+static void subscribe (sllp_server_t *server, struct message *recv_msg,
+                       struct message *send_msg)
+{
+    // ID, interval (2 bytes) and deadband (4 bytes), most significant first
+    if(recv_msg->payload_size != id_size(server) + 6)
     {
         message_set_answer(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
         return;
     }
 
-    // Check curve ID
-    uint8_t curve_id = recv_msg->payload[0];
+    uint16_t var_id = get_id(server, recv_msg->payload);
 
-    if(curve_id >= server->curves.count)
+    if(var_id >= vars_count(server))
     {
         message_set_answer(send_msg, CMD_ERR_INVALID_ID);
         return;
     }
 
-    // Get curve
-    struct sllp_curve *curve = server->curves.list[curve_id];
+    const uint8_t *p = recv_msg->payload + id_size(server);
 
-    uint8_t block_offset = recv_msg->payload[1];
-    if(block_offset > curve->info.nblocks)
+    // Subscribing again changes the parameters
+    struct subscription *sub = find_subscription(server, var_id);
+
+    if(!sub)
     {
-        message_set_answer(send_msg, CMD_ERR_INVALID_VALUE);
-        return;
+        if(!subs_reserve(server))
+        {
+            message_set_answer(send_msg, CMD_ERR_INSUFFICIENT_MEMORY);
+            return;
+        }
+        sub = &server->subs.list[server->subs.count++];
     }
-    curve->write_block(curve, block_offset, recv_msg->payload + 2);
+
+    sub->id = var_id;
+    sub->fresh = true;
+    sub->interval = (p[0] << 8) | p[1];
+    sub->deadband = ((uint32_t) p[2] << 24) | ((uint32_t) p[3] << 16) |
+                    ((uint32_t) p[4] << 8)  |  (uint32_t) p[5];
+
     message_set_answer(send_msg, CMD_OK);
 }
 
-static void recalc_curve_csum (sllp_server_t *server, struct message *recv_msg,
-                               struct message *send_msg)
+static void unsubscribe (sllp_server_t *server, struct message *recv_msg,
+                         struct message *send_msg)
 {
-    if(recv_msg->payload_size != 1)
+    // Without an ID, every subscription goes
+    if(!recv_msg->payload_size)
     {
-        message_set_answer(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
+        server->subs.count = 0;
+        message_set_answer(send_msg, CMD_OK);
         return;
     }
 
-    // Check curve ID
-    uint8_t curve_id = recv_msg->payload[0];
-
-    if(curve_id >= server->curves.count)
+    if(recv_msg->payload_size != id_size(server))
     {
-        message_set_answer(send_msg, CMD_ERR_INVALID_ID);
+        message_set_answer(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
         return;
     }
 
-    // Get curve
-    struct sllp_curve *curve = server->curves.list[curve_id];
-
-    // Calculate checksum (this might take a while)
-    unsigned int nblocks = curve->info.nblocks + 1;
-    uint8_t block[CURVE_BLOCK];
-    MD5_CTX md5ctx;
-
-    MD5Init(&md5ctx);
+    uint16_t var_id = get_id(server, recv_msg->payload);
 
-    unsigned int i;
-    for(i = 0; i < nblocks; ++i)
+    if(var_id >= vars_count(server))
     {
-        curve->read_block(curve, (uint8_t)i, block);
-        MD5Update(&md5ctx, block, CURVE_BLOCK);
+        message_set_answer(send_msg, CMD_ERR_INVALID_ID);
+        return;
     }
-    MD5Final(curve->info.checksum, &md5ctx);
+
+    struct subscription *sub = find_subscription(server, var_id);
+    if(sub)
+        remove_subscription(server, sub);
 
     message_set_answer(send_msg, CMD_OK);
 }
@@ -796,11 +2400,16 @@ static void message_set_answer (struct message *msg, enum command_code code)
 
 // Process packet infrastructure
 
+static void batch (sllp_server_t *server, struct message *recv_msg,
+                   struct message *send_msg);
+
 typedef void (*command_function) (sllp_server_t *server,
                                   struct message *recv_msg,
                                   struct message *send_msg);
 
 static command_function command[256] = {
+    [CMD_QUERY_STATS]           = query_stats,
+    [CMD_QUERY_CAPS]            = query_caps,
     [CMD_QUERY_VARS_LIST]       = query_vars_list,
     [CMD_QUERY_GROUPS_LIST]     = query_groups_list,
     [CMD_QUERY_GROUP]           = query_group,
@@ -811,81 +2420,444 @@ static command_function command[256] = {
     [CMD_WRITE_GROUP]           = write_group,
     [CMD_BIN_OP_VAR]            = bin_op_var,
     [CMD_BIN_OP_GROUP]          = bin_op_group,
+    [CMD_CAS_VAR]               = cas_var,
+    [CMD_CAS_GROUP]             = cas_group,
+    [CMD_FETCH_ADD_VAR]         = fetch_add_var,
+    [CMD_FETCH_ADD_GROUP]       = fetch_add_group,
     [CMD_CREATE_GROUP]          = create_group,
     [CMD_REMOVE_ALL_GROUPS]     = remove_groups,
     [CMD_CURVE_TRANSMIT]        = request_curve_block,
     [CMD_CURVE_BLOCK]           = curve_block,
-    [CMD_CURVE_RECALC_CSUM]     = recalc_curve_csum
+    [CMD_CURVE_RECALC_CSUM]     = recalc_curve_csum,
+    [CMD_CURVE_TRANSMIT_COMPRESSED] = request_curve_block,
+    [CMD_CURVE_BLOCK_COMPRESSED]    = curve_block_compressed,
+    [CMD_CURVE_READ_RANGE]      = read_curve_range,
+    [CMD_SUBSCRIBE]             = subscribe,
+    [CMD_UNSUBSCRIBE]           = unsubscribe,
+    [CMD_BATCH]                 = batch
 };
 
-enum sllp_err sllp_process_packet (sllp_server_t *server,
-                                    struct sllp_raw_packet *request,
-                                    struct sllp_raw_packet *response)
+// Answer the message in request, len bytes long, in response. Returns the
+// length of the answer.
+static uint16_t answer (sllp_server_t *server, uint8_t *request, uint32_t len,
+                        uint8_t *response)
 {
-    if(!server || !request || !response)
-        return SLLP_ERR_PARAM_INVALID;
-
     // Interpret packet payload as a message
-    struct raw_message *recv_raw_msg = (struct raw_message *) request->data;
-    struct raw_message *send_raw_msg = (struct raw_message *) response->data;
+    struct raw_message *send_raw_msg = (struct raw_message *) response;
 
     // Create proper messages from the raw messages
     struct message recv_msg, send_msg;
 
-    recv_msg.command_code = (enum command_code) recv_raw_msg->command_code;
-    recv_msg.payload      = recv_raw_msg->payload;
+    // Decode received header. Extended ones are answered in kind.
+    uint8_t code = 0;
+    uint32_t size = 0;
+    unsigned int header = header_decode(request, len, &code, &size);
+    bool extended = header && request[0] == EXTENDED_FRAME;
 
-    // Decode received payload size
-    if(recv_raw_msg->encoded_size == MAX_PAYLOAD_ENCODED)
-        recv_msg.payload_size = MAX_PAYLOAD;
-    else
-        recv_msg.payload_size = recv_raw_msg->encoded_size;
+    recv_msg.command_code = (enum command_code) code;
+    recv_msg.payload      = request + header;
+    recv_msg.payload_size = size;
+    recv_msg.extended     = extended;
 
     send_msg.payload = send_raw_msg->payload;
 
-    server->modified_list[0] = NULL;
-
     // Check inconsistency between the size of the received data and the size
     // specified in the message header
-    if(request->len < SLLP_HEADER_SIZE ||
-       request->len != recv_msg.payload_size + SLLP_HEADER_SIZE)
+    if(!header || len != header + size)
+    {
         message_set_answer(&send_msg, CMD_ERR_MALFORMED_MESSAGE);
-
+        ++server->stats.malformed;
+    }
     // Check existence of the requested command
     else if(!command[recv_msg.command_code])
+    {
         message_set_answer(&send_msg, CMD_ERR_OP_NOT_SUPPORTED);
+        ++server->stats.unsupported;
+    }
     else
+    {
+        struct sllp_command_stats *stats =
+                &server->stats.command[recv_msg.command_code];
+        uint32_t start = server->clock ? server->clock() : 0;
+
         command[recv_msg.command_code](server, &recv_msg, &send_msg);
 
-    send_raw_msg->command_code = send_msg.command_code;
+        ++stats->count;
+        if(server->clock)
+            stats->time += server->clock() - start;
+    }
 
-    if(send_msg.payload_size == MAX_PAYLOAD)
-        send_raw_msg->encoded_size = MAX_PAYLOAD_ENCODED;
-    else
-        send_raw_msg->encoded_size = send_msg.payload_size;
-    response->len = send_msg.payload_size + 2;
+    // Payloads are either MAX_PAYLOAD long or short enough for the size byte,
+    // unless the client reads extended headers. Those make room for themselves.
+    if(!header_needs_extended(send_msg.payload_size))
+        extended = false;
+    else if(!extended)
+        message_set_answer(&send_msg, CMD_ERR_INSUFFICIENT_MEMORY);
+
+    header = header_size(send_msg.payload_size, extended);
+
+    if(header != HEADER_SIZE)
+        memmove(response + header, send_msg.payload, send_msg.payload_size);
+
+    header_encode(response, send_msg.command_code, send_msg.payload_size,
+                  extended);
+
+    return header + send_msg.payload_size;
+}
+
+enum sllp_err sllp_process_packet (sllp_server_t *server,
+                                    struct sllp_raw_packet *request,
+                                    struct sllp_raw_packet *response)
+{
+    if(!server || !request || !response)
+        return SLLP_ERR_PARAM_INVALID;
+
+    response->len = answer(server, request->data, request->len,
+                           response->data);
 
     return SLLP_SUCCESS;
 }
 
-static void group_init (struct server_group *grp, uint8_t id)
+// Requests, each with its own header, answered in order with their answers
+// one after the other. Their framing is checked before any is executed, and
+// execution stops at the first answer that doesn't fit, so the requests
+// answered are exactly the ones executed: a request is left out before running
+// if as many bytes as it takes don't fit, which is all the room the answer of
+// a request that changes anything needs. Answers of reads may be longer, and
+// are dropped after running if they don't fit, which changes nothing.
+static void batch (sllp_server_t *server, struct message *recv_msg,
+                   struct message *send_msg)
 {
-    memset(grp, 0, sizeof(*grp));
-    grp->id = id;
-    grp->writable = true;
+    uint8_t *p = recv_msg->payload;
+    uint8_t *end = recv_msg->payload + recv_msg->payload_size;
+    uint8_t code;
+    uint32_t size = 0;
+    unsigned int header;
+
+    for(; p < end; p += header + size)
+    {
+        header = header_decode(p, end - p, &code, &size);
+
+        if(!header || size > (uint32_t)(end - p) - header)
+        {
+            message_set_answer(send_msg, CMD_ERR_MALFORMED_MESSAGE);
+            return;
+        }
+
+        // No batches within batches
+        if(code == CMD_BATCH)
+        {
+            message_set_answer(send_msg, CMD_ERR_OP_NOT_SUPPORTED);
+            return;
+        }
+    }
+
+    // Each answer is built aside, as it may be as large as a whole message
+    uint8_t *scratch = batch_buffer(server);
+
+    if(!scratch)
+    {
+        message_set_answer(send_msg, CMD_ERR_INSUFFICIENT_MEMORY);
+        return;
+    }
+
+    uint32_t limit = recv_msg->extended ? MAX_PAYLOAD : MAX_PAYLOAD_ENCODED - 1;
+
+    message_set_answer(send_msg, CMD_BATCH_REPLY);
+
+    for(p = recv_msg->payload; p < end; p += header + size)
+    {
+        header = header_decode(p, end - p, &code, &size);
+
+        if(send_msg->payload_size + header + size > limit)
+            break;
+
+        uint16_t len = answer(server, p, header + size, scratch);
+
+        if(send_msg->payload_size + len > limit)
+            break;
+
+        memcpy(send_msg->payload + send_msg->payload_size, scratch, len);
+        send_msg->payload_size += len;
+    }
 }
 
-static void group_add_var (struct server_group *grp, struct sllp_var *var)
+// Frames
+
+// Length of the packet starting at data, of which len bytes are at hand, or 0
+// until its header is complete. A header with a size too large is a packet by
+// itself, for sllp_process_packet to reject.
+static inline size_t packet_length (const uint8_t *data, size_t len)
 {
-    grp->vars.list[grp->vars.count++] = &var->info;
-    grp->size += var->info.size;
-    grp->writable &= var->info.writable;
+    uint8_t code;
+    uint32_t size;
+    unsigned int header = header_decode(data, len, &code, &size);
+
+    if(!header)
+        return 0;
+
+    return header + (size > MAX_PAYLOAD ? 0 : size);
 }
 
-static void group_to_mod_list (sllp_server_t *server, struct server_group *grp)
+// Bytes announced by a complete packet of len bytes that didn't come with it:
+// the payload of an oversized packet, or UINT32_MAX if its header ran out of
+// size bytes before the size did.
+static uint32_t packet_excess (const uint8_t *data, size_t len)
 {
+    uint8_t code;
+    uint32_t size = 0;
     unsigned int i;
-    for(i = 0; i < grp->vars.count; ++i)
-        server->modified_list[i] = server->vars.list[grp->vars.list[i]->id];
-    server->modified_list[i] = NULL;
+
+    if(!header_decode(data, len, &code, &size) || size <= MAX_PAYLOAD)
+        return 0;
+
+    if(data[len - 1] & 0x80)
+        return UINT32_MAX;
+
+    // header_decode only tells it's too large
+    size = 0;
+    for(i = HEADER_SIZE; i < len; ++i)
+        size |= (uint32_t)(data[i] & 0x7F) << 7*(i - HEADER_SIZE);
+
+    return size;
+}
+
+void sllp_decoder_init (struct sllp_decoder *decoder)
+{
+    if(decoder)
+    {
+        decoder->len = 0;
+        decoder->skip = 0;
+    }
+}
+
+size_t sllp_decoder_feed (struct sllp_decoder *decoder, uint8_t *data,
+                          size_t len, struct sllp_raw_packet *packet)
+{
+    size_t used = 0;
+
+    packet->data = NULL;
+    packet->len = 0;
+
+    // The rest of an oversized packet, dropped as it comes
+    if(decoder->skip)
+    {
+        used = decoder->skip < len ? decoder->skip : len;
+
+        if(decoder->skip != UINT32_MAX)
+            decoder->skip -= used;
+
+        if(decoder->skip)
+            return used;
+    }
+
+    // Whole packet at hand, use it where it is
+    size_t want = decoder->len ? 0 : packet_length(data + used, len - used);
+
+    if(want && len - used >= want)
+    {
+        packet->data = data + used;
+        packet->len = want;
+        decoder->skip = packet_excess(packet->data, want);
+        return used + want;
+    }
+
+    while(used < len)
+    {
+        // First the header, which tells how much more to wait for. Extended
+        // headers end with the first size byte without the high bit.
+        want = packet_length(decoder->buffer, decoder->len);
+
+        size_t take;
+
+        if(want)
+            take = want - decoder->len;
+        else if(decoder->len < HEADER_SIZE)
+            take = HEADER_SIZE - decoder->len;
+        else
+            take = 1;
+
+        if(take > len - used)
+            take = len - used;
+
+        memcpy(decoder->buffer + decoder->len, data + used, take);
+        decoder->len += take;
+        used += take;
+
+        if(decoder->len == packet_length(decoder->buffer, decoder->len))
+        {
+            packet->data = decoder->buffer;
+            packet->len = decoder->len;
+            decoder->skip = packet_excess(packet->data, packet->len);
+            decoder->len = 0;
+            break;
+        }
+    }
+
+    return used;
+}
+
+// Notifications
+
+enum sllp_err sllp_server_notify (sllp_server_t *server, uint32_t now,
+                                  struct sllp_raw_packet *notification)
+{
+    if(!server || !notification || !notification->data)
+        return SLLP_ERR_PARAM_INVALID;
+
+    struct raw_message *msg = (struct raw_message *) notification->data;
+    uint8_t *payloadp = msg->payload;
+    uint8_t *end = msg->payload + NOTIFY_MAX_PAYLOAD;
+
+    notification->len = 0;
+
+    // Start where the last notification stopped, so every subscription gets
+    // its turn when they don't all fit
+    uint32_t n;
+    for(n = 0; n < server->subs.count; ++n, ++server->subs.next)
+    {
+        if(server->subs.next >= server->subs.count)
+            server->subs.next = 0;
+
+        struct subscription *sub = &server->subs.list[server->subs.next];
+        server_var_t *var = get_var(server, sub->id);
+
+        if(payloadp + id_size(server) + var->info.size > end)
+            break;
+
+        // Changes within the interval wait for its end
+        if(!sub->fresh && (uint32_t)(now - sub->sent_at) < sub->interval)
+            continue;
+
+        uint8_t *value = put_id(server, payloadp, sub->id);
+
+        uint32_t seq;
+        do
+        {
+            seq = snapshot_begin(server);
+            memcpy(value, var->data, var->info.size);
+        }while(snapshot_retry(server, seq));
+
+        if(!sub->fresh && !value_changed(sub, value, var->info.size))
+            continue;
+
+        memcpy(sub->sent, value, var->info.size);
+        sub->sent_at = now;
+        sub->fresh = false;
+
+        payloadp = value + var->info.size;
+    }
+
+    if(payloadp == msg->payload)
+        return SLLP_SUCCESS;
+
+    msg->command_code = CMD_NOTIFY;
+    msg->encoded_size = payloadp - msg->payload;
+    notification->len = HEADER_SIZE + msg->encoded_size;
+
+    return SLLP_SUCCESS;
+}
+
+// Ring buffer curves
+
+static void ring_read_block (struct sllp_curve *curve, uint8_t block,
+                             uint8_t *data)
+{
+    struct sllp_ring *ring = (struct sllp_ring *) curve;
+    memcpy(data, ring->buffer + block*CURVE_BLOCK, CURVE_BLOCK);
+}
+
+static void ring_read_range (struct sllp_curve *curve, uint32_t offset,
+                             uint16_t len, uint8_t *data)
+{
+    struct sllp_ring *ring = (struct sllp_ring *) curve;
+    memcpy(data, ring->buffer + offset, len);
+}
+
+enum sllp_err sllp_ring_init (struct sllp_ring *ring,
+                              struct sllp_var *const *vars, uint8_t count,
+                              uint8_t *buffer, uint8_t nblocks,
+                              uint16_t period)
+{
+    if(!ring || !vars || !count || !buffer)
+        return SLLP_ERR_PARAM_INVALID;
+
+    unsigned int sample_size = 0;
+    unsigned int i;
+    for(i = 0; i < count; ++i)
+    {
+        if(!vars[i] || !vars[i]->data)
+            return SLLP_ERR_PARAM_INVALID;
+        sample_size += vars[i]->info.size;
+    }
+
+    if(sample_size > CURVE_BLOCK)
+        return SLLP_ERR_PARAM_OUT_OF_RANGE;
+
+    memset(buffer, 0, (nblocks + 1)*CURVE_BLOCK);
+
+    ring->curve.info.writable = false;
+    ring->curve.info.nblocks = nblocks;
+    ring->curve.read_block = ring_read_block;
+    ring->curve.write_block = NULL;
+    ring->curve.read_range = ring_read_range;
+
+    ring->index = 0;
+    ring->index_var.info.writable = false;
+    ring->index_var.info.size = sizeof(ring->index);
+    ring->index_var.data = (uint8_t *) &ring->index;
+
+    ring->vars = vars;
+    ring->count = count;
+    ring->buffer = buffer;
+    ring->sample_size = sample_size;
+    ring->per_block = CURVE_BLOCK/sample_size;
+    ring->capacity = ring->per_block*(nblocks + 1);
+    ring->period = period;
+    ring->started = false;
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_ring_sample (sllp_server_t *server, struct sllp_ring *ring,
+                                uint32_t now)
+{
+    if(!server || !ring || !ring->buffer)
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(ring->started && (int32_t)(now - ring->next_at) < 0)
+        return SLLP_SUCCESS;
+
+    // Late calls don't make up for the samples missed
+    ring->next_at = ring->started && (int32_t)(now - ring->next_at) <
+                                     ring->period ?
+                    ring->next_at + ring->period : now + ring->period;
+    ring->started = true;
+
+    uint32_t slot = ring->index % ring->capacity;
+    unsigned int block = slot/ring->per_block;
+    uint8_t *sample = ring->buffer + block*CURVE_BLOCK +
+                      (slot % ring->per_block)*ring->sample_size;
+
+    uint32_t seq;
+    do
+    {
+        seq = snapshot_begin(server);
+
+        uint8_t *p = sample;
+        unsigned int i;
+        for(i = 0; i < ring->count; ++i)
+        {
+            memcpy(p, ring->vars[i]->data, ring->vars[i]->info.size);
+            p += ring->vars[i]->info.size;
+        }
+    }while(snapshot_retry(server, seq));
+
+    ++ring->index;
+
+    uint8_t id = ring->curve.info.id;
+    if(id < curves_count(server) && get_curve(server, id) == &ring->curve)
+        curve_forget_checksum(server, id);
+
+    return SLLP_SUCCESS;
 }
@@ -3,20 +3,28 @@
 
 #include "sllp.h"
 
+#include <stddef.h>
+
 // Types
 
 // Handle to a server instance
 typedef struct sllp_server sllp_server_t;
 
-// Hook function. Called before the values of a set of variables are read and
-// after values of a set of variables are written.
+// Hook function. Called for each variable before its value is read and after
+// its value is written. Variables of static servers are constant (see
+// sllp_server_static.h), hence the const.
 enum sllp_operation
 {
     SLLP_OP_READ,                   // Read command arrived
     SLLP_OP_WRITE,                  // Write command arrived
 };
 
-typedef void (*sllp_hook_t) (enum sllp_operation op, struct sllp_var **list);
+typedef void (*sllp_hook_t) (enum sllp_operation op,
+                             const struct sllp_var *var);
+
+// Clock used to time the handling of requests (see sllp_register_clock). Any
+// unit will do, e.g. CPU cycles, as long as it wraps around at 2^32.
+typedef uint32_t (*sllp_clock_t) (void);
 
 // Structures
 
@@ -27,10 +35,36 @@ struct sllp_raw_packet
     uint16_t len;
 };
 
+// Sequence lock the application wraps its updates of variables with, so that
+// the server copies them in a consistent state (see sllp_register_seqlock)
+struct sllp_seqlock
+{
+    uint32_t seq;                   // Odd while an update is in progress
+};
+
+#define SLLP_SEQLOCK_INITIALIZER    {0}
+
+// Call before changing the values of registered variables
+static inline void sllp_seqlock_write_begin (struct sllp_seqlock *lock)
+{
+    __atomic_store_n(&lock->seq, lock->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+// Call once the new values are in place
+static inline void sllp_seqlock_write_end (struct sllp_seqlock *lock)
+{
+    __atomic_store_n(&lock->seq, lock->seq + 1, __ATOMIC_RELEASE);
+}
+
 /**
  * Allocate a new server instance, returning a handle to it. This instance
  * should be deallocated with sllp_destroy after its use.
  *
+ * With SLLP_SERVER_STATIC there's a single, statically allocated, instance
+ * serving the variables and curves of sllp_server_config.h. This function
+ * resets it and returns its handle, and sllp_server_destroy does nothing.
+ *
  * @return A handle to a server or NULL if there wasn't enough memory to do the
  *         allocation.
  */
@@ -48,6 +82,28 @@ sllp_server_t *sllp_server_new (void);
  */
 enum sllp_err sllp_server_destroy (sllp_server_t *server);
 
+#ifndef SLLP_SERVER_STATIC
+
+/**
+ * Switch a server instance to two byte IDs (most significant byte first) for
+ * variables and groups, advertised to clients as CAP_WIDE_IDS. This raises the
+ * limit of registered variables and of groups from 254 to SLLP_MAX_PAYLOAD,
+ * one entry per byte of the variables and groups lists. Curve IDs keep a
+ * single byte.
+ *
+ * Must be called before any variable is registered or group created.
+ *
+ * @param server [input] Handle to the instance.
+ * @param enable [input] Whether IDs take two bytes.
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li> SLLP_ERR_PARAM_INVALID: server is a NULL pointer or already has
+ *                                variables or groups. </li>
+ * </ul>
+ */
+enum sllp_err sllp_server_wide_ids (sllp_server_t *server, bool enable);
+
 /**
  * Register a variable with a server instance. The memory pointed by the var
  * parameter must remain valid throughout the entire lifespan of the server
@@ -58,6 +114,10 @@ enum sllp_err sllp_server_destroy (sllp_server_t *server);
  *
  * The user field is untouched.
  *
+ * Groups copy the values of consecutive variables whose data are adjacent in
+ * memory at once, so registering the fields of a struct in order makes group
+ * reads and writes cheaper.
+ *
  * @param server [input] Handle to the instance.
  * @param var [input] Structure describing the variable to be registered.
  *
@@ -66,6 +126,9 @@ enum sllp_err sllp_server_destroy (sllp_server_t *server);
  *   <li> SLLP_ERR_PARAM_INVALID: server, data or id is a NULL pointer. </li>
  *   <li> SLLP_PARAM_OUT_OF_RANGE: size is less than SLLP_VAR_SIZE_MIN or
  *                                 greater than SLLP_VAR_SIZE_MAX. </li>
+ *   <li> SLLP_ERR_OUT_OF_MEMORY: the ID space is exhausted, the values of all
+ *                                variables would no longer fit a message or
+ *                                the registry couldn't grow. </li>
  * </ul>
  */
 enum sllp_err sllp_register_variable (sllp_server_t *server,
@@ -102,6 +165,31 @@ enum sllp_err sllp_register_variable (sllp_server_t *server,
 enum sllp_err sllp_register_curve (sllp_server_t *server,
                                    struct sllp_curve *curve);
 
+#endif  /* SLLP_SERVER_STATIC */
+
+/**
+ * Tell the server that the application changed a block of a curve by itself.
+ *
+ * The server keeps a digest of every block, updated as clients write them, so
+ * that a checksum request doesn't have to read the whole curve. Blocks changed
+ * behind its back must be reported with this function before the next
+ * checksum request, which costs one read of the block.
+ *
+ * @param server [input] Handle to the server instance.
+ * @param curve [input] A curve registered with the server.
+ * @param block [input] The block that changed, from 0 to curve->nblocks.
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: server or curve is a NULL pointer, or the
+ *                               curve is not registered with the server.</li>
+ *   <li>SLLP_ERR_PARAM_OUT_OF_RANGE: block is greater than nblocks.</li>
+ * </ul>
+ */
+enum sllp_err sllp_curve_block_changed (sllp_server_t *server,
+                                        struct sllp_curve *curve,
+                                        uint8_t block);
+
 /**
  * Register a function that will be called in two moments:
  *
@@ -118,7 +206,8 @@ enum sllp_err sllp_register_curve (sllp_server_t *server,
  *
  * A hook function receives two parameters: the first one indicating the type
  * of operation being performed (specified in enum sllp_operation) and the
- * second one containing the list of variables being affected by that operation.
+ * second one the variable affected by that operation. Commands on groups call
+ * it once for each variable of the group, in order.
  *
  * @param server [input] Handle to a SLLP instance.
  * @param hook [input] Hook function
@@ -130,6 +219,71 @@ enum sllp_err sllp_register_curve (sllp_server_t *server,
  */
 enum sllp_err sllp_register_hook (sllp_server_t *server, sllp_hook_t hook);
 
+/**
+ * Register the sequence lock the application updates variables under. Reads of
+ * variables and groups then copy the values again whenever an update happened
+ * while they were being copied, so a group read never mixes old and new values
+ * and the application never waits for the server.
+ *
+ * Updates must not run concurrently with each other, and the server must not
+ * preempt an update in progress (e.g. by running in an interrupt that may
+ * arrive in the middle of one), or it would wait forever for it to end.
+ * Writes done by the server itself are not covered.
+ *
+ * @param server [input] Handle to a SLLP instance.
+ * @param lock [input] The lock, or NULL to copy values without it
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li> SLLP_ERR_INVALID_PARAM: server is a NULL pointer.
+ * </ul>
+ */
+enum sllp_err sllp_register_seqlock (sllp_server_t *server,
+                                     struct sllp_seqlock *lock);
+
+/**
+ * Register the clock that times the handling of each command, kept in the
+ * server's statistics along with how many requests of each command arrived.
+ * Without a clock, only the requests are counted.
+ *
+ * @param server [input] Handle to a SLLP instance.
+ * @param clock [input] The clock, or NULL to stop timing
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li> SLLP_ERR_INVALID_PARAM: server is a NULL pointer.
+ * </ul>
+ */
+enum sllp_err sllp_register_clock (sllp_server_t *server, sllp_clock_t clock);
+
+/**
+ * Copy the statistics of a server: requests and handling time by command,
+ * plus malformed and unsupported requests. Clients get them with
+ * CMD_QUERY_STATS.
+ *
+ * @param server [input] Handle to a SLLP instance.
+ * @param stats [output] The statistics
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li> SLLP_ERR_INVALID_PARAM: server or stats is a NULL pointer.
+ * </ul>
+ */
+enum sllp_err sllp_server_stats (sllp_server_t *server,
+                                 struct sllp_stats *stats);
+
+/**
+ * Zero the statistics of a server.
+ *
+ * @param server [input] Handle to a SLLP instance.
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li> SLLP_ERR_INVALID_PARAM: server is a NULL pointer.
+ * </ul>
+ */
+enum sllp_err sllp_server_reset_stats (sllp_server_t *server);
+
 /**
  * Process a received message and prepare an answer.
  *
@@ -147,5 +301,155 @@ enum sllp_err sllp_process_packet (sllp_server_t *server,
                                    struct sllp_raw_packet *request,
                                    struct sllp_raw_packet *response);
 
-#endif
+/**
+ * Prepare a notification of the subscribed variables that changed, to be sent
+ * to the client unprompted, between responses. Clients subscribe to a variable
+ * with CMD_SUBSCRIBE, giving the least interval between notifications of it
+ * and a deadband: for variables of 1, 2, 4 or 8 bytes, read as signed integers
+ * in the byte order of the device, changes up to the deadband are ignored.
+ * Other variables are notified on any change. The value at the time of
+ * subscribing is always notified.
+ *
+ * The notification is a CMD_NOTIFY message holding the ID and the value of
+ * each variable. When they don't all fit, the next call starts with those left
+ * out. Subscriptions belong to the server, so every client of a server shares
+ * them. The hook is not called.
+ *
+ * Should be called periodically, e.g. from the main loop, with a millisecond
+ * clock that may wrap around.
+ *
+ * @param server [input] Handle to a server instance.
+ * @param now [input] Current time, in milliseconds
+ * @param notification [output] The message to be sent, with len 0 if there is
+ *                              nothing to notify
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li> SSLP_ERR_PARAM_INVALID: Either server or notification is a NULL
+ *                                pointer.</li>
+ * </ul>
+ */
+enum sllp_err sllp_server_notify (sllp_server_t *server, uint32_t now,
+                                  struct sllp_raw_packet *notification);
 
+// Incremental frame decoder. Splits a byte stream (TCP, UART, ...) into the
+// packets sllp_process_packet takes, whatever the sizes of the chunks it
+// arrives in. The caller provides the memory, so it can be static.
+struct sllp_decoder
+{
+    uint16_t len;                   // Bytes of the current packet received
+    uint32_t skip;                  // Bytes of an oversized packet to drop
+    uint8_t  buffer[SLLP_MAX_MESSAGE];
+};
+
+/**
+ * Prepare a decoder for a new stream, discarding any partial packet.
+ *
+ * @param decoder [output] The decoder to be initialized
+ */
+void sllp_decoder_init (struct sllp_decoder *decoder);
+
+/**
+ * Feed received bytes to a decoder. Stops right after the first packet they
+ * complete, returning how many bytes were used, so the rest (e.g. pipelined
+ * requests) must be fed again once the packet is processed.
+ *
+ * A packet found whole at the start of data, with nothing pending, is not
+ * copied: it points into data. Otherwise it points into the decoder. Either
+ * way, it's only valid until the next call.
+ *
+ * A packet announcing more than SLLP_MAX_PAYLOAD bytes comes out as its header
+ * alone, for sllp_process_packet to reject, and the bytes it announced are
+ * dropped as they arrive, so the packets after it come out whole. If the
+ * header can't even tell how many bytes that is, everything is dropped until
+ * sllp_decoder_init: the stream should be closed.
+ *
+ * @param decoder [input/output] The decoder of the stream
+ * @param data [input] The next bytes of the stream
+ * @param len [input] How many bytes data has
+ * @param packet [output] A complete packet, or one with NULL data and len 0 if
+ *                        more bytes are needed
+ *
+ * @return Number of bytes of data used, len unless a packet was completed
+ */
+size_t sllp_decoder_feed (struct sllp_decoder *decoder, uint8_t *data,
+                          size_t len, struct sllp_raw_packet *packet);
+
+// Ring buffer curve. Samples a set of variables at a fixed rate into a
+// circular buffer, which clients read as a read-only curve. Each block holds
+// as many whole samples as fit, one after the other, and is zero after them.
+// Sample n (counting from 0) lands in block (n % capacity)/per_block, so
+// comparing index with its value at the last read tells which blocks have new
+// samples.
+struct sllp_ring
+{
+    struct sllp_curve curve;        // The samples, to be registered
+    struct sllp_var   index_var;    // Read-only variable holding index, to be
+                                    // registered
+    uint32_t          index;        // Samples taken so far, wrapping around
+
+    // Filled by sllp_ring_init
+    struct sllp_var *const *vars;   // Variables sampled, in order
+    uint8_t           count;
+    uint8_t          *buffer;
+    uint16_t          sample_size;  // Sum of the sizes of the variables
+    uint16_t          per_block;    // Samples in a block
+    uint32_t          capacity;     // Samples in the whole curve
+    uint16_t          period;       // Time between samples, in ms
+    uint32_t          next_at;      // When the next sample is due
+    bool              started;
+};
+
+/**
+ * Prepare a ring buffer curve. Its curve and index_var must then be registered
+ * with the server like any other curve and variable. Static servers list them
+ * in sllp_server_config.h instead, e.g. CURVE(wave, ring.curve) and
+ * VAR(wave_index, 4, ring.index) among the read-only variables.
+ *
+ * The variables sampled don't have to be registered.
+ *
+ * @param ring [output] The ring buffer curve
+ * @param vars [input] Variables to be sampled. Must remain valid while the
+ *                     ring is in use.
+ * @param count [input] How many variables there are
+ * @param buffer [input] Memory for the samples, (nblocks + 1) blocks of
+ *                       SLLP_CURVE_BLOCK_SIZE bytes
+ * @param nblocks [input] Number of blocks of the curve, minus 1
+ * @param period [input] Time between samples, in milliseconds
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: ring, vars, a variable or buffer is a NULL
+ *                               pointer, or count is 0.</li>
+ *   <li>SLLP_ERR_PARAM_OUT_OF_RANGE: a sample wouldn't fit a block.</li>
+ * </ul>
+ */
+enum sllp_err sllp_ring_init (struct sllp_ring *ring,
+                              struct sllp_var *const *vars, uint8_t count,
+                              uint8_t *buffer, uint8_t nblocks,
+                              uint16_t period);
+
+/**
+ * Take a sample if the period elapsed since the last one. Should be called
+ * more often than the period, with a millisecond clock that may wrap around,
+ * and not concurrently with sllp_process_packet. Values are copied under the
+ * seqlock, if there is one.
+ *
+ * The checksum of the curve is recomputed from the whole curve, since it
+ * changes all the time.
+ *
+ * @param server [input] Handle to the server instance the ring is registered
+ *                       with.
+ * @param ring [input] The ring buffer curve
+ * @param now [input] Current time, in milliseconds
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: server or ring is a NULL pointer, or the ring
+ *                               wasn't initialized.</li>
+ * </ul>
+ */
+enum sllp_err sllp_ring_sample (sllp_server_t *server, struct sllp_ring *ring,
+                                uint32_t now);
+
+#endif
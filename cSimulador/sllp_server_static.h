@@ -0,0 +1,80 @@
+#ifndef SLLP_SERVER_STATIC_H
+#define SLLP_SERVER_STATIC_H
+
+/*
+ * Static server configuration, for firmware built with SLLP_SERVER_STATIC.
+ *
+ * Instead of registering variables and curves at run time, the server takes
+ * them from constant tables, which the compiler can place in flash along with
+ * the standard groups and the answer to CMD_QUERY_VARS_LIST. The tables are
+ * built from sllp_server_config.h, provided by the application, which must
+ * define:
+ *
+ *   SLLP_STATIC_READ_VARS(VAR)   Read-only variables, as VAR(name, size, value)
+ *   SLLP_STATIC_WRITE_VARS(VAR)  Writable variables, as VAR(name, size, value)
+ *   SLLP_STATIC_CURVES(CURVE)    Curves, as CURVE(name, curve)
+ *   SLLP_STATIC_MAX_GROUPS       How many groups clients can create
+ *   SLLP_STATIC_MAX_GROUP_VARS   How many variables those groups can hold,
+ *                                all together
+ *
+ * and may define:
+ *
+ *   SLLP_STATIC_MAX_SUBSCRIPTIONS  How many variables clients can subscribe
+ *                                  to (0 if not defined)
+ *   SLLP_STATIC_BATCH              To take CMD_BATCH, at the cost of a buffer
+ *                                  of SLLP_MAX_MESSAGE bytes
+ *
+ * value is the object holding the variable, size bytes long, and curve a
+ * struct sllp_curve with writable, nblocks, read_block and write_block filled,
+ * and read_range if wanted.
+ * Read-only variables get the first IDs, in the order they are listed,
+ * followed by the writable ones. This way every standard group is a range of
+ * IDs and takes no memory. For example:
+ *
+ *   extern uint32_t status;
+ *   extern float    setpoint;
+ *   extern struct sllp_curve waveform;
+ *
+ *   #define SLLP_STATIC_READ_VARS(VAR)    VAR(status, 4, status)
+ *   #define SLLP_STATIC_WRITE_VARS(VAR)   VAR(setpoint, 4, setpoint)
+ *   #define SLLP_STATIC_CURVES(CURVE)     CURVE(waveform, waveform)
+ *   #define SLLP_STATIC_MAX_GROUPS        2
+ *   #define SLLP_STATIC_MAX_GROUP_VARS    8
+ *
+ * At most 254 variables and 14 curves fit the lists sent to clients.
+ */
+
+#include "sllp_server_config.h"
+
+#ifndef SLLP_STATIC_MAX_SUBSCRIPTIONS
+#define SLLP_STATIC_MAX_SUBSCRIPTIONS   0
+#endif
+
+// ID of a variable or curve, by name
+#define SLLP_VAR_ID(name)       SLLP_VAR_ID_##name
+#define SLLP_CURVE_ID(name)     SLLP_CURVE_ID_##name
+
+#define SLLP_STATIC_ENUM_VAR(name, size, value)     SLLP_VAR_ID(name),
+#define SLLP_STATIC_ENUM_CURVE(name, curve)         SLLP_CURVE_ID(name),
+#define SLLP_STATIC_ADD_ONE(name, size, value)      + 1
+#define SLLP_STATIC_ADD_SIZE(name, size, value)     + (size)
+
+enum sllp_static_var_id
+{
+    SLLP_STATIC_READ_VARS(SLLP_STATIC_ENUM_VAR)
+    SLLP_STATIC_WRITE_VARS(SLLP_STATIC_ENUM_VAR)
+    SLLP_STATIC_VAR_COUNT
+};
+
+enum sllp_static_curve_id
+{
+    SLLP_STATIC_CURVES(SLLP_STATIC_ENUM_CURVE)
+    SLLP_STATIC_CURVE_COUNT
+};
+
+#define SLLP_STATIC_READ_COUNT  (0 SLLP_STATIC_READ_VARS(SLLP_STATIC_ADD_ONE))
+#define SLLP_STATIC_WRITE_COUNT (0 SLLP_STATIC_WRITE_VARS(SLLP_STATIC_ADD_ONE))
+#define SLLP_STATIC_READ_SIZE   (0 SLLP_STATIC_READ_VARS(SLLP_STATIC_ADD_SIZE))
+#define SLLP_STATIC_WRITE_SIZE  (0 SLLP_STATIC_WRITE_VARS(SLLP_STATIC_ADD_SIZE))
+
+#endif  /* SLLP_SERVER_STATIC_H */
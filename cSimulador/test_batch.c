@@ -0,0 +1,102 @@
+/*
+ * Batches whose answers don't all fit the response: the server stops before a
+ * write whose answer might not fit instead of running it and dropping the
+ * answer, and the client learns how many requests were executed.
+ *
+ * Build and run:
+ *
+ *   gcc -std=gnu99 -o test_batch test_batch.c sllp_server.c sllp_client.c \
+ *       sllp.c md5/md5.c crc32c.c deltarle.c && ./test_batch
+ */
+
+#include "sllp_server.h"
+#include "sllp_client.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+static sllp_server_t *server;
+static uint8_t response[SLLP_MAX_MESSAGE];
+static uint32_t response_len;
+
+// The server answers right away, the answer is taken by the next receive
+static int send_func(uint8_t *data, uint32_t *count)
+{
+    struct sllp_raw_packet request = {data, *count};
+    struct sllp_raw_packet answer = {response, 0};
+
+    sllp_process_packet(server, &request, &answer);
+    response_len = answer.len;
+    return 0;
+}
+
+static int recv_func(uint8_t *data, uint32_t *count)
+{
+    memcpy(data, response, response_len);
+    *count = response_len;
+    return 0;
+}
+
+int main(void)
+{
+    // Answers to reading the first two take 2+127 and 2+122 bytes, 253 of the
+    // 254 a response without an extended header has room for
+    static uint8_t big[127], medium[122], small = 1;
+    static struct sllp_var vars[3];
+    static uint8_t big_read[127], medium_read[122];
+    uint8_t value = 2;
+
+    server = sllp_server_new();
+    assert(server);
+
+    vars[0].info.size = sizeof(big);
+    vars[0].data = big;
+    vars[1].info.size = sizeof(medium);
+    vars[1].data = medium;
+    vars[2].info.writable = true;
+    vars[2].info.size = 1;
+    vars[2].data = &small;
+
+    for(unsigned int i = 0; i < 3; i++)
+        assert(!sllp_register_variable(server, &vars[i]));
+
+    sllp_client_t *client = sllp_client_new(send_func, recv_func);
+    assert(client);
+    assert(!sllp_client_init(client));
+
+    // Responses without extended headers have the least room
+    assert(!sllp_use_extended_headers(client, false));
+
+    struct sllp_vars_list *vl;
+    struct sllp_batch batch;
+
+    assert(!sllp_get_vars_list(client, &vl));
+
+    // The answer to the write would fit, but not the write itself
+    assert(!sllp_batch_init(&batch));
+    assert(!sllp_batch_read_var(client, &batch, &vl->list[0], big_read));
+    assert(!sllp_batch_read_var(client, &batch, &vl->list[1], medium_read));
+    assert(!sllp_batch_write_var(client, &batch, &vl->list[2], &value));
+    assert(sllp_batch_submit(client, &batch) == SLLP_ERR_COMM);
+
+    assert(batch.executed == 2);
+    assert(batch.list[0].result == SLLP_SUCCESS);
+    assert(batch.list[1].result == SLLP_SUCCESS);
+    assert(batch.list[2].result == SLLP_ERR_COMM);
+    assert(small == 1);
+
+    // With room, it goes through
+    assert(!sllp_batch_init(&batch));
+    assert(!sllp_batch_read_var(client, &batch, &vl->list[1], medium_read));
+    assert(!sllp_batch_write_var(client, &batch, &vl->list[2], &value));
+    assert(!sllp_batch_submit(client, &batch));
+
+    assert(batch.executed == 2);
+    assert(small == 2);
+
+    sllp_client_destroy(client);
+    sllp_server_destroy(server);
+
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,135 @@
+/*
+ * Two clients of the same server asking for curve checksums in different
+ * modes: each gets its own, whatever the other asked for in between, and MD5
+ * stays the default.
+ *
+ * Build and run:
+ *
+ *   gcc -std=gnu99 -o test_checksum_modes test_checksum_modes.c \
+ *       sllp_server.c sllp_client.c sllp.c md5/md5.c crc32c.c deltarle.c && \
+ *       ./test_checksum_modes
+ */
+
+#include "sllp_server.h"
+#include "sllp_client.h"
+#include "crc32c.h"
+#include "md5/md5.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+static sllp_server_t *server;
+static uint8_t response[SLLP_MAX_MESSAGE];
+static uint32_t response_len;
+static uint8_t memory[SLLP_CURVE_BLOCK_SIZE];
+
+// The server answers right away, the answer is taken by the next receive
+static int send_func(uint8_t *data, uint32_t *count)
+{
+    struct sllp_raw_packet request = {data, *count};
+    struct sllp_raw_packet answer = {response, 0};
+
+    sllp_process_packet(server, &request, &answer);
+    response_len = answer.len;
+    return 0;
+}
+
+static int recv_func(uint8_t *data, uint32_t *count)
+{
+    memcpy(data, response, response_len);
+    *count = response_len;
+    return 0;
+}
+
+static void read_block(struct sllp_curve *curve, uint8_t block, uint8_t *data)
+{
+    (void) curve; (void) block;
+    memcpy(data, memory, sizeof(memory));
+}
+
+static void write_block(struct sllp_curve *curve, uint8_t block, uint8_t *data)
+{
+    (void) curve; (void) block;
+    memcpy(memory, data, sizeof(memory));
+}
+
+// A single block curve has the digest of its data as checksum
+static void expected_md5(uint8_t *checksum)
+{
+    MD5_CTX md5ctx;
+
+    MD5Init(&md5ctx);
+    MD5Update(&md5ctx, memory, sizeof(memory));
+    MD5Final(checksum, &md5ctx);
+}
+
+static void expected_crc32c(uint8_t *checksum)
+{
+    uint32_t crc = crc32c(0, memory, sizeof(memory));
+
+    memset(checksum, 0, 16);
+    checksum[0] = crc >> 24;
+    checksum[1] = crc >> 16;
+    checksum[2] = crc >> 8;
+    checksum[3] = crc;
+}
+
+int main(void)
+{
+    static struct sllp_curve curve;
+    uint8_t expected[16];
+    unsigned int i;
+
+    for(i = 0; i < sizeof(memory); i++)
+        memory[i] = i*7;
+
+    server = sllp_server_new();
+    assert(server);
+
+    curve.info.writable = true;
+    curve.read_block = read_block;
+    curve.write_block = write_block;
+    assert(!sllp_register_curve(server, &curve));
+
+    sllp_client_t *md5 = sllp_client_new(send_func, recv_func);
+    sllp_client_t *crc = sllp_client_new(send_func, recv_func);
+    struct sllp_curves_list *md5_curves, *crc_curves;
+
+    assert(md5 && crc);
+    assert(!sllp_client_init(md5));
+    assert(!sllp_client_init(crc));
+    assert(!sllp_set_checksum_mode(crc, SLLP_CHECKSUM_CRC32C));
+
+    assert(!sllp_get_curves_list(crc, &crc_curves));
+    assert(!sllp_recalc_checksum(crc, &crc_curves->list[0]));
+    expected_crc32c(expected);
+    assert(!memcmp(crc_curves->list[0].checksum, expected, 16));
+
+    // The CRC-32C one didn't go to the curves list
+    assert(!sllp_get_curves_list(md5, &md5_curves));
+    assert(!sllp_recalc_checksum(md5, &md5_curves->list[0]));
+    assert(!sllp_get_curves_list(md5, &md5_curves));
+    expected_md5(expected);
+    assert(!memcmp(md5_curves->list[0].checksum, expected, 16));
+    assert(!memcmp(curve.info.checksum, expected, 16));
+
+    // Both trees follow the writes
+    memory[100] ^= 0xFF;
+    assert(!sllp_send_curve_block(crc, &crc_curves->list[0], 0, memory));
+
+    assert(!sllp_recalc_checksum(crc, &crc_curves->list[0]));
+    expected_crc32c(expected);
+    assert(!memcmp(crc_curves->list[0].checksum, expected, 16));
+
+    assert(!sllp_recalc_checksum(md5, &md5_curves->list[0]));
+    assert(!sllp_get_curves_list(md5, &md5_curves));
+    expected_md5(expected);
+    assert(!memcmp(md5_curves->list[0].checksum, expected, 16));
+
+    sllp_client_destroy(md5);
+    sllp_client_destroy(crc);
+    sllp_server_destroy(server);
+
+    printf("ok\n");
+    return 0;
+}
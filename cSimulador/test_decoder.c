@@ -0,0 +1,110 @@
+/*
+ * A stream with an oversized packet in it: the packet is rejected and the
+ * bytes it announced are dropped, so the valid packet after it is decoded and
+ * answered, however the stream is split into chunks.
+ *
+ * Build and run:
+ *
+ *   gcc -std=gnu99 -o test_decoder test_decoder.c sllp_server.c sllp.c \
+ *       md5/md5.c crc32c.c deltarle.c && ./test_decoder
+ */
+
+#include "sllp_server.h"
+#include "common.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define OVERSIZE        (MAX_PAYLOAD + 100)
+
+static sllp_server_t *server;
+static struct sllp_decoder decoder;
+static uint8_t stream[2*SLLP_MAX_MESSAGE];
+static uint8_t response[SLLP_MAX_MESSAGE];
+
+// Feed len bytes of stream in chunks of the given size, returning the
+// commands of the answers to the packets decoded
+static unsigned int feed (size_t len, size_t chunk, uint8_t *answers)
+{
+    unsigned int count = 0;
+    size_t pos = 0;
+
+    sllp_decoder_init(&decoder);
+
+    while(pos < len)
+    {
+        size_t end = pos + chunk < len ? pos + chunk : len;
+
+        while(pos < end)
+        {
+            struct sllp_raw_packet packet;
+
+            pos += sllp_decoder_feed(&decoder, stream + pos, end - pos,
+                                     &packet);
+
+            if(packet.data)
+            {
+                struct sllp_raw_packet answer = {response, 0};
+
+                sllp_process_packet(server, &packet, &answer);
+                answers[count++] = response[0];
+            }
+        }
+    }
+
+    return count;
+}
+
+int main (void)
+{
+    static uint8_t value[4] = {1, 2, 3, 4};
+    static struct sllp_var var;
+    uint8_t answers[8];
+    size_t header, len, chunk;
+
+    server = sllp_server_new();
+    assert(server);
+
+    var.info.size = sizeof(value);
+    var.data = value;
+    assert(!sllp_register_variable(server, &var));
+
+    // A packet announcing more than a message can carry, whose payload is
+    // made of valid looking packets
+    header = header_encode(stream, CMD_READ_VAR, OVERSIZE, true);
+
+    for(len = header; len < header + OVERSIZE; len += 3)
+    {
+        stream[len] = CMD_READ_VAR;
+        stream[len + 1] = 1;
+        stream[len + 2] = 0;
+    }
+    len = header + OVERSIZE;
+
+    stream[len++] = CMD_READ_VAR;
+    stream[len++] = 1;
+    stream[len++] = 0;
+
+    for(chunk = 1; chunk <= len; chunk = chunk < 16 ? chunk + 1 : chunk*3)
+    {
+        assert(feed(len, chunk, answers) == 2);
+        assert(answers[0] == CMD_ERR_MALFORMED_MESSAGE);
+        assert(answers[1] == CMD_VAR_READING);
+        assert(!memcmp(response + HEADER_SIZE, value, sizeof(value)));
+    }
+
+    // With a size that doesn't end, nothing after it can be trusted until the
+    // decoder starts over
+    stream[2] = stream[3] = stream[4] = 0x80;
+    assert(feed(len, len, answers) == 1);
+    assert(answers[0] == CMD_ERR_MALFORMED_MESSAGE);
+
+    memmove(stream, stream + len - 3, 3);
+    assert(feed(3, 3, answers) == 1);
+    assert(answers[0] == CMD_VAR_READING);
+
+    sllp_server_destroy(server);
+
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,80 @@
+/*
+ * Ring buffer curves are read-only and have no write_block. Writes of their
+ * blocks, raw or compressed, are refused instead of reaching it, while reads
+ * still return the samples.
+ *
+ * Build and run:
+ *
+ *   gcc -std=gnu99 -o test_ring_curve test_ring_curve.c sllp_server.c \
+ *       sllp.c md5/md5.c crc32c.c deltarle.c && ./test_ring_curve
+ */
+
+#include "sllp_server.h"
+#include "common.h"
+#include "deltarle.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+static sllp_server_t *server;
+static uint8_t request[SLLP_MAX_MESSAGE];
+static uint8_t response[SLLP_MAX_MESSAGE];
+
+static uint8_t transact (uint32_t len)
+{
+    struct sllp_raw_packet in = {request, len};
+    struct sllp_raw_packet out = {response, 0};
+
+    assert(!sllp_process_packet(server, &in, &out));
+    return response[0];
+}
+
+int main (void)
+{
+    static uint8_t buffer[2*SLLP_CURVE_BLOCK_SIZE];
+    static struct sllp_ring ring;
+    static struct sllp_var sampled;
+    struct sllp_var *vars[] = {&sampled};
+    uint8_t value = 0x5A;
+    size_t size;
+
+    sampled.info.size = 1;
+    sampled.data = &value;
+
+    server = sllp_server_new();
+    assert(server);
+    assert(!sllp_ring_init(&ring, vars, 1, buffer, 1, 10));
+    assert(!sllp_register_curve(server, &ring.curve));
+    assert(!sllp_register_variable(server, &ring.index_var));
+    assert(!sllp_ring_sample(server, &ring, 0));
+
+    // A raw block
+    request[0] = CMD_CURVE_BLOCK;
+    request[1] = MAX_PAYLOAD_ENCODED;
+    request[2] = ring.curve.info.id;
+    request[3] = 0;
+    memset(request + 4, 0xFF, SLLP_CURVE_BLOCK_SIZE);
+    assert(transact(SLLP_HEADER_SIZE + 2 + SLLP_CURVE_BLOCK_SIZE) ==
+           CMD_ERR_READ_ONLY);
+
+    // A compressed one
+    request[0] = CMD_CURVE_BLOCK_COMPRESSED;
+    size = deltarle_encode(buffer, SLLP_CURVE_BLOCK_SIZE, request + 4,
+                           MAX_PAYLOAD_ENCODED - 3);
+    assert(size);
+    request[1] = 2 + size;
+    assert(transact(SLLP_HEADER_SIZE + 2 + size) == CMD_ERR_READ_ONLY);
+
+    // The samples are still there
+    request[0] = CMD_CURVE_TRANSMIT;
+    request[1] = 2;
+    assert(transact(SLLP_HEADER_SIZE + 2) == CMD_CURVE_BLOCK);
+    assert(response[SLLP_HEADER_SIZE + 2] == 0x5A);
+    assert(!memcmp(response + SLLP_HEADER_SIZE + 2, buffer,
+                   SLLP_CURVE_BLOCK_SIZE));
+
+    sllp_server_destroy(server);
+
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,136 @@
+/*
+ * The simulator serving test_simulator.model over TCP: block writes to its
+ * read-only curve are refused, and the simulator keeps answering afterwards.
+ *
+ * Build and run, next to a built cSimulator:
+ *
+ *   gcc -std=gnu99 -o test_simulator test_simulator.c && ./test_simulator
+ */
+
+#define _GNU_SOURCE
+#include "sllp.h"
+#include "common.h"
+#include <assert.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define PORT            "16791"
+#define MODEL           "test_simulator.model"
+
+static int sock;
+static uint8_t request[SLLP_MAX_MESSAGE];
+static uint8_t response[SLLP_MAX_MESSAGE];
+
+static void receive (uint8_t *data, size_t len)
+{
+    while(len)
+    {
+        ssize_t n = read(sock, data, len);
+
+        assert(n > 0);
+        data += n;
+        len -= n;
+    }
+}
+
+// Send a request whose header and payload are already in request[] and
+// return the command of the answer
+static uint8_t transact (uint32_t len)
+{
+    uint32_t size;
+
+    assert(write(sock, request, len) == (ssize_t) len);
+
+    receive(response, SLLP_HEADER_SIZE);
+    size = response[1] == MAX_PAYLOAD_ENCODED ? MAX_PAYLOAD : response[1];
+    receive(response + SLLP_HEADER_SIZE, size);
+
+    return response[0];
+}
+
+static uint8_t write_block (uint8_t curve)
+{
+    request[0] = CMD_CURVE_BLOCK;
+    request[1] = MAX_PAYLOAD_ENCODED;
+    request[2] = curve;
+    request[3] = 0;
+    memset(request + 4, 0x55, SLLP_CURVE_BLOCK_SIZE);
+
+    return transact(SLLP_HEADER_SIZE + 2 + SLLP_CURVE_BLOCK_SIZE);
+}
+
+int main (int argc, char *argv[])
+{
+    const char *simulator = argc > 1 ? argv[1] : "./cSimulator";
+    struct sockaddr_in addr;
+    struct timespec wait = {0, 10000000};
+    int tries, status;
+    pid_t pid;
+
+    pid = fork();
+    assert(pid >= 0);
+
+    // The simulator goes away with the test, even if an assertion fails
+    if(!pid)
+    {
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        execl(simulator, simulator, "-p", PORT, "-f", MODEL, (char *) NULL);
+        perror(simulator);
+        _exit(1);
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(atoi(PORT));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    // Until the simulator listens
+    for(tries = 0; tries < 200; tries++)
+    {
+        sock = socket(AF_INET, SOCK_STREAM, 0);
+        assert(sock >= 0);
+
+        if(!connect(sock, (struct sockaddr *) &addr, sizeof(addr)))
+            break;
+
+        close(sock);
+        sock = -1;
+        assert(waitpid(pid, &status, WNOHANG) == 0);
+        nanosleep(&wait, NULL);
+    }
+    assert(sock >= 0);
+
+    assert(write_block(0) == CMD_OK);
+    assert(write_block(1) == CMD_ERR_READ_ONLY);
+
+    // Still there, and the read-only curve wasn't touched
+    request[0] = CMD_CURVE_TRANSMIT;
+    request[1] = 2;
+    request[2] = 1;
+    request[3] = 0;
+    assert(transact(SLLP_HEADER_SIZE + 2) == CMD_CURVE_BLOCK);
+    assert(response[SLLP_HEADER_SIZE + 2] != 0x55 ||
+           response[SLLP_HEADER_SIZE + 3] != 0x55);
+
+    request[0] = CMD_READ_VAR;
+    request[1] = 1;
+    request[2] = 0;
+    assert(transact(SLLP_HEADER_SIZE + 1) == CMD_VAR_READING);
+    assert(response[1] == 4 && response[SLLP_HEADER_SIZE] == 7);
+
+    close(sock);
+    kill(pid, SIGTERM);
+    waitpid(pid, &status, 0);
+
+    printf("ok\n");
+    return 0;
+}
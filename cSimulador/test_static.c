@@ -0,0 +1,166 @@
+/*
+ * Client against a server built with SLLP_SERVER_STATIC, configured by
+ * test_static/sllp_server_config.h: the variables, groups and curve of the
+ * constant tables go through, and the hook gets each variable affected, in
+ * order, as it does in dynamic builds.
+ *
+ * Build and run:
+ *
+ *   gcc -std=gnu99 -DSLLP_SERVER_STATIC -I. -Itest_static -o test_static \
+ *       test_static.c sllp_server.c sllp_client.c sllp.c md5/md5.c crc32c.c \
+ *       deltarle.c && ./test_static
+ */
+
+#include "sllp_server.h"
+#include "sllp_client.h"
+#include "sllp_server_static.h"
+#include "common.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+uint32_t status = 7;
+uint32_t setpoint;
+uint16_t gain;
+struct sllp_curve waveform;
+
+static sllp_server_t *server;
+static uint8_t response[SLLP_MAX_MESSAGE];
+static uint32_t response_len;
+static uint8_t memory[SLLP_CURVE_BLOCK_SIZE];
+
+static struct
+{
+    enum sllp_operation op;
+    uint16_t id;
+}hooked[8];
+static unsigned int hooked_count;
+
+// The server answers right away, the answer is taken by the next receive
+static int send_func(uint8_t *data, uint32_t *count)
+{
+    struct sllp_raw_packet request = {data, *count};
+    struct sllp_raw_packet answer = {response, 0};
+
+    sllp_process_packet(server, &request, &answer);
+    response_len = answer.len;
+    return 0;
+}
+
+static int recv_func(uint8_t *data, uint32_t *count)
+{
+    memcpy(data, response, response_len);
+    *count = response_len;
+    return 0;
+}
+
+static void hook(enum sllp_operation op, const struct sllp_var *var)
+{
+    assert(hooked_count < sizeof(hooked)/sizeof(hooked[0]));
+    hooked[hooked_count].op = op;
+    hooked[hooked_count].id = var->info.id;
+    hooked_count++;
+}
+
+static void read_block(struct sllp_curve *curve, uint8_t block, uint8_t *data)
+{
+    (void) curve; (void) block;
+    memcpy(data, memory, sizeof(memory));
+}
+
+static void write_block(struct sllp_curve *curve, uint8_t block, uint8_t *data)
+{
+    (void) curve; (void) block;
+    memcpy(memory, data, sizeof(memory));
+}
+
+int main(void)
+{
+    static uint8_t block[SLLP_CURVE_BLOCK_SIZE];
+    uint8_t values[8];
+    unsigned int i;
+
+    waveform.info.writable = true;
+    waveform.read_block = read_block;
+    waveform.write_block = write_block;
+
+    server = sllp_server_new();
+    assert(server);
+    assert(!sllp_register_hook(server, hook));
+
+    sllp_client_t *client = sllp_client_new(send_func, recv_func);
+    struct sllp_vars_list *vars;
+    struct sllp_groups_list *groups;
+    struct sllp_curves_list *curves;
+
+    assert(client);
+    assert(!sllp_client_init(client));
+    assert(!sllp_get_vars_list(client, &vars));
+    assert(!sllp_get_groups_list(client, &groups));
+    assert(!sllp_get_curves_list(client, &curves));
+
+    // Read-only variables first, in the order of the configuration
+    assert(vars->count == SLLP_STATIC_VAR_COUNT);
+    assert(!vars->list[SLLP_VAR_ID(status)].writable);
+    assert(vars->list[SLLP_VAR_ID(status)].size == 4);
+    assert(vars->list[SLLP_VAR_ID(setpoint)].writable);
+    assert(vars->list[SLLP_VAR_ID(gain)].size == 2);
+    assert(curves->count == SLLP_STATIC_CURVE_COUNT);
+
+    assert(!sllp_read_var(client, &vars->list[SLLP_VAR_ID(status)], values));
+    assert(!memcmp(values, &status, sizeof(status)));
+    assert(hooked_count == 1);
+    assert(hooked[0].op == SLLP_OP_READ);
+    assert(hooked[0].id == SLLP_VAR_ID(status));
+
+    // A standard group: one call for each variable
+    hooked_count = 0;
+    setpoint = 0x01020304;
+    gain = 0x0506;
+    memcpy(values, &setpoint, 4);
+    memcpy(values + 4, &gain, 2);
+    for(i = 0; i < 6; i++)
+        values[i] ^= 0xFF;
+
+    assert(!sllp_write_group(client, &groups->list[GROUP_WRITE_ID], values));
+    assert(setpoint == ~0x01020304u);
+    assert(gain == (uint16_t) ~0x0506);
+    assert(hooked_count == 2);
+    assert(hooked[0].op == SLLP_OP_WRITE);
+    assert(hooked[0].id == SLLP_VAR_ID(setpoint));
+    assert(hooked[1].op == SLLP_OP_WRITE);
+    assert(hooked[1].id == SLLP_VAR_ID(gain));
+
+    // A created one, in the order it was created with
+    struct sllp_var_info *members[] = {&vars->list[SLLP_VAR_ID(gain)],
+                                       &vars->list[SLLP_VAR_ID(status)], NULL};
+
+    assert(!sllp_create_group(client, members));
+    assert(!sllp_get_groups_list(client, &groups));
+    assert(groups->count == GROUP_STANDARD_COUNT + 1);
+
+    hooked_count = 0;
+    assert(!sllp_read_group(client, &groups->list[GROUP_STANDARD_COUNT],
+                            values));
+    assert(!memcmp(values, &gain, 2));
+    assert(!memcmp(values + 2, &status, 4));
+    assert(hooked_count == 2);
+    assert(hooked[0].id == SLLP_VAR_ID(gain));
+    assert(hooked[1].id == SLLP_VAR_ID(status));
+
+    // The curve
+    for(i = 0; i < sizeof(block); i++)
+        block[i] = i*3;
+
+    assert(!sllp_send_curve_block(client, &curves->list[0], 0, block));
+    assert(!memcmp(memory, block, sizeof(block)));
+    memset(block, 0, sizeof(block));
+    assert(!sllp_request_curve_block(client, &curves->list[0], 0, block));
+    assert(!memcmp(memory, block, sizeof(block)));
+
+    sllp_client_destroy(client);
+    sllp_server_destroy(server);
+
+    printf("ok\n");
+    return 0;
+}
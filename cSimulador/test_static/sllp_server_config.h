@@ -0,0 +1,20 @@
+#ifndef SLLP_SERVER_CONFIG_H
+#define SLLP_SERVER_CONFIG_H
+
+// Configuration of the static server of test_static.c
+
+#include "sllp.h"
+
+extern uint32_t status;
+extern uint32_t setpoint;
+extern uint16_t gain;
+extern struct sllp_curve waveform;
+
+#define SLLP_STATIC_READ_VARS(VAR)      VAR(status, 4, status)
+#define SLLP_STATIC_WRITE_VARS(VAR)     VAR(setpoint, 4, setpoint)          \
+                                        VAR(gain, 2, gain)
+#define SLLP_STATIC_CURVES(CURVE)       CURVE(waveform, waveform)
+#define SLLP_STATIC_MAX_GROUPS          1
+#define SLLP_STATIC_MAX_GROUP_VARS      2
+
+#endif  /* SLLP_SERVER_CONFIG_H */
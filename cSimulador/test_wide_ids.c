@@ -0,0 +1,175 @@
+/*
+ * Client against a server with more variables than one byte IDs can tell,
+ * switched to wide IDs. The client learns that from the capabilities of the
+ * server, every request that carries an ID goes through, and lists and
+ * notifications come back right.
+ *
+ * Build and run:
+ *
+ *   gcc -std=gnu99 -o test_wide_ids test_wide_ids.c sllp_server.c \
+ *       sllp_client.c sllp.c md5/md5.c crc32c.c deltarle.c && ./test_wide_ids
+ */
+
+#include "sllp_server.h"
+#include "sllp_client.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define NUM_VARS    300
+
+static sllp_server_t *server;
+static uint8_t response[SLLP_MAX_MESSAGE];
+static uint32_t response_len;
+
+// The server answers right away, the answer is taken by the next receive
+static int send_func(uint8_t *data, uint32_t *count)
+{
+    struct sllp_raw_packet request = {data, *count};
+    struct sllp_raw_packet answer = {response, 0};
+
+    sllp_process_packet(server, &request, &answer);
+    response_len = answer.len;
+    return 0;
+}
+
+static int recv_func(uint8_t *data, uint32_t *count)
+{
+    memcpy(data, response, response_len);
+    *count = response_len;
+    return 0;
+}
+
+static struct sllp_var_info *notified;
+static uint8_t notified_value;
+
+static void notify(struct sllp_var_info *var, const uint8_t *value, void *user)
+{
+    (void) user;
+    notified = var;
+    notified_value = *value;
+}
+
+int main(void)
+{
+    static struct sllp_var vars[NUM_VARS];
+    static uint8_t values[NUM_VARS];
+    unsigned int i;
+
+    server = sllp_server_new();
+    assert(server);
+    assert(!sllp_server_wide_ids(server, true));
+
+    for(i = 0; i < NUM_VARS; i++)
+    {
+        vars[i].info.writable = true;
+        vars[i].info.size = 1;
+        vars[i].data = &values[i];
+        values[i] = i;
+        assert(!sllp_register_variable(server, &vars[i]));
+    }
+
+    sllp_client_t *client = sllp_client_new(send_func, recv_func);
+    assert(client);
+    assert(!sllp_client_init(client));
+
+    struct sllp_vars_list *vl;
+    struct sllp_groups_list *gl;
+
+    assert(!sllp_get_vars_list(client, &vl));
+    assert(vl->count == NUM_VARS);
+    assert(!sllp_get_groups_list(client, &gl));
+    assert(gl->list[0].vars.count == NUM_VARS);
+    assert(gl->list[0].vars.list[NUM_VARS - 1] == &vl->list[NUM_VARS - 1]);
+
+    // Variables past the first 256
+    struct sllp_var_info *last = &vl->list[NUM_VARS - 1];
+    uint8_t value = 0;
+
+    assert(!sllp_read_var(client, last, &value));
+    assert(value == (uint8_t)(NUM_VARS - 1));
+
+    value = 0xA5;
+    assert(!sllp_write_var(client, last, &value));
+    assert(values[NUM_VARS - 1] == 0xA5);
+
+    value = 0x0F;
+    assert(!sllp_bin_op_var(client, BIN_OP_AND, last, &value));
+    assert(values[NUM_VARS - 1] == 0x05);
+
+    uint8_t expected = 0x05;
+    bool swapped;
+
+    value = 0x10;
+    assert(!sllp_cas_var(client, last, &expected, &value, &swapped));
+    assert(swapped && values[NUM_VARS - 1] == 0x10);
+
+    uint8_t old;
+
+    value = 1;
+    assert(!sllp_fetch_add_var(client, last, &value, &old));
+    assert(old == 0x10 && values[NUM_VARS - 1] == 0x11);
+
+    // A group made of them
+    struct sllp_var_info *members[] = {&vl->list[258], last, &vl->list[3],
+                                       NULL};
+    uint8_t group_values[3];
+
+    assert(!sllp_create_group(client, members));
+    assert(!sllp_get_groups_list(client, &gl));
+    assert(gl->count == 4);
+
+    struct sllp_group *grp = &gl->list[3];
+
+    assert(grp->vars.count == 3 && grp->size == 3);
+    assert(grp->vars.list[0] == &vl->list[258] && grp->vars.list[1] == last);
+
+    assert(!sllp_read_group(client, grp, group_values));
+    assert(group_values[0] == (uint8_t) 258 && group_values[1] == 0x11 &&
+           group_values[2] == 3);
+
+    group_values[0] = 1;
+    group_values[1] = 2;
+    group_values[2] = 3;
+    assert(!sllp_write_group(client, grp, group_values));
+    assert(values[258] == 1 && values[NUM_VARS - 1] == 2);
+
+    // Batches
+    struct sllp_batch batch;
+    uint8_t read_back = 0;
+
+    value = 0x77;
+    assert(!sllp_batch_init(&batch));
+    assert(!sllp_batch_write_var(client, &batch, &vl->list[280], &value));
+    assert(!sllp_batch_read_var(client, &batch, &vl->list[280], &read_back));
+    assert(!sllp_batch_submit(client, &batch));
+    assert(values[280] == 0x77 && read_back == 0x77);
+
+    // Notifications
+    struct sllp_raw_packet notification;
+    static uint8_t notification_data[SLLP_MAX_MESSAGE];
+
+    assert(!sllp_register_notify(client, notify, NULL));
+    assert(!sllp_subscribe(client, &vl->list[290], 0, 0));
+
+    notification.data = notification_data;
+    notification.len = 0;
+    assert(!sllp_server_notify(server, 0, &notification));
+
+    values[290] = 0x42;
+    notification.len = 0;
+    assert(!sllp_server_notify(server, 1, &notification));
+    assert(notification.len);
+    assert(!sllp_process_notification(client, notification.data,
+                                      notification.len));
+    assert(notified == &vl->list[290] && notified_value == 0x42);
+
+    assert(!sllp_unsubscribe(client, &vl->list[290]));
+    assert(!sllp_remove_all_groups(client));
+
+    sllp_client_destroy(client);
+    sllp_server_destroy(server);
+
+    printf("ok\n");
+    return 0;
+}